@@ -30,5 +30,16 @@
 
 #define ESP_RST PIN_PB05
 #define ESP_BUSY PIN_PB04
+#define ESP_CS PIN_PB15
+
+// The ESP32's SPI, for USE_ESP_OTA
+#define ESP_SPI_MODULE                    SERCOM2
+#define ESP_SPI_MASK                      APBBMASK
+#define ESP_SPI_BUS_CLOCK_INDEX           MCLK_APBBMASK_SERCOM2
+#define ESP_SPI_PAD_SETTINGS              (SERCOM_SPI_CTRLA_DOPO(0) | SERCOM_SPI_CTRLA_DIPO(2))
+#define ESP_SPI_MOSI                      PINMUX_PA12C_SERCOM2_PAD0
+#define ESP_SPI_SCK                       PINMUX_PA13C_SERCOM2_PAD1
+#define ESP_SPI_MISO                      PINMUX_PA14C_SERCOM2_PAD2
+#define ESP_GCLK_ID_CORE                  SERCOM2_GCLK_ID_CORE
 
 #endif
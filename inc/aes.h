@@ -0,0 +1,17 @@
+#ifndef AES_H
+#define AES_H
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES_KEY_SIZE 16
+#define AES_NONCE_SIZE 12
+
+// Sets up AES-128 with key; on the SAMD51 this loads the AES peripheral
+void aes_set_key(const uint8_t *key);
+
+// AES-128-CTR over len bytes (a multiple of AES_BLOCK_SIZE) at data, in place. The counter block
+// is nonce followed by the big endian counter, which goes up by one every 16 bytes.
+void aes_ctr(const uint8_t *nonce, uint32_t counter, uint8_t *data, uint32_t len);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef BOOT_TABLE_H
 #define BOOT_TABLE_H
 #include "uf2.h"
+#include "multiboot.h"
 
 typedef struct {
     uint32_t id;
@@ -16,4 +17,103 @@ typedef struct {
     const BootVectorEntry *entry;
 } BootModules;
 
-#endif
\ No newline at end of file
+// The boot table lives in the last erase unit(s) of flash, outside of the space modules can
+// use. It is written like any other flash, with a UF2 file (see scripts/gen_boot_table.py) or
+// HF2 WRITE_FLASH_PAGE.
+#ifdef SAMD51
+#define BOOT_TABLE_SIZE NVMCTRL_BLOCK_SIZE
+#else
+#define BOOT_TABLE_SIZE (4 * FLASH_ROW_SIZE)
+#endif
+#if USE_BANK_SWAP
+// Every bank carries its own table, updated along with the modules
+#define BOOT_TABLE_ADDR (FLASH_BANK_SIZE - BOOT_TABLE_SIZE)
+#else
+#define BOOT_TABLE_ADDR (FLASH_SIZE - BOOT_TABLE_SIZE)
+#endif
+// End of the flash available to modules
+#define APP_END_ADDRESS BOOT_TABLE_ADDR
+
+#define BOOT_TABLE_MAGIC 0x4c425442 // "BTBL"
+#define BOOT_TABLE_VERSION 3
+// Without a table, slots at this alignment are scanned for multiboot headers
+#define BOOT_TABLE_SCAN_STEP 0x2000
+
+#define BOOT_TABLE_NAME_LEN 16
+#define BOOT_TABLE_OPTS_LEN 32
+
+// On-flash version of BootVectorEntry; strings are NUL terminated
+typedef struct {
+    uint32_t id;
+    uint32_t flash_start;
+    uint32_t flash_len;
+    char module_name[BOOT_TABLE_NAME_LEN];
+    char command_line_opts[BOOT_TABLE_OPTS_LEN];
+} BootTableEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t module_cnt;
+    BootTableEntry entries[MB_MAX_MODULES];
+    // A/B slots: when slot_b_start is set, module 0 has a second slot of entries[0].flash_len
+    // bytes there. active_slot (0 = entries[0].flash_start, 1 = slot_b_start) is the one booted;
+    // the bootloader flips it after staging an update and on rollback.
+    uint32_t slot_b_start;
+    uint32_t active_slot;
+    // How long a second reset counts as a double tap, in ms; 0 for DBL_TAP_DEFAULT_MS
+    uint32_t dbl_tap_ms;
+    // CRC16 (add_crc) of everything above
+    uint32_t crc;
+} BootTable;
+
+STATIC_ASSERT(sizeof(BootTable) <= BOOT_TABLE_SIZE);
+
+#define BOOT_TABLE ((const BootTable *)BOOT_TABLE_ADDR)
+
+#define DBL_TAP_DEFAULT_MS 500
+
+// Boot attempts of the active slot, handed to the application in the double tap word
+// (UF2_BOOT_STATE_PTR) and recorded in the boot log below. Until the application calls
+// uf2_confirm_boot(), every boot counts as an attempt; after BOOT_MAX_ATTEMPTS the bootloader rolls
+// back to the other slot.
+#define BOOT_STATE_SLOT(state) (((state) >> 8) & 1)
+#define BOOT_STATE_ATTEMPTS(state) ((state) & 0xff)
+#define BOOT_MAX_ATTEMPTS 3
+
+// The boot log keeps the boot state through power loss and stays in the bootloader. It fills the
+// erase unit(s) of the table from the row after it (gen_boot_table.py pads the rest with 0xff):
+// one state word per write unit, a quad word on the SAMD51 and a page on the SAMD21, so every
+// record goes to blank flash. A record is appended whenever the state changes: on every
+// unconfirmed attempt, on the first boot after a confirmation, on rollback and on commit. The last
+// one is the state; when they run out, the table is rewritten and the log starts over.
+#ifdef SAMD51
+#define BOOT_LOG_UNIT 16
+#else
+#define BOOT_LOG_UNIT FLASH_PAGE_SIZE
+#endif
+#define BOOT_LOG_ADDR                                                                              \
+    (BOOT_TABLE_ADDR + (sizeof(BootTable) + FLASH_ROW_SIZE - 1) / FLASH_ROW_SIZE * FLASH_ROW_SIZE)
+#define BOOT_LOG_RECORDS ((BOOT_TABLE_ADDR + BOOT_TABLE_SIZE - BOOT_LOG_ADDR) / BOOT_LOG_UNIT)
+
+STATIC_ASSERT(BOOT_LOG_RECORDS >= BOOT_MAX_ATTEMPTS + 2);
+
+// Fills entries (MB_MAX_MODULES long) from the boot table, or from a scan for multiboot headers
+// when the table is missing or corrupt. Returns the number of entries, 0 if nothing was found.
+// With A/B slots, entries[0] is the slot picked by the attempt counter, and the pick counts as
+// an attempt; only call it right before booting.
+int boot_table_load(BootVectorEntry *entries);
+
+// Double tap window from the boot table
+uint32_t boot_table_dbl_tap_ms(void);
+
+// Start of the slot that boots next; APP_START_ADDRESS without A/B slots. The first call has to
+// come before the double tap check, which reuses the word holding the boot state.
+uint32_t boot_slot_active_start(void);
+// False for writes into the active slot, which has to stay intact while an update is staged
+// into the other one
+bool boot_slot_write_allowed(uint32_t addr);
+// Makes a completely written inactive slot the active one, on trial until it is confirmed
+void boot_slot_commit(void);
+
+#endif
@@ -119,6 +119,11 @@ uint32_t cdc_read_buf(void *data, uint32_t length);
  */
 uint32_t cdc_read_buf_xmd(void *data, uint32_t length);
 
+/**
+ * \brief Waits until everything written so far has been taken by the host (or the UART)
+ */
+void cdc_flush(void);
+
 void reset_ep(uint8_t ep);
 void stall_ep(uint8_t ep);
 
@@ -0,0 +1,15 @@
+#ifndef ED25519_H
+#define ED25519_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ED25519_SIGNATURE_SIZE 64
+#define ED25519_PUBLIC_KEY_SIZE 32
+// Longest message ed25519_verify() takes; we only sign digests
+#define ED25519_MAX_MESSAGE 64
+
+// RFC 8032 Ed25519 (pure, no prehash); verification only
+bool ed25519_verify(const uint8_t *sig, const uint8_t *public_key, const uint8_t *msg,
+                    uint32_t len);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef ESP_OTA_H
+#define ESP_OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Updates pushed by the ESP32 co-processor (USE_ESP_OTA). We are the SPI master; the ESP32 pulls
+// ESP_BUSY low once it has a frame armed in its SPI slave, and raises it again as soon as ESP_CS
+// selects it. Every transaction is ESP_OTA_FRAME_SIZE bytes each way, little endian:
+//   from the ESP32: 0xA7, op, seq (16 bits), UF2 block (512 bytes, zeros unless BLOCK), CRC
+//   to the ESP32:   0x7A, status, seq (16), numBlocks (32), numWritten (32), CRC, then zeros
+// with the CRC of add_crc() over everything before it. The next transaction runs while the block
+// of the last one is flashed, so a reply is the status of the frame handled last before the
+// transaction started: the one before the last, or the last one when the ESP32 was slow to arm
+// the next. Each frame gets one status, in order; a frame whose status doesn't come back (or
+// comes back bad) is sent again, blocks already written are skipped. numWritten and numBlocks
+// are those of write_block().
+#define ESP_OTA_FRAME_SYNC 0xA7
+#define ESP_OTA_REPLY_SYNC 0x7A
+#define ESP_OTA_FRAME_SIZE (4 + 512 + 2)
+#define ESP_OTA_REPLY_SIZE 14
+
+#define ESP_OTA_OP_NOP 0   // nothing to flash, for the status
+#define ESP_OTA_OP_BLOCK 1 // a UF2 block
+#define ESP_OTA_OP_START 2 // forgets the blocks of an earlier transfer
+#define ESP_OTA_OP_RESET 3 // resets into the image, once all of its blocks are in and it passed
+
+#define ESP_OTA_OK 0
+#define ESP_OTA_BAD_CRC 1
+#define ESP_OTA_BAD_OP 2
+#define ESP_OTA_BAD_BLOCK 3  // not a UF2 block for this board
+#define ESP_OTA_NOT_DONE 4   // RESET with blocks missing
+#define ESP_OTA_REJECTED 5   // RESET of an image that failed its digest or signature check
+#define ESP_OTA_NONE 0xff    // no frame handled since the last reply
+
+// SPI clock; the ESP32's slave DMA keeps up to about 10 MHz
+#ifndef ESP_SPI_FREQ
+#define ESP_SPI_FREQ 8000000
+#endif
+// How long we wait for the ESP32 to acknowledge ESP_CS, and to arm the next frame before the
+// block of the last one is flashed without overlap
+#define ESP_OTA_ACK_US 200
+#define ESP_OTA_ARM_US 300
+
+// Sets up the SPI link; ESP_RST and ESP_BUSY are left to main()
+void esp_ota_init(void);
+// Takes frames for as long as the ESP32 has them armed, and returns once it hasn't
+void esp_ota_poll(void);
+
+#endif
@@ -30,7 +30,8 @@
 #ifndef _MAIN_H_
 #define _MAIN_H_
 
-#define CPU_FREQUENCY 48000000
+// USE_120MHZ is only defined further down in uf2.h, fine as long as this isn't used in #if
+#define CPU_FREQUENCY (USE_120MHZ ? 120000000 : 48000000)
 
 #define FLASH_WAIT_STATES 1
 
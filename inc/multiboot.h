@@ -7,6 +7,7 @@
 #define MULTIBOOT_ARM7M_ISA 0x6D04
 #define MULTIBOOT_CHECKSUM_SUM 0x0
 
+#define MB_IMAGE_HEADER_TYPE_END 0x00
 #define MB_IMAGE_HEADER_TYPE_INFO_REQ 0x01
 #define MB_IMAGE_HEADER_TYPE_ADDRESS 0x02
 #define MB_IMAGE_HEADER_TYPE_ENTRY_ADDR 0x03
@@ -17,6 +18,7 @@
 #define MB_IMAGE_HEADER_TYPE_ALIGN_MODULE 0x06
 #define MB_IMAGE_HEADER_TYPE_EFI_BOOT_SERVICES 0x07
 #define MB_IMAGE_HEADER_TYPE_RELOCATABLE 0x10 // Weird its not 0xA but thats the spec
+#define MB_IMAGE_HEADER_TYPE_SHA256 0x20 // ARM extension
 
 #define MB_BOOT_INFO_BASIC_MEM_INFO 0x04
 #define MB_BOOT_INFO_BIOS_DEVICE 0x05
@@ -45,11 +47,28 @@
 #define MB_MAX_IMAGE_HEADER_LEN 255
 #define MB_MAX_MB_REQ 5
 
+// Smallest erase unit. Relocated modules have to start on one, otherwise flash_write_row()
+// would wipe whatever shares the first block with them; it is also our "page" for the
+// module alignment tag.
+#ifdef SAMD51
+#define MB_LOAD_ALIGN NVMCTRL_BLOCK_SIZE
+#else
+#define MB_LOAD_ALIGN FLASH_ROW_SIZE
+#endif
+
 #define MB_NAME(VER) "uf2_adafruit_mb_" #VER
 
 // Name from Makefile
-const char bootloader_version[] = UF2_VERSION_BASE;
-const char bootloader_name[] =  MB_NAME(UF2_VERSION_BASE);
+extern const char bootloader_version[];
+extern const char bootloader_name[];
+
+// Fixed part of the image header; header_length includes it and all the tags after it
+typedef struct {
+    uint32_t magic;
+    uint32_t architecture;
+    uint32_t header_length;
+    uint32_t checksum;
+} MultibootHeader;
 
 // The image header is prependded to a image we wish to boot which will inform the
 // bootloader of basic details
@@ -68,9 +87,116 @@ typedef struct BootInfoTag {
     uint8_t *data;
 } BootInfoTag;
 
+// Data of a MB_IMAGE_HEADER_TYPE_ADDRESS tag
+typedef struct {
+    uint32_t header_addr;
+    uint32_t load_addr;
+    uint32_t load_end_addr;
+    uint32_t bss_end_addr;
+} MultibootAddressTag;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} MemorySpace;
+
+// Where a module lives; ram is empty (start == end) for modules without an address tag
+typedef struct {
+    MemorySpace flash;
+    MemorySpace ram;
+    uint32_t align;
+} ModuleMap;
+
+#define MB_MAP_OK 0
+#define MB_MAP_FLASH_RANGE 1
+#define MB_MAP_FLASH_OVERLAP 2
+#define MB_MAP_RAM_RANGE 3
+#define MB_MAP_RAM_OVERLAP 4
+#define MB_MAP_MISALIGNED 5
+
+// Last module map failure, as (module << 8) | MB_MAP_*; readable over HF2
+extern uint32_t module_map_error;
+
+#define MB_RELOC_PREFERENCE_NONE 0
+#define MB_RELOC_PREFERENCE_LOWEST 1
+#define MB_RELOC_PREFERENCE_HIGHEST 2
+
+// Data of a MB_IMAGE_HEADER_TYPE_RELOCATABLE tag. The first four fields are from the spec,
+// reloc_offset is our ARM extension and gives the offset of the relocation table from the
+// start of the image header. The whole module must lie in [min_addr, max_addr): max_addr is
+// exclusive, the first address past its end.
+typedef struct {
+    uint32_t min_addr;
+    uint32_t max_addr;
+    uint32_t align;
+    uint32_t preference;
+    uint32_t reloc_offset;
+} MultibootRelocatableTag;
+
+#define MB_RELOC_MAGIC 0x4c45524d // "MREL"
+// Stands for a gap of 0xffff words without a fixup
+#define MB_RELOC_SKIP 0xffff
+
+// Relocation table appended to a relocatable module. Every entry is the distance in words from
+// the previous fixup (from the start of the image for the first one); the word found there gets
+// (load address - link_addr) added to it. Entries after the first one are never zero.
+typedef struct {
+    uint32_t magic;
+    uint32_t link_addr;
+    uint32_t image_len;
+    uint32_t num_entries;
+    uint16_t entries[0];
+} MultibootRelocTable;
+
+// Data of a MB_IMAGE_HEADER_TYPE_SHA256 tag. The SHA-256 of the first image_len bytes of the
+// module (header included) is stored right after them.
+typedef struct {
+    uint32_t image_len;
+} MultibootDigestTag;
+
+#define MB_DIGEST_OK 0
+#define MB_DIGEST_NONE 1
+#define MB_DIGEST_BAD 2
+
 // Find a multiboot header within a binary, it must be within the first 32768 bytes
 uint8_t *find_multiboot_header(uint8_t *start);
 
+// Fills result with up to result_len tags; returns the number of tags or a negative error
 int decode_multiboot_image_headers(uint8_t *start, ImageHeaderTag *result, int result_len);
 
-#endif
\ No newline at end of file
+// Same as above, without checking the fixed part of the header first
+int multiboot_parse_tags(uint8_t *start, ImageHeaderTag *result, int result_len);
+
+// Whether a module of len bytes at addr lies within the tag's [min_addr, max_addr)
+bool multiboot_tag_allows(const MultibootRelocatableTag *tag, uint32_t addr, uint32_t len);
+
+// Picks the load address of a relocatable module of len bytes, which must not overlap the
+// [avoid_start, avoid_end) range; returns 0 if the tag can't be satisfied
+uint32_t multiboot_pick_load_addr(const MultibootRelocatableTag *tag, uint32_t len,
+                                  uint32_t avoid_start, uint32_t avoid_end);
+
+// Checks that all modules fit in flash and SRAM, don't overlap and are aligned as requested.
+// Returns MB_MAP_OK or the first problem found; *bad_module is set to the offending module.
+int multiboot_validate_map(const ModuleMap *map, int n, int *bad_module);
+
+// Copies the module to load_addr in flash, applying its relocation table on the way. rel_len is
+// how many bytes from rel on belong to the module; a table that runs past them is refused.
+int multiboot_relocate_module(const uint8_t *src, const MultibootRelocTable *rel, uint32_t rel_len,
+                              uint32_t load_addr);
+
+// Checks the digest of the module at start, which spans at most flash_len bytes; returns one
+// of MB_DIGEST_*
+int multiboot_check_digest(const uint8_t *start, uint32_t flash_len);
+
+// Like multiboot_check_digest(), plus the Ed25519 signature of the digest stored right after
+// it. Unsigned modules give MB_DIGEST_NONE.
+int multiboot_check_signature(const uint8_t *start, uint32_t flash_len);
+
+// Forgets the module of the last transfer
+void multiboot_stream_begin(void);
+// Feeds a row written to flash at addr to the hash of the module being transferred
+void multiboot_stream_row(uint32_t addr, const uint8_t *data);
+// Whether the current transfer wrote a module, and it is properly signed
+bool multiboot_transfer_ok(void);
+
+#endif
@@ -5,12 +5,35 @@
 
 // The timings are taken from Adafruit's NeoPixel library
 
+#if USE_120MHZ
+// The clock goes from 48 to 120 MHz in system_init(), so the three delay loop counts come in
+// the fifth argument, a byte each, and are moved in from r8-r10: mov takes as long as movs.
+// The 120 MHz counts are scaled from the 48 MHz ones, loop overhead included.
+#define NEOPIXEL_DELAYS                                                                            \
+    (current_cpu_frequency_MHz > 48 ? (10 | 17 << 8 | 7 << 16) : (3 | 6 << 8 | 2 << 16))
+#define NEOPIXEL_PUSH                                                                              \
+    "push {r4, r5, r6, r8, r9, r10, lr};"                                                          \
+    "ldr r6, [sp, #28]; ubfx r8, r6, #0, #8; ubfx r9, r6, #8, #8; ubfx r10, r6, #16, #8;"
+#define NEOPIXEL_POP "pop {r4, r5, r6, r8, r9, r10, pc};"
+#define NEOPIXEL_DELAY_HIGH "mov r6, r8;"
+#define NEOPIXEL_DELAY_ONE "mov r6, r9;"
+#define NEOPIXEL_DELAY_LOW "mov r6, r10;"
+#else
+#define NEOPIXEL_DELAYS 0
+#define NEOPIXEL_PUSH "push {r4, r5, r6, lr};"
+#define NEOPIXEL_POP "pop {r4, r5, r6, pc};"
+#define NEOPIXEL_DELAY_HIGH "movs r6, #3;"
+#define NEOPIXEL_DELAY_ONE "movs r6, #6;"
+#define NEOPIXEL_DELAY_LOW "movs r6, #2;"
+#endif
+
 static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMask,
-                                      const uint8_t *ptr, int numBytes) __attribute__((naked));
+                                      const uint8_t *ptr, int numBytes, uint32_t delays)
+    __attribute__((naked));
 
 static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMask,
-                                      const uint8_t *ptr, int numBytes) {
-    asm volatile("        push    {r4, r5, r6, lr};"
+                                      const uint8_t *ptr, int numBytes, uint32_t delays) {
+    asm volatile("        " NEOPIXEL_PUSH
                  "        add     r3, r2, r3;"
                  "loopLoad:"
                  "        ldrb r5, [r2, #0];" // r5 := *ptr
@@ -22,7 +45,7 @@ static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMa
                  "        movs r6, #3; d2: sub r6, #1; bne d2;" // delay 3
                  #endif
                  #ifdef SAMD51
-                 "        movs r6, #3; d2: subs r6, #1; bne d2;" // delay 3
+                 "        " NEOPIXEL_DELAY_HIGH " d2: subs r6, #1; bne d2;" // delay 3
                  #endif
                  "        tst r4, r5;"                          // mask&r5
                  "        bne skipclr;"
@@ -32,7 +55,7 @@ static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMa
                  "        movs r6, #6; d0: sub r6, #1; bne d0;" // delay 6
                  #endif
                  #ifdef SAMD51
-                 "        movs r6, #6; d0: subs r6, #1; bne d0;" // delay 6
+                 "        " NEOPIXEL_DELAY_ONE " d0: subs r6, #1; bne d0;" // delay 6
                  #endif
                  "        str r1, [r0, #0];"   // clr (possibly again, doesn't matter)
                  #ifdef SAMD21
@@ -47,7 +70,7 @@ static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMa
                  "        movs r6, #2; d1: sub r6, #1; bne d1;" // delay 2
                  #endif
                  #ifdef SAMD51
-                 "        movs r6, #2; d1: subs r6, #1; bne d1;" // delay 2
+                 "        " NEOPIXEL_DELAY_LOW " d1: subs r6, #1; bne d1;" // delay 2
                  #endif
                  "        b       loopBit;"
                  "nextbyte:"
@@ -55,7 +78,7 @@ static void neopixel_send_buffer_core(volatile uint32_t *clraddr, uint32_t pinMa
                  "        bcs stop;"
                  "        b loopLoad;"
                  "stop:"
-                 "        pop {r4, r5, r6, pc};"
+                 "        " NEOPIXEL_POP
                  "");
 }
 
@@ -80,10 +103,10 @@ static inline void neopixel_send_buffer(const uint8_t *ptr, int numBytes) {
     // equivalent to cpu_irq_is_enabled()
     if (__get_PRIMASK() == 0) {
         __disable_irq();
-        neopixel_send_buffer_core(clraddr, pinMask, ptr, numBytes);
+        neopixel_send_buffer_core(clraddr, pinMask, ptr, numBytes, NEOPIXEL_DELAYS);
         __enable_irq();
     } else {
-        neopixel_send_buffer_core(clraddr, pinMask, ptr, numBytes);
+        neopixel_send_buffer_core(clraddr, pinMask, ptr, numBytes, NEOPIXEL_DELAYS);
     }
 }
 
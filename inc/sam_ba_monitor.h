@@ -42,6 +42,62 @@
 /* Selects USB as the communication interface of the monitor */
 #define SIZEBUFMAX 64
 
+/*
+ * Binary mode (USE_FAST_MONITOR). "P#" answers "P" followed by the maximum payload in hex and
+ * "#\n\r", after which the monitor only takes frames, until SAM_BA_FAST_OP_EXIT. All fields are
+ * little endian:
+ *   request: 0xA5, op, seq (16 bits), addr (32), len (32), payload (len bytes, WRITE only), CRC
+ *   reply:   0x5A, op, seq, status, 0, payload length (16), payload, CRC
+ * The CRC is the 16-bit XMODEM CRC of add_crc() over everything before it. Requests are handled
+ * in order and each gets one reply, so the host can keep several in flight. After a bad CRC the
+ * monitor drops its input until the line has been quiet for a while, then replies
+ * SAM_BA_FAST_BAD_CRC; the host resends everything from the oldest unanswered request.
+ */
+#define SAM_BA_FAST_REQ_SYNC 0xA5
+#define SAM_BA_FAST_REPLY_SYNC 0x5A
+#define SAM_BA_FAST_MAX_PAYLOAD 1024
+
+#define SAM_BA_FAST_OP_WRITE 1 // flash whole rows at addr, outside the bootloader
+#define SAM_BA_FAST_OP_ERASE 2 // flash_erase_range(addr, len), outside the bootloader
+#define SAM_BA_FAST_OP_CRC 3   // replies with the CRC of len bytes at addr (2 bytes), all of
+                               // them in flash or SRAM
+#define SAM_BA_FAST_OP_READ 4  // replies with len bytes at addr, at most SAM_BA_FAST_MAX_PAYLOAD,
+                               // fewer where flash or SRAM ends
+#define SAM_BA_FAST_OP_EXIT 5  // back to the ASCII commands
+#define SAM_BA_FAST_OP_RESET 6 // resets into the application after the reply
+
+#define SAM_BA_FAST_OK 0
+#define SAM_BA_FAST_BAD_CRC 1
+#define SAM_BA_FAST_BAD_OP 2
+#define SAM_BA_FAST_BAD_ADDR 3
+
+/*
+ * RS-485 broadcast mode (USE_UART_BROADCAST). "M#" on the UART monitor switches every node on the
+ * bus to it at once, without a reply, and for good. Fields are little endian:
+ *   request: 0xA6, op, addr (32 bits), len (16), payload (len bytes), CRC
+ *   reply:   0x6A, op, node id (32), len (16), payload, CRC
+ * with the CRC of add_crc() as in the binary mode. addr is a node id, or SAM_BA_BCAST_ADDR_ALL.
+ * Broadcasts are never answered; frames with a bad CRC are dropped without a word, the status
+ * poll is what recovers them. A node id is a hash of the chip's serial number.
+ */
+#define SAM_BA_BCAST_REQ_SYNC 0xA6
+#define SAM_BA_BCAST_REPLY_SYNC 0x6A
+#define SAM_BA_BCAST_ADDR_ALL 0xffffffff
+#define SAM_BA_BCAST_MAX_RANGES 64
+
+// A 512-byte UF2 block, for write_block(); blocks already written are skipped
+#define SAM_BA_BCAST_OP_BLOCK 1
+// Seed (32 bits), slots (16), slot length in ms (16): every node replies, with no payload, in
+// slot ((id ^ seed) * 0x9E3779B1 >> 16) % slots, counted from the end of the request; nodes that
+// have been polled for their status keep quiet
+#define SAM_BA_BCAST_OP_DISCOVER 2
+// Addressed: replies with numBlocks and numWritten (32 bits each) and up to
+// SAM_BA_BCAST_MAX_RANGES runs of missing blocks, as first block and count (16 bits each)
+#define SAM_BA_BCAST_OP_STATUS 3
+// Nodes that have all the blocks of the image reset into it, unless it failed its transfer
+// digest or signature check; those stay, and rs485_flash.py counts them as not reset
+#define SAM_BA_BCAST_OP_RESET 4
+
 /**
  * \brief Initialize the monitor
  *
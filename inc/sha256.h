@@ -0,0 +1,23 @@
+#ifndef SHA256_H
+#define SHA256_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint32_t count;
+    uint8_t buf[64];
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, uint32_t len);
+void sha256_final(Sha256 *ctx, uint8_t *digest);
+
+// Digest of len bytes at data, which can be in flash; on the SAMD51 the ICM does the hashing
+void sha256_flash(const uint8_t *data, uint32_t len, uint8_t *digest);
+// Whether sha256_flash() gives the FIPS 180-4 example digests
+bool sha256_self_test(void);
+
+#endif
@@ -34,6 +34,19 @@
 #include <stdio.h>
 
 #define PINMUX_UNUSED 0xFFFFFFFF
+/* Ring buffers of the DMA transport (powers of two) */
+#ifdef SAMD51
+#define UART_RX_RING_SIZE 4096
+#else
+#define UART_RX_RING_SIZE 1024
+#endif
+#define UART_TX_RING_SIZE 256
+/* Channels of the DMAC, which the transports share (see dmac_init()) */
+#define UART_DMA_RX_CH 0
+#define UART_DMA_TX_CH 1
+#define ESP_DMA_RX_CH 2
+#define ESP_DMA_TX_CH 3
+#define DMAC_USED_CHANNELS 4
 #define GCLK_ID_SERCOM0_CORE 0x14
 
 /* SERCOM UART available pad settings */
@@ -104,4 +117,129 @@ void uart_write_buffer_polled(Sercom *sercom, uint8_t *ptr, uint16_t length);
  */
 void uart_read_buffer_polled(Sercom *sercom, uint8_t *ptr, uint16_t length);
 
+/**
+ * \brief Sets the baud rate, with 16x oversampling up to fref / 16 and 8x above
+ *
+ * \param Pointer to SERCOM instance
+ * \param Baud rate, up to fref / 8
+ * \param Frequency of the SERCOM core clock
+ */
+void uart_set_baud(Sercom *sercom, uint32_t baud, uint32_t fref);
+
+/**
+ * \brief Switches to auto-baud frames: a break followed by 0x55 makes the SERCOM measure the
+ * baud rate (16x oversampling) and load it into BAUD; other bytes are received as usual
+ *
+ * \param Pointer to SERCOM instance
+ */
+void uart_enable_autobaud(Sercom *sercom);
+
+/**
+ * \brief Baud rate the SERCOM is set to, e.g. after auto-baud
+ *
+ * \param Pointer to SERCOM instance
+ * \param Frequency of the SERCOM core clock
+ * \return Baud rate
+ */
+uint32_t uart_get_baud(Sercom *sercom, uint32_t fref);
+
+/**
+ * \brief Starts the DMAC with the descriptor tables of all the channels, unless it is already
+ * running on them
+ */
+void dmac_init(void);
+
+/**
+ * \brief Descriptor of a channel, to be filled in before dmac_channel_start()
+ *
+ * \param Channel number, below DMAC_USED_CHANNELS
+ * \return Pointer to the descriptor
+ */
+DmacDescriptor *dmac_descriptor(uint32_t ch);
+
+/**
+ * \brief Starts a channel on its descriptor, a beat per trigger
+ *
+ * \param Channel number
+ * \param Trigger source, e.g. SERCOM0_DMAC_ID_RX
+ */
+void dmac_channel_start(uint32_t ch, uint32_t trigsrc);
+
+/**
+ * \brief Whether a channel is still transferring
+ *
+ * \param Channel number
+ * \return true until the last descriptor of the channel is done
+ */
+bool dmac_channel_busy(uint32_t ch);
+
+/**
+ * \brief Whether a channel has finished a block since the last call; needs BLOCKACT_INT in the
+ * block's descriptor
+ *
+ * \param Channel number
+ */
+bool dmac_channel_block_done(uint32_t ch);
+
+/**
+ * \brief Stops a channel and waits until it has
+ *
+ * \param Channel number
+ */
+void dmac_channel_stop(uint32_t ch);
+
+/**
+ * \brief Starts the DMA transport: channel UART_DMA_RX_CH receives into a ring buffer and
+ * UART_DMA_TX_CH sends from another
+ *
+ * \param Pointer to an initialized SERCOM instance
+ */
+void uart_dma_init(Sercom *sercom);
+
+/**
+ * \brief Sends what is left in the TX ring and stops the UART channels
+ */
+void uart_dma_stop(void);
+
+/**
+ * \brief Number of received bytes waiting in the RX ring
+ *
+ * \return Byte count; a reader more than UART_RX_RING_SIZE bytes behind has lost data, which is
+ * dropped and reported by uart_dma_rx_overflow()
+ */
+uint32_t uart_dma_rx_count(void);
+
+/**
+ * \brief Whether received bytes were lost to an RX ring overrun since the last call
+ */
+bool uart_dma_rx_overflow(void);
+
+/**
+ * \brief Takes received bytes from the RX ring, without waiting
+ *
+ * \param Pointer to store read data
+ * \param Maximum number of bytes to read
+ * \return Number of bytes read
+ */
+uint32_t uart_dma_read(uint8_t *ptr, uint32_t length);
+
+/**
+ * \brief Queues data on the TX ring, waiting only while it is full
+ *
+ * \param Pointer to data to send
+ * \param Number of bytes to send
+ */
+void uart_dma_write(const uint8_t *ptr, uint32_t length);
+
+/**
+ * \brief Starts sending the next part of the TX ring once the previous one is out; there is no
+ * DMAC interrupt, uart_dma_rx_count() and uart_dma_write() call it
+ */
+void uart_dma_kick(void);
+
+/**
+ * \brief Waits until everything queued has been sent
+ */
+void uart_dma_flush(void);
+
 #endif
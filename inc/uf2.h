@@ -12,6 +12,7 @@
 #include "cdc_enumerate.h"
 #include "sam_ba_monitor.h"
 #include "usart_sam_ba.h"
+#include "update.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -53,6 +54,10 @@
 #define USE_CDC 1 // 1264 bytes (plus terminal, see below)
 // Support the UART (real serial port, not USB)
 #define USE_UART 0
+// Baud rate of the UART; boards can set their own, up to 6000000 (the 48MHz SERCOM clock / 8)
+#ifndef BOOT_USART_BAUD
+#define BOOT_USART_BAUD 115200
+#endif
 // Support Human Interface Device (HID) - serial, flashing and debug
 #define USE_HID 1 // 788 bytes
 // Expose HID via WebUSB
@@ -81,6 +86,61 @@
 #define USE_CDC_TERMINAL 0 // enable ASCII mode on CDC loop (not used by BOSSA); 228 bytes
 #define USE_DBG_MSC 0      // output debug info about MSC
 
+// SAMD51 only: flash updates into the inactive NVM bank and swap banks (BKSWRST) once the
+// update is complete and verified; 2.2 KB RAM per 256 KB bank, 300 bytes
+#define USE_BANK_SWAP 0
+// Check the SHA-256 of modules that carry a digest tag (see scripts/add_digest.py): 0 never,
+// 1 before a staged A/B slot is made active, 2 also on every boot; ~1 KB on SAMD21, ~300 bytes
+// on SAMD51 (ICM)
+#define USE_IMAGE_DIGEST 0
+// Only boot modules signed with the board's SIGNING_PUBLIC_KEY (Ed25519 over the digest, see
+// scripts/sign_image.py), and check them at the end of a UF2 transfer too; ~3 KB
+#define USE_SIGNED_IMAGES 0
+// Decrypt UF2 blocks flagged UF2_FLAG_ENCRYPTED (AES-128-CTR with the key in the user page, see
+// scripts/encrypt_uf2.py): 1 accept plain blocks too, 2 only flash encrypted ones. The application
+// can't be read back, so bossac --verify fails. ~300 bytes on SAMD51 (AES peripheral), ~600 bytes
+// and 176 bytes RAM on SAMD21 (table-free software AES)
+#define USE_ENCRYPTED_UF2 0
+// Hash the rows of a UF2 transfer as they are flashed and compare with the digest block at the
+// end of the file (see scripts/uf2_digest.py) before resetting: 1 check files that have one, 2
+// refuse files without; ~1 KB on SAMD21 (software SHA-256), 72 bytes RAM
+#define USE_TRANSFER_DIGEST 0
+// SAMD51 only: time the boot phases with the DWT cycle counter into UF2_BOOT_PROFILE, readable
+// over HF2 (scripts/boot_profile.py) and by the application; ~150 bytes
+#define USE_BOOT_PROFILE 0
+// SAMD51 only: start the application right after a reset and catch a second one with an RTC
+// timestamp, instead of waiting out the double tap window first; 200 bytes
+#define USE_FAST_DBL_TAP 0
+// SAMD51 only: run the core at 120 MHz from DPLL0 once system_init() is done (USB and the UART
+// stay on the 48 MHz DFLL); ~100 bytes
+#define USE_120MHZ 0
+// Binary mode for the SAM-BA monitor, entered with "P#": length-prefixed, CRC-checked frames to
+// flash, erase, CRC and read memory, pipelined by the host (scripts/sam_ba_fast.py); ~700 bytes,
+// 1 KB RAM
+#define USE_FAST_MONITOR 0
+// UART through the DMAC: received bytes go straight into a ring buffer in SRAM, so none are lost
+// while the CPU waits on a flash erase or write, and replies go out from another one; ~600 bytes,
+// 4.4 KB RAM on SAMD51 (1.3 KB on SAMD21)
+#define USE_UART_DMA 0
+// XMODEM-1K is always accepted on the UART; this adds YMODEM batches ("B#" on the UART monitor):
+// .uf2 files are flashed like a copy to the drive, other files as binaries; ~800 bytes, 1.8 KB RAM
+#define USE_YMODEM 0
+// UART auto-baud: a break followed by 0x55 sets the rate (up to 3 Mbaud), and "L[BAUD]#" switches
+// to a faster one, going back after 16 line errors; ~300 bytes
+#define USE_UART_AUTOBAUD 0
+// RS-485 broadcast flashing ("M#" on the UART monitor, frames in sam_ba_monitor.h): the host sends
+// UF2 blocks to all nodes on the bus at once, then polls each for the blocks it missed; boards
+// can set BOOT_RS485_DE_PIN for the transceiver's driver enable; ~700 bytes, 1.1 KB RAM
+#define USE_UART_BROADCAST 0
+// CDC without a wait per packet: the USB fills one half of a 1 KB buffer, several packets at a
+// time, while the monitor reads the other, and short replies are gathered and sent in the
+// background; ~500 bytes, 1.3 KB RAM
+#define USE_CDC_BUFFERED 0
+// SAMD51 only: the ESP32 co-processor pushes UF2 blocks (fetched over MQTT) over SPI, with
+// ESP_BUSY as the handshake, for boards updated without USB; needs ESP_CS and ESP_SPI_* in
+// board_config.h (frames in esp_ota.h); ~800 bytes, 1.1 KB RAM
+#define USE_ESP_OTA 0
+
 #if USE_CDC
 #define CDC_VERSION "S"
 #else
@@ -138,8 +198,10 @@
 #define USE_MONITOR (USE_CDC || USE_UART)
 
 #ifdef SAMD51
-// 51 also runs at 48MHz in bootloader mode, but it's still faster
-#define TIMER_STEP 2000
+// 51 also runs at 48MHz in bootloader mode (unless USE_120MHZ), but it's still faster
+#define TIMER_STEP (2000 * (CPU_FREQUENCY / 1000000) / 48)
+// Generator running the DFLL at 48MHz for USB and the UART
+#define GCLK_48MHZ (USE_120MHZ ? 1 : 0)
 #else
 #define TIMER_STEP 1500
 #endif
@@ -194,6 +256,52 @@ void logreset(void);
 #define logreset() NOOP
 #endif
 
+#if USE_BOOT_PROFILE
+#ifndef SAMD51
+#error "USE_BOOT_PROFILE needs the DWT cycle counter of the SAMD51"
+#endif
+// Records a UF2_BOOT_PHASE_*; UF2_BOOT_PHASE_MAIN starts a new profile
+void boot_profile_mark(uint32_t phase);
+#else
+#define boot_profile_mark(...) NOOP
+#endif
+
+#if USE_FAST_DBL_TAP && !defined(SAMD51)
+#error "USE_FAST_DBL_TAP needs the SAMD51 RTC, which keeps running through resets"
+#endif
+
+#if USE_120MHZ && !defined(SAMD51)
+#error "USE_120MHZ needs the DPLL of the SAMD51"
+#endif
+
+#if USE_UART_DMA && !USE_UART
+#error "USE_UART_DMA needs USE_UART"
+#endif
+
+#if USE_UART_AUTOBAUD && !USE_UART
+#error "USE_UART_AUTOBAUD needs USE_UART"
+#endif
+
+#if USE_YMODEM && !USE_UART
+#error "USE_YMODEM needs USE_UART"
+#endif
+
+#if USE_UART_BROADCAST && !USE_UART
+#error "USE_UART_BROADCAST needs USE_UART"
+#endif
+
+#if USE_CDC_BUFFERED && !USE_CDC
+#error "USE_CDC_BUFFERED needs USE_CDC"
+#endif
+
+#if USE_ESP_OTA && !defined(SAMD51)
+#error "USE_ESP_OTA is for the SAMD51 AirLift boards, it times ESP_BUSY with the DWT cycle counter"
+#endif
+
+#if USE_FAST_MONITOR && !USE_MONITOR
+#error "USE_FAST_MONITOR is a mode of the SAM-BA monitor, it needs USE_CDC or USE_UART"
+#endif
+
 #if USE_DBG_MSC
 #define DBG_MSC(x) x
 #else
@@ -214,8 +322,39 @@ void panic(int code);
 extern volatile bool b_sam_ba_interface_usart;
 void flash_write_row(uint32_t *dst, uint32_t *src);
 void flash_erase_to_end(uint32_t *start_address);
+// Erases every row (SAMD21) or block (SAMD51) that addr..addr+len touches
+void flash_erase_range(uint32_t addr, uint32_t len);
+// Does the erases flash_erase_to_end() left pending in addr..addr+len, skipping blank rows or
+// blocks; flash_write_row() and flash_write_words() call it themselves
+void flash_erase_pending(uint32_t addr, uint32_t len);
 void flash_write_words(uint32_t *dst, uint32_t *src, uint32_t n_words);
+// Writes a row and nothing else, outside of a transfer
+#ifdef SAMD51
+void flash_rewrite_row(uint32_t *dst, uint32_t *src);
+#else
+#define flash_rewrite_row flash_write_row
+#endif
 void copy_words(uint32_t *dst, uint32_t *src, uint32_t n_words);
+#ifdef SAMD51
+// Turns the CMCC on, unless the silicon revision needs the NVM cache errata workaround
+void flash_cache_init(void);
+#endif
+#if USE_BANK_SWAP
+#ifndef SAMD51
+#error "USE_BANK_SWAP needs the dual bank NVM of the SAMD51"
+#endif
+// The running bank is always mapped at 0 and the inactive one right after it
+#define FLASH_BANK_SIZE (FLASH_SIZE / 2)
+// Writes a row of an image linked for the running bank to the same place in the inactive bank
+void bank_write_row(uint32_t addr, uint32_t *src);
+// Completes the inactive bank from the running one, verifies it and swaps; does nothing (and
+// returns) unless bank_commit() came first, or when verification fails
+void bank_swap_finish(void);
+// Marks what was written to the inactive bank as a finished, checked image
+void bank_commit(void);
+// Forgets what was written to the inactive bank, so that bank_swap_finish() doesn't swap
+void bank_discard(void);
+#endif
 
 int writeNum(char *buf, uint32_t n, bool full);
 
@@ -229,15 +368,46 @@ void msc_reset(void);
 #define UDI_MSC_BLOCK_SIZE 512L
 
 void read_block(uint32_t block_no, uint8_t *data);
+#if USE_ENCRYPTED_UF2
+// False if the len bytes at addr overlap the device key in the user page, the decrypted
+// application or SRAM, where both pass through; every way of reading memory from the outside
+// (CURRENT.UF2, HF2, the SAM-BA monitor) asks first. Protected memory reads as zeros over
+// SAM-BA, which is what makes bossac's verify fail.
+bool read_allowed(uint32_t addr, uint32_t len);
+#else
+#define read_allowed(addr, len) true
+#endif
 #define MAX_BLOCKS (FLASH_SIZE / 256 + 100)
 typedef struct {
     uint32_t numBlocks;
     uint32_t numWritten;
     uint8_t writtenMask[MAX_BLOCKS / 8 + 1];
+    // The blocks go to flash through this, as an image
+    UpdateSession update;
+    // All blocks are in, but the image failed its transfer digest or signature check: it must
+    // not be reset into
+    bool rejected;
+#if USE_TRANSFER_DIGEST
+    // XOR of the SHA-256 of every flashed block (targetAddr, then payload), so blocks can come in
+    // any order; expected is from the UF2_FLAG_TRANSFER_DIGEST block
+    uint8_t digest[32];
+    uint8_t expected[32];
+    bool hasExpected;
+    // Lowest flashed address, wiped when the digest doesn't match
+    uint32_t firstAddr;
+#endif
 } WriteState;
 void write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state);
 void padded_memcpy(char *dst, const char *src, int len);
 
+#ifdef SAMD51
+#define RAM_START HSRAM_ADDR
+#define RAM_SIZE HSRAM_SIZE
+#else
+#define RAM_START HMCRAMC0_ADDR
+#define RAM_SIZE HMCRAMC0_SIZE
+#endif
+
 // Last word in RAM
 // Unlike for ordinary applications, our link script doesn't place the stack at the bottom
 // of the RAM, but instead after all allocated BSS.
@@ -248,6 +418,12 @@ void padded_memcpy(char *dst, const char *src, int len);
 #ifdef SAMD51
 #define DBL_TAP_PTR ((volatile uint32_t *)(HSRAM_ADDR + HSRAM_SIZE - 4))
 #endif
+#if defined(SAMD21)
+    #define RESET_CONTROLLER PM
+#elif defined(SAMD51)
+    #define RESET_CONTROLLER RSTC
+#endif
+
 #define DBL_TAP_MAGIC 0xf01669ef // Randomly selected, adjusted to have first and last bit set
 #define DBL_TAP_MAGIC_QUICK_BOOT 0xf02669ef
 
@@ -330,6 +506,10 @@ void RGBLED_set_color(uint32_t color);
 #endif
 
 extern uint32_t timerHigh, resetHorizon;
+// Milliseconds counted by SysTick (48kHz on both chips) since system_init(); 0 before it
+extern volatile uint32_t systick_ms;
+// Free running count of CPU cycles from SysTick, wrapping at 2^32; the SAMD21 has no DWT
+uint32_t systick_cycles(void);
 void timerTick(void);
 void delay(uint32_t ms);
 void hidHandoverLoop(int ep);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // All entries are little endian.
 
@@ -23,6 +24,12 @@
 // If set, the block is "comment" and should not be flashed to the device
 #define UF2_FLAG_NOFLASH 0x00000001
 #define UF2_FLAG_FAMILYID_PRESENT 0x00002000
+// Not in the UF2 spec: the payload is AES-128-CTR encrypted with the device key, and the 12 bytes
+// after it hold the nonce. The counter of the first 16 bytes is targetAddr / 16.
+#define UF2_FLAG_ENCRYPTED 0x00100000
+// Not in the UF2 spec either: a UF2_FLAG_NOFLASH block whose 32-byte payload is the digest of the
+// other blocks of the file (see WriteState)
+#define UF2_FLAG_TRANSFER_DIGEST 0x00200000
 
 #define UF2_IS_MY_FAMILY(bl)                                                                       \
     (((bl)->flags & UF2_FLAG_FAMILYID_PRESENT) == 0 || (bl)->familyID == UF2_FAMILY)
@@ -68,6 +75,50 @@ typedef struct {
 
 #define UF2_BINFO ((UF2_BInfo *)(APP_START_ADDRESS - sizeof(UF2_BInfo)))
 
+// The double tap word at the end of RAM, which application link scripts already keep out of the
+// stack and data. With A/B slots the bootloader leaves the boot state of the slot it starts there:
+// UF2_BOOT_STATE_TAG in the upper half, the slot and the attempts so far below. The application
+// sets UF2_BOOT_CONFIRMED to stop the bootloader from rolling back (see uf2_confirm_boot()); the
+// bootloader records that in flash after the next reset that keeps RAM, power loss loses it.
+#ifdef SAMD21
+#define UF2_BOOT_STATE_PTR ((volatile uint32_t *)(HMCRAMC0_ADDR + HMCRAMC0_SIZE - 4))
+#endif
+#ifdef SAMD51
+#define UF2_BOOT_STATE_PTR ((volatile uint32_t *)(HSRAM_ADDR + HSRAM_SIZE - 4))
+#endif
+#define UF2_BOOT_STATE_TAG 0xb0070000
+#define UF2_BOOT_STATE_TAG_MASK 0xffff0000
+#define UF2_BOOT_CONFIRMED 0x8000
+
+// Boot phases timed by a USE_BOOT_PROFILE bootloader, in the order they happen
+#define UF2_BOOT_PHASE_MAIN 0        // main() entered, the clock starts
+#define UF2_BOOT_PHASE_BOD33 1       // supply settled above the brownout level
+#define UF2_BOOT_PHASE_ESP_READY 2   // ESP32 signalled ESP_BUSY
+#define UF2_BOOT_PHASE_DBL_TAP 3     // double tap window over
+#define UF2_BOOT_PHASE_JUMP 4        // modules checked, jumping to the kernel
+#define UF2_BOOT_PHASE_STAY 5        // staying in the bootloader instead
+#define UF2_BOOT_PHASE_SYSTEM_INIT 6 // clocks and peripherals set up
+#define UF2_BOOT_PHASE_USB_INIT 7    // USB attached
+#define UF2_BOOT_PHASE_USB_READY 8   // USB enumerated
+
+#define UF2_BOOT_PROFILE_MAGIC 0x464f5250 // "PROF"
+#define UF2_BOOT_PROFILE_MAX 12
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_hz; // rate of the cycle counts
+    uint32_t count;
+    struct {
+        uint32_t phase;
+        uint32_t cycles; // DWT CYCCNT, 0 when main() was entered
+    } marks[UF2_BOOT_PROFILE_MAX];
+} UF2_BootProfile;
+
+// Right below the double tap word, and like it not initialized by the bootloader's startup code;
+// an application that wants to read it has to keep its stack and data out of these words too
+#define UF2_BOOT_PROFILE                                                                           \
+    ((volatile UF2_BootProfile *)((uint32_t)UF2_BOOT_STATE_PTR - sizeof(UF2_BootProfile)))
+
 static inline bool is_uf2_block(void *data) {
     UF2_Block *bl = (UF2_Block *)data;
     return bl->magicStart0 == UF2_MAGIC_START0 && bl->magicStart1 == UF2_MAGIC_START1 &&
@@ -85,6 +136,21 @@ static inline const char *uf2_info(void) {
 }
 
 #ifdef UF2_DEFINE_HANDOVER
+// Call on every boot, once the application is known to work; otherwise a freshly flashed image is
+// rolled back after a few boots, power cycles included. Reset once after it if the device may be
+// powered off before its next reset, so the bootloader can record the confirmation.
+static inline void uf2_confirm_boot(void) {
+    uint32_t state = *UF2_BOOT_STATE_PTR;
+    if ((state & UF2_BOOT_STATE_TAG_MASK) == UF2_BOOT_STATE_TAG)
+        *UF2_BOOT_STATE_PTR = state | UF2_BOOT_CONFIRMED;
+}
+
+// Phase timestamps of the boot that started the application, NULL if the bootloader didn't record
+// any (built without USE_BOOT_PROFILE)
+static inline const volatile UF2_BootProfile *uf2_boot_profile(void) {
+    return UF2_BOOT_PROFILE->magic == UF2_BOOT_PROFILE_MAGIC ? UF2_BOOT_PROFILE : NULL;
+}
+
 static inline void hf2_handover(uint8_t ep) {
     const char *board_info = UF2_BINFO->info_uf2;
     UF2_HID_Handover_Handler fn = UF2_BINFO->handoverHID;
@@ -24,7 +24,15 @@ struct HF2_BININFO_Result {
 // no arguments, no result
 
 #define HF2_CMD_START_FLASH 0x0005
-// no arguments, no result
+struct HF2_START_FLASH_Command {
+    uint32_t image_len;
+};
+// image_len is an extension: in HF2 as published, START_FLASH takes no arguments. It gives the
+// bytes of WRITE_FLASH_PAGE the image takes, and RESET_INTO_APP only checks and commits the image
+// (makes it the one that boots) once that many are in; a partial one is left uncommitted. Without
+// image_len, as older hosts send it, RESET_INTO_APP commits whatever was written, as it always
+// did. A failed check answers RESET_INTO_APP with HF2_STATUS_EXEC_ERR and doesn't reset.
+// no result
 
 #define HF2_CMD_WRITE_FLASH_PAGE 0x0006
 struct HF2_WRITE_FLASH_PAGE_Command {
@@ -63,6 +71,10 @@ struct HF2_WRITE_WORDS_Command {
 // no arguments
 // results is utf8 character array
 
+#define HF2_CMD_BOOT_PROFILE 0x0030
+// no arguments
+// result is UF2_BootProfile up to its count marks; HF2_STATUS_INVALID_CMD without USE_BOOT_PROFILE
+
 typedef struct {
     uint32_t command_id;
     uint16_t tag;
@@ -70,6 +82,7 @@ typedef struct {
     uint8_t reserved1;
 
     union {
+        struct HF2_START_FLASH_Command start_flash;
         struct HF2_WRITE_FLASH_PAGE_Command write_flash_page;
         struct HF2_WRITE_WORDS_Command write_words;
         struct HF2_READ_WORDS_Command read_words;
@@ -103,5 +116,6 @@ typedef struct {
 
 #define HF2_STATUS_OK 0x00
 #define HF2_STATUS_INVALID_CMD 0x01
+#define HF2_STATUS_EXEC_ERR 0x02
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The update engine. Every way into flash (UF2 blocks from the drive, YMODEM or the RS-485 bus,
+// HF2 pages, the SAM-BA monitor's Y, U and binary writes) goes through a session: the engine
+// decides which addresses may be written, merges partial rows with what is in flash, leaves the
+// erasing to the flash driver (flash_erase_to_end() and the compare in flash_write_row()), and
+// does the checks, boot slot commit and reset scheduling at the end of an image. It only calls
+// the flash_* functions and their neighbours; test/test_update.c runs it on the host against the
+// stubs in test/host (make test-host).
+
+// An image update, as from a UF2 file or HF2: with USE_BANK_SWAP it goes to the inactive bank,
+// with USE_SIGNED_IMAGES its rows are hashed for the signature check in update_finalize(). The
+// SAM-BA monitor writes raw, where it is told to.
+#define UPDATE_IMAGE 0x01
+#define UPDATE_ACTIVE 0x80
+
+typedef struct {
+    uint32_t bytes;    // submitted
+    uint32_t rows;     // handed to the flash driver, which skips those already right
+    uint32_t merged;   // rows that had to be merged with flash, for partial writes
+    uint32_t rejected; // bytes outside the application or the writable boot slot
+    uint32_t started;  // timerHigh at update_begin()
+} UpdateStats;
+
+typedef struct {
+    uint8_t flags;
+    UpdateStats stats;
+} UpdateSession;
+
+// Whether a row at addr may be written: in the application, outside the running boot slot
+bool update_addr_ok(uint32_t addr);
+// Starts a session with UPDATE_* flags; a zeroed session is a raw one, begun as it is used
+void update_begin(UpdateSession *s, uint8_t flags);
+// Writes len bytes at addr. Whole rows go to flash straight from data (if word aligned); the
+// rest is staged in the row buffer of the engine, until the row is complete, another row is
+// staged or update_sync(). With USE_BANK_SWAP, an image only takes whole rows: there is nothing
+// to merge a partial one with. Returns false if some of it was rejected.
+bool update_submit(UpdateSession *s, uint32_t addr, const void *data, uint32_t len);
+// Writes the row s has staged, if any, so that flash reads back what was submitted
+void update_sync(UpdateSession *s);
+// Ends an image: syncs, checks the signature of what was streamed (USE_SIGNED_IMAGES), commits
+// the boot slot or the inactive bank (USE_BANK_SWAP) and, with reset_ticks, schedules the reset
+// into the application. Returns false, and commits nothing, if the check failed. An image that
+// is never finalized isn't swapped in by resetIntoApp().
+bool update_finalize(UpdateSession *s, uint32_t reset_ticks);
+// Resets into the application once timerHigh has gone reset_ticks further (timerTick() runs in
+// the USB polling)
+void update_reset_after(uint32_t reset_ticks);
+const UpdateStats *update_progress(const UpdateSession *s);
+
+#endif
@@ -47,7 +47,7 @@
 
 /* X/Ymodem protocol: */
 #define SOH 0x01
-//#define STX                    0x02
+#define STX 0x02
 #define EOT 0x04
 #define ACK 0x06
 #define NAK 0x15
@@ -55,6 +55,12 @@
 #define ESC 0x1b
 
 #define PKTLEN_128 128
+#define PKTLEN_1K 1024
+
+/* getPacket() results */
+#define PKT_BAD 0
+#define PKT_OK 1
+#define PKT_REPEAT 2
 
 /**
  * \brief Open the given USART
@@ -66,6 +72,26 @@ void usart_open(void);
  */
 void usart_close(void);
 
+/**
+ * \brief Waits until everything written has gone out
+ */
+void usart_flush(void);
+
+/**
+ * \brief Counts a transfer error (bad CRC, framing error); with USE_UART_AUTOBAUD, too many
+ * at a rate the L command switched to go back to the base rate
+ */
+void usart_line_error(void);
+
+/**
+ * \brief Switches to baud, if the host confirms with a '#' at that rate within about a
+ * second; otherwise stays at the current rate
+ *
+ * \param baud rate, 1200 to 6000000
+ * \return true if switched
+ */
+bool usart_switch_baud(uint32_t baud);
+
 /**
  * \brief Puts a byte on usart line
  *
@@ -153,6 +179,24 @@ usart_getdata_xmd(void *data,
  */
 uint16_t add_crc(uint8_t ch, unsigned short crc0);
 
-uint8_t getPacket(uint8_t *pData, uint8_t sno);
+/* Where usart_ymodem_receive() puts the files of a batch */
+typedef struct {
+    /* A new file, size 0xffffffff if the sender didn't give one; false cancels the batch */
+    bool (*start)(const char *name, uint32_t size);
+    /* The next len bytes of the file, which start at offset */
+    void (*data)(uint32_t offset, const uint8_t *data, uint32_t len);
+    /* The file is complete */
+    void (*end)(void);
+} YmodemSink;
+
+/**
+ * \brief Receives a YMODEM batch (128 and 1024 byte packets, CRC-16) into sink
+ *
+ * \param callbacks for the files
+ * \return number of files received completely
+ */
+uint32_t usart_ymodem_receive(const YmodemSink *sink);
+
+uint8_t getPacket(uint8_t *pData, uint8_t sno, uint16_t length);
 
 #endif // _USART_SAM_BA_H_
@@ -0,0 +1,48 @@
+# Seals a module binary for USE_IMAGE_DIGEST: fills in image_len of its SHA-256 tag (see
+# inc/multiboot.h) and appends the SHA-256 of the image.
+#
+# python3 scripts/add_digest.py ovule.bin ovule-sealed.bin
+#
+# Convert the result to UF2 as usual. The module's flash_len in the boot table has to leave
+# room for the 32 digest bytes.
+import hashlib
+import struct
+import sys
+
+MULTIBOOT_MAGIC = 0xE85250D6
+MB_IMAGE_HEADER_TYPE_END = 0x00
+MB_IMAGE_HEADER_TYPE_SHA256 = 0x20
+
+
+def seal(image):
+    """Returns the image with its SHA-256 tag filled in and the digest appended"""
+    image = bytearray(image)
+    # Keep the digest word aligned
+    image += b"\xff" * (-len(image) % 4)
+
+    magic, arch, header_len, checksum = struct.unpack_from("<IIII", image, 0)
+    if magic != MULTIBOOT_MAGIC:
+        raise SystemExit("no multiboot header at the start of the image")
+
+    pos = 16
+    found = False
+    while pos + 8 <= header_len:
+        tag_type, flags, size = struct.unpack_from("<HHI", image, pos)
+        if tag_type == MB_IMAGE_HEADER_TYPE_END:
+            break
+        if tag_type == MB_IMAGE_HEADER_TYPE_SHA256:
+            struct.pack_into("<I", image, pos + 8, len(image))
+            found = True
+            break
+        pos += (size + 7) & ~7
+    if not found:
+        raise SystemExit("no SHA-256 tag in the multiboot header")
+
+    return image + hashlib.sha256(image).digest()
+
+
+if __name__ == "__main__":
+    sealed = seal(open(sys.argv[1], "rb").read())
+    with open(sys.argv[2], "wb") as output:
+        output.write(sealed)
+    print("{}: {} bytes, sha256 {}".format(sys.argv[2], len(sealed) - 32, sealed[-32:].hex()))
@@ -0,0 +1,64 @@
+# Reads the boot phase timestamps of a USE_BOOT_PROFILE bootloader over HF2 and prints how long
+# every phase took. Needs the hidapi module (pip install hidapi).
+#
+# python3 scripts/boot_profile.py [VID:PID]
+#
+# The profile is of the latest boot, so double tap into the bootloader first; to profile a boot
+# into the application, read UF2_BOOT_PROFILE from the application instead (uf2_boot_profile()
+# in inc/uf2format.h).
+import struct
+import sys
+
+import hid
+
+HF2_CMD_BOOT_PROFILE = 0x0030
+HF2_FLAG_CMDPKT_LAST = 0x40
+HF2_FLAG_MASK = 0xC0
+UF2_BOOT_PROFILE_MAGIC = 0x464F5250
+
+PHASES = ["main", "bod33", "esp_ready", "dbl_tap", "jump", "stay", "system_init", "usb_init",
+          "usb_ready"]
+
+
+def hf2_command(dev, cmd, tag=1):
+    dev.write(bytes([0, HF2_FLAG_CMDPKT_LAST | 8]) + struct.pack("<IHBB", cmd, tag, 0, 0))
+    data = b""
+    while True:
+        pkt = bytes(dev.read(64, 2000))
+        if not pkt:
+            raise SystemExit("no response")
+        data += pkt[1:1 + (pkt[0] & 0x3F)]
+        if pkt[0] & HF2_FLAG_MASK == HF2_FLAG_CMDPKT_LAST:
+            break
+    rtag, status, _ = struct.unpack_from("<HBB", data)
+    if rtag != tag or status:
+        raise SystemExit("command failed, status {} (bootloader built without USE_BOOT_PROFILE?)"
+                         .format(status))
+    return data[4:]
+
+
+def main(args):
+    vid, pid = (int(x, 16) for x in args[0].split(":")) if args else (0x239A, 0)
+    for info in hid.enumerate(vid, pid):
+        if info["usage_page"] == 0xFF97:
+            break
+    else:
+        raise SystemExit("no HF2 device found")
+    dev = hid.device()
+    dev.open_path(info["path"])
+
+    data = hf2_command(dev, HF2_CMD_BOOT_PROFILE)
+    magic, cpu_hz, count = struct.unpack_from("<III", data)
+    if magic != UF2_BOOT_PROFILE_MAGIC:
+        raise SystemExit("no profile recorded")
+    last = 0
+    for i in range(count):
+        phase, cycles = struct.unpack_from("<II", data, 12 + 8 * i)
+        name = PHASES[phase] if phase < len(PHASES) else str(phase)
+        print("{:12} {:10.3f} ms  +{:9.3f} ms".format(name, cycles * 1e3 / cpu_hz,
+                                                       (cycles - last) * 1e3 / cpu_hz))
+        last = cycles
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,173 @@
+# Encrypts UF2 files for USE_ENCRYPTED_UF2 (see inc/uf2format.h): every flashable block gets its
+# payload AES-128-CTR encrypted with the device key, the nonce after the payload and the
+# UF2_FLAG_ENCRYPTED flag.
+#
+# python3 scripts/encrypt_uf2.py keygen device.key
+# python3 scripts/encrypt_uf2.py encrypt device.key firmware.uf2 firmware-enc.uf2
+# python3 scripts/encrypt_uf2.py bench device.key 0x40000 64 bench
+#
+# The key is per device: write the 16 bytes to offset 0x40 of the device's user page with a
+# debugger, leaving the fuses in front of it alone. bench writes bench-plain.uf2 and
+# bench-enc.uf2, the same random data at the given address and size in KB; copy both to the
+# board and compare how long they take (USE_LOGS builds also log "aes cycles/KB" on the SAMD51).
+# The AES here is a plain reference implementation, no extra packages needed.
+import os
+import struct
+import sys
+import time
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOFLASH = 0x00000001
+UF2_FLAG_ENCRYPTED = 0x00100000
+PAYLOAD_SIZE = 256
+NONCE_SIZE = 12
+
+
+def xtime(x):
+    x <<= 1
+    return x ^ 0x11B if x & 0x100 else x
+
+
+def gf_mul(a, b):
+    r = 0
+    while b:
+        if b & 1:
+            r ^= a
+        a = xtime(a)
+        b >>= 1
+    return r
+
+
+def make_sbox():
+    inv = [0] * 256
+    for a in range(1, 256):
+        for b in range(1, 256):
+            if gf_mul(a, b) == 1:
+                inv[a] = b
+                break
+    sbox = []
+    for x in inv:
+        s = x
+        for n in range(1, 5):
+            s ^= ((x << n) | (x >> (8 - n))) & 0xFF
+        sbox.append(s ^ 0x63)
+    return sbox
+
+
+SBOX = make_sbox()
+
+
+class Aes128:
+    def __init__(self, key):
+        assert len(key) == 16
+        rk = list(key)
+        rcon = 1
+        while len(rk) < 176:
+            t = rk[-4:]
+            if len(rk) % 16 == 0:
+                t = [SBOX[t[1]] ^ rcon, SBOX[t[2]], SBOX[t[3]], SBOX[t[0]]]
+                rcon = xtime(rcon)
+            rk += [a ^ b for a, b in zip(rk[-16:-12], t)]
+        self.rk = rk
+
+    def encrypt_block(self, block):
+        rk = self.rk
+        s = [b ^ k for b, k in zip(block, rk[:16])]
+        for rnd in range(1, 11):
+            t = [SBOX[s[(i + 4 * (i & 3)) & 15]] for i in range(16)]
+            if rnd < 10:
+                for c in range(0, 16, 4):
+                    a = t[c:c + 4]
+                    all_ = a[0] ^ a[1] ^ a[2] ^ a[3]
+                    for r in range(4):
+                        t[c + r] ^= all_ ^ xtime(a[r] ^ a[(r + 1) & 3])
+            s = [b ^ k for b, k in zip(t, rk[16 * rnd:16 * rnd + 16])]
+        return bytes(s)
+
+    def ctr(self, nonce, counter, data):
+        out = bytearray()
+        for off in range(0, len(data), 16):
+            stream = self.encrypt_block(nonce + struct.pack(">I", counter & 0xFFFFFFFF))
+            out += bytes(a ^ b for a, b in zip(data[off:off + 16], stream))
+            counter += 1
+        return bytes(out)
+
+
+def self_test():
+    # FIPS-197 appendix C.1
+    aes = Aes128(bytes(range(16)))
+    ct = aes.encrypt_block(bytes(i * 0x11 for i in range(16)))
+    assert ct.hex() == "69c4e0d86a7b0430d8cdb78070b4c55a", "AES self test failed"
+
+
+def read_key(path):
+    key = bytes.fromhex(open(path).read().strip())
+    if len(key) != 16 or key in (b"\x00" * 16, b"\xff" * 16):
+        raise SystemExit("{}: need 16 key bytes, not all 0x00 or 0xff".format(path))
+    return key
+
+
+def encrypt_uf2(key, uf2, nonce=None):
+    """Returns uf2 with all flashable blocks encrypted; one random nonce covers the whole file"""
+    aes = Aes128(key)
+    nonce = nonce or os.urandom(NONCE_SIZE)
+    out = bytearray(uf2)
+    for pos in range(0, len(out), 512):
+        start0, start1, flags, addr, size = struct.unpack_from("<IIIII", out, pos)
+        end = struct.unpack_from("<I", out, pos + 508)[0]
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or end != UF2_MAGIC_END:
+            raise SystemExit("not a UF2 block at offset {}".format(pos))
+        if flags & (UF2_FLAG_NOFLASH | UF2_FLAG_ENCRYPTED):
+            continue
+        if size != PAYLOAD_SIZE or addr & 0xFF:
+            raise SystemExit("block at 0x{:x} has {} bytes; the bootloader wants 256-byte rows"
+                             .format(addr, size))
+        data = pos + 32
+        out[data:data + size] = aes.ctr(nonce, addr // 16, bytes(out[data:data + size]))
+        out[data + size:data + size + NONCE_SIZE] = nonce
+        struct.pack_into("<I", out, pos + 8, flags | UF2_FLAG_ENCRYPTED)
+    return bytes(out)
+
+
+def make_uf2(addr, data):
+    blocks = []
+    num = len(data) // PAYLOAD_SIZE
+    for i in range(num):
+        payload = data[i * PAYLOAD_SIZE:(i + 1) * PAYLOAD_SIZE].ljust(476, b"\x00")
+        blocks.append(struct.pack("<IIIIIIII", UF2_MAGIC_START0, UF2_MAGIC_START1, 0,
+                                  addr + i * PAYLOAD_SIZE, PAYLOAD_SIZE, i, num, 0) +
+                      payload + struct.pack("<I", UF2_MAGIC_END))
+    return b"".join(blocks)
+
+
+def main(args):
+    self_test()
+    if len(args) == 2 and args[0] == "keygen":
+        with open(args[1], "w") as f:
+            f.write(os.urandom(16).hex() + "\n")
+        print("{}: key for one device, program it at user page offset 0x40".format(args[1]))
+    elif len(args) == 4 and args[0] == "encrypt":
+        out = encrypt_uf2(read_key(args[1]), open(args[2], "rb").read())
+        with open(args[3], "wb") as f:
+            f.write(out)
+        print("{}: {} blocks".format(args[3], len(out) // 512))
+    elif len(args) == 5 and args[0] == "bench":
+        key = read_key(args[1])
+        plain = make_uf2(int(args[2], 0), os.urandom(int(args[3]) * 1024))
+        t = time.time()
+        enc = encrypt_uf2(key, plain)
+        t = time.time() - t
+        with open(args[4] + "-plain.uf2", "wb") as f:
+            f.write(plain)
+        with open(args[4] + "-enc.uf2", "wb") as f:
+            f.write(enc)
+        print("{} KB, host encryption {:.1f} KB/s".format(args[3], int(args[3]) / t))
+    else:
+        raise SystemExit("usage: encrypt_uf2.py keygen KEY | encrypt KEY IN OUT | "
+                         "bench KEY ADDR KB PREFIX")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
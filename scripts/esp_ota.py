@@ -0,0 +1,228 @@
+# Stand-in for the ESP32 end of the SPI update link of bootloaders built with USE_ESP_OTA (frame
+# format in inc/esp_ota.h): what the co-processor firmware does with a UF2 file it fetched over
+# MQTT, run against a simulated bootloader.
+#
+# python3 scripts/esp_ota.py firmware.uf2 [LOSS] [SPI_MHZ]
+#
+# Sender is the part to port: it sends START, every block once, NOPs to collect the statuses still
+# owed, repeats the blocks whose status came back bad or never came back, and sends RESET once the
+# bootloader has them all. It gives up if the bootloader answers RESET with REJECTED (the image
+# failed its transfer digest or signature check). It only needs a transfer() that clocks one frame
+# out and returns the reply clocked in with it, or None once the bootloader is gone. SimBootloader
+# is what esp_ota_poll() does with a frame, with the pipelining, minus the flash. LOSS (default
+# 0.02) is the fraction of frames garbled each way.
+#
+# The times are line and flash time: ESP_OTA_FRAME_SIZE bytes at SPI_MHZ (default 8), against a
+# row write and the 8 KB erases of a SAMD51, with and without the overlap.
+import binascii
+import random
+import struct
+import sys
+from collections import OrderedDict, deque
+
+FRAME_SYNC = 0xA7
+REPLY_SYNC = 0x7A
+FRAME_SIZE = 4 + 512 + 2
+REPLY_SIZE = 14
+OP_NOP, OP_BLOCK, OP_START, OP_RESET = range(4)
+OK, BAD_CRC, BAD_OP, BAD_BLOCK, NOT_DONE, REJECTED = range(6)
+NONE = 0xFF
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+MAX_BLOCKS = 512 * 1024 // 256 + 100
+MAX_TRANSFERS = 100000
+
+# SAMD51 NVM, approximately: a row is half a page, erased 8 KB at a time before its first write
+ROW_WRITE_S = 0.0008
+BLOCK_ERASE_S = 0.025
+ERASE_SIZE = 8192
+# How long ESP_CS takes to be acknowledged, and the ESP32 to arm the next frame
+ACK_S = 0.00001
+ARM_S = 0.00006
+
+
+def crc16(data):
+    # the XMODEM CRC, same as add_crc() in the bootloader
+    return binascii.crc_hqx(data, 0)
+
+
+def frame(op, seq, block=b""):
+    data = struct.pack("<BBH", FRAME_SYNC, op, seq) + block.ljust(512, b"\0")
+    return data + struct.pack("<H", crc16(data))
+
+
+def parse_reply(data):
+    """(status, seq, numBlocks, numWritten), or None if it didn't come through"""
+    if data[0] != REPLY_SYNC or crc16(data[:12]) != struct.unpack_from("<H", data, 12)[0]:
+        return None
+    sync, status, seq, num_blocks, num_written = struct.unpack_from("<BBHII", data)
+    return status, seq, num_blocks, num_written
+
+
+class Sender:
+    def __init__(self, transfer, uf2):
+        self.transfer = transfer
+        self.blocks = [uf2[off:off + 512] for off in range(0, len(uf2) - 511, 512)]
+        self.seq = 0
+        self.sent = self.repeats = self.nops = 0
+
+    def send(self, op, block=b""):
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.sent += 1
+        if op == OP_NOP:
+            self.nops += 1
+        reply = self.transfer(frame(op, self.seq, block))
+        return self.seq, reply if reply is None else parse_reply(reply)
+
+    def run(self):
+        queue = deque(range(len(self.blocks)))
+        # seq -> block index (None for the other ops), in the order sent; statuses come back in
+        # that order, one per frame
+        pending = OrderedDict()
+        complete = False
+        idle = 0
+        seq, _ = self.send(OP_START)
+        pending[seq] = None
+        while self.sent < MAX_TRANSFERS:
+            outstanding = any(i is not None for i in pending.values())
+            if queue:
+                i = queue.popleft()
+                seq, reply = self.send(OP_BLOCK, self.blocks[i])
+            else:
+                i = None
+                seq, reply = self.send(OP_RESET if complete and not outstanding else OP_NOP)
+                if reply is None:
+                    # Reset into the new image
+                    return
+            pending[seq] = i
+            if reply is None or reply[0] == NONE or reply[1] not in pending:
+                if reply is not None:
+                    complete = 0 < reply[2] <= MAX_BLOCKS and reply[3] >= reply[2]
+                # Every block was acknowledged, yet some are missing: all of them again (the
+                # bootloader skips those it has)
+                idle = idle + 1 if not queue and not outstanding and not complete else 0
+                if idle > 8:
+                    queue.extend(range(len(self.blocks)))
+                    idle = 0
+                continue
+            status, rseq, num_blocks, num_written = reply
+            complete = 0 < num_blocks <= MAX_BLOCKS and num_written >= num_blocks
+            # The frames before this one never got theirs
+            for s in list(pending):
+                if s == rseq:
+                    break
+                lost = pending.pop(s)
+                if lost is not None:
+                    queue.append(lost)
+                    self.repeats += 1
+            i = pending.pop(rseq)
+            if status == BAD_BLOCK:
+                raise SystemExit("block {} is not for this board".format(i))
+            if status == REJECTED:
+                raise SystemExit("the bootloader rejected the image (digest or signature check)")
+            if status != OK and i is not None:
+                queue.append(i)
+                self.repeats += 1
+        raise SystemExit("no progress after {} transfers".format(MAX_TRANSFERS))
+
+
+class SimBootloader:
+    def __init__(self, loss, spi_hz, pipelined, seed=1, reject=False):
+        self.rng = random.Random(seed)
+        self.loss = loss
+        self.xfer_s = FRAME_SIZE * 8 / spi_hz
+        self.pipelined = pipelined
+        self.written = set()
+        self.num_blocks = 0
+        self.erased = set()
+        self.status, self.seq = NONE, 0
+        self.last = None
+        self.time = 0.0
+        self.reset = False
+        # Whether the finished image fails its digest or signature check
+        self.reject = reject
+
+    def garble(self, data):
+        if self.rng.random() < self.loss:
+            i = self.rng.randrange(len(data))
+            data = data[:i] + bytes([data[i] ^ 0x10]) + data[i + 1:]
+        return data
+
+    def handle(self, data):
+        """ota_handle(), returning the flash time"""
+        op, self.seq = data[1], struct.unpack_from("<H", data, 2)[0]
+        self.status, t = OK, 0.0
+        crc = struct.unpack_from("<H", data, FRAME_SIZE - 2)[0]
+        if data[0] != FRAME_SYNC or crc16(data[:-2]) != crc:
+            self.status = BAD_CRC
+        elif op == OP_BLOCK:
+            magic0, magic1, _, addr, _, block_no, num_blocks = struct.unpack_from("<7I", data, 4)
+            if magic0 != UF2_MAGIC_START0 or magic1 != UF2_MAGIC_START1:
+                self.status = BAD_BLOCK
+            elif block_no not in self.written:
+                if self.num_blocks != num_blocks:
+                    self.num_blocks = 0xFFFFFFFF if self.num_blocks else num_blocks
+                self.written.add(block_no)
+                if addr // ERASE_SIZE not in self.erased:
+                    self.erased.add(addr // ERASE_SIZE)
+                    t += BLOCK_ERASE_S
+                t += ROW_WRITE_S
+        elif op == OP_START:
+            self.written, self.num_blocks = set(), 0
+        elif op == OP_RESET:
+            complete = 0 < self.num_blocks <= MAX_BLOCKS and len(self.written) >= self.num_blocks
+            if complete and self.reject:
+                self.status = REJECTED
+            else:
+                self.reset = complete
+                self.status = NOT_DONE
+        elif op != OP_NOP:
+            self.status = BAD_OP
+        return t
+
+    def transfer(self, data):
+        """A transaction: None once the bootloader has reset"""
+        if self.reset:
+            return None
+        reply = struct.pack("<BBHII", REPLY_SYNC, self.status, self.seq, self.num_blocks,
+                            len(self.written))
+        reply = (reply + struct.pack("<H", crc16(reply))).ljust(FRAME_SIZE, b"\0")
+        self.status = NONE
+        # The last frame is flashed while this one comes in
+        flash_s = self.handle(self.last) if self.last else 0.0
+        if self.pipelined:
+            self.time += ACK_S + ARM_S + max(self.xfer_s, flash_s)
+        else:
+            self.time += ACK_S + self.xfer_s + flash_s
+        if self.reset:
+            return None
+        self.last = self.garble(data)
+        return self.garble(reply)
+
+    def idle(self):
+        if self.last:
+            self.time += self.handle(self.last)
+            self.last = None
+
+
+def main(args):
+    if not args:
+        raise SystemExit("usage: esp_ota.py firmware.uf2 [LOSS] [SPI_MHZ]")
+    uf2 = open(args[0], "rb").read()
+    loss = float(args[1]) if len(args) > 1 else 0.02
+    spi_hz = float(args[2]) * 1e6 if len(args) > 2 else 8e6
+
+    for pipelined in (False, True):
+        boot = SimBootloader(loss, spi_hz, pipelined)
+        sender = Sender(boot.transfer, uf2)
+        sender.run()
+        boot.idle()
+        if not boot.reset:
+            raise SystemExit("the bootloader did not reset")
+        print("{}: {} blocks, {} frames ({} repeats, {} NOPs), {:.2f} s".format(
+            "pipelined" if pipelined else "one at a time", len(sender.blocks), sender.sent,
+            sender.repeats, sender.nops, boot.time))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
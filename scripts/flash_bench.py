@@ -0,0 +1,68 @@
+# Times flashing over the UF2 drive, to compare bootloader builds (e.g. USE_120MHZ 0 against 1):
+# writes a UF2 file of random data to the mounted drive and waits until the board has flashed it
+# and reset, which unmounts the drive.
+#
+# python3 scripts/flash_bench.py /media/$USER/METROM4BOOT 0x4000 256 [runs]
+#
+# Double tap into the bootloader before every run; the script waits for the drive to come back.
+# The data is random, so only run it against a board whose application can be lost.
+import os
+import struct
+import sys
+import time
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+PAYLOAD_SIZE = 256
+
+
+def make_uf2(addr, data):
+    blocks = []
+    num = len(data) // PAYLOAD_SIZE
+    for i in range(num):
+        payload = data[i * PAYLOAD_SIZE:(i + 1) * PAYLOAD_SIZE].ljust(476, b"\x00")
+        blocks.append(struct.pack("<IIIIIIII", UF2_MAGIC_START0, UF2_MAGIC_START1, 0,
+                                  addr + i * PAYLOAD_SIZE, PAYLOAD_SIZE, i, num, 0) +
+                      payload + struct.pack("<I", UF2_MAGIC_END))
+    return b"".join(blocks)
+
+
+def wait_for(cond, what, timeout=60):
+    end = time.time() + timeout
+    while not cond():
+        if time.time() > end:
+            raise SystemExit("timed out waiting for " + what)
+        time.sleep(0.01)
+
+
+def run(drive, uf2):
+    info = os.path.join(drive, "INFO_UF2.TXT")
+    wait_for(lambda: os.path.exists(info), "the drive, double tap reset")
+    t = time.time()
+    try:
+        with open(os.path.join(drive, "BENCH.UF2"), "wb") as f:
+            f.write(uf2)
+            f.flush()
+            os.fsync(f.fileno())
+    except OSError:
+        pass  # the board may reset before the last write is acknowledged
+    wait_for(lambda: not os.path.exists(info), "the reset after flashing")
+    return time.time() - t
+
+
+def main(args):
+    if len(args) not in (3, 4):
+        raise SystemExit("usage: flash_bench.py DRIVE ADDR KB [RUNS]")
+    drive, addr, kb = args[0], int(args[1], 0), int(args[2])
+    uf2 = make_uf2(addr, os.urandom(kb * 1024))
+    times = []
+    for i in range(int(args[3]) if len(args) > 3 else 3):
+        times.append(run(drive, uf2))
+        print("run {}: {:.2f} s, {:.1f} KB/s".format(i + 1, times[-1], kb / times[-1]))
+    best = min(times)
+    print("{} KB, best {:.2f} s, {:.1f} KB/s".format(kb, best, kb / best))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
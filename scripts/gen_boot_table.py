@@ -0,0 +1,94 @@
+# Generates a UF2 file holding the boot table (see inc/boot_table.h).
+#
+# python3 scripts/gen_boot_table.py samd51 boot_table.uf2 ovule:0x4000:0x10000 net:0x14000:0x8000:-v
+#
+# Every module is NAME:FLASH_START:FLASH_LEN[:COMMAND_LINE_OPTS]; the position in the list is
+# the module id, the first one is booted.
+#
+# With --slot-b ADDR (right after the file name) the first module gets a second slot of the same
+# length at ADDR for A/B updates; slot A starts out active. --dbl-tap-ms MS sets the double tap
+# window (0 keeps the bootloader's default of 500 ms). Options go before the modules.
+import struct
+import sys
+
+CHIPS = {
+    # flash size, boot table size, UF2 family
+    "samd21": (0x40000, 4 * 256, 0x68ed2b88),
+    "samd51": (0x80000, 8192, 0x55114460),
+}
+
+BOOT_TABLE_MAGIC = 0x4c425442
+BOOT_TABLE_VERSION = 3
+MB_MAX_MODULES = 5
+NAME_LEN = 16
+OPTS_LEN = 32
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_FAMILYID_PRESENT = 0x00002000
+
+
+def update_crc(new_byte, current_crc):
+    crc = current_crc ^ new_byte << 8
+    for cmpt in range(8):
+        if crc & 0x8000:
+            crc = crc << 1 ^ 0x1021
+        else:
+            crc = crc << 1
+        crc &= 0xffff
+    return crc
+
+
+def c_string(s, size):
+    b = s.encode()
+    if len(b) >= size:
+        raise SystemExit("'{}' is longer than {} characters".format(s, size - 1))
+    return b + b"\0" * (size - len(b))
+
+
+chip = sys.argv[1]
+out_name = sys.argv[2]
+modules = sys.argv[3:]
+slot_b = 0
+dbl_tap_ms = 0
+while modules[:1] in (["--slot-b"], ["--dbl-tap-ms"]):
+    if modules[0] == "--slot-b":
+        slot_b = int(modules[1], 0)
+    else:
+        dbl_tap_ms = int(modules[1], 0)
+    modules = modules[2:]
+flash_size, table_size, family = CHIPS[chip]
+if not 0 < len(modules) <= MB_MAX_MODULES:
+    raise SystemExit("need 1 to {} modules".format(MB_MAX_MODULES))
+
+table = bytearray(struct.pack("<IHH", BOOT_TABLE_MAGIC, BOOT_TABLE_VERSION, len(modules)))
+for i in range(MB_MAX_MODULES):
+    if i < len(modules):
+        fields = modules[i].split(":", 3) + [""]
+        name, start, length, opts = fields[0], int(fields[1], 0), int(fields[2], 0), fields[3]
+    else:
+        name, start, length, opts = "", 0, 0, ""
+    table += struct.pack("<III", i, start, length)
+    table += c_string(name, NAME_LEN) + c_string(opts, OPTS_LEN)
+
+table += struct.pack("<III", slot_b, 0, dbl_tap_ms)
+
+crc = 0
+for b in table:
+    crc = update_crc(b, crc)
+table += struct.pack("<I", crc)
+
+# Pad to the whole erase unit(s): the boot log after the table starts out blank, whatever was
+# there before
+table += b"\xff" * (table_size - len(table))
+base = flash_size - table_size
+num_blocks = len(table) // 256
+with open(out_name, "wb") as output:
+    for block_no in range(num_blocks):
+        header = struct.pack("<IIIIIIII", UF2_MAGIC_START0, UF2_MAGIC_START1,
+                             UF2_FLAG_FAMILYID_PRESENT, base + block_no * 256, 256,
+                             block_no, num_blocks, family)
+        data = table[block_no * 256:(block_no + 1) * 256]
+        output.write(header + data + b"\0" * (476 - 256) + struct.pack("<I", UF2_MAGIC_END))
+print("Wrote {} blocks to {}".format(num_blocks, out_name))
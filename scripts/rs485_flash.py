@@ -0,0 +1,305 @@
+# Flashes a UF2 file to every node on an RS-485 bus at once, with bootloaders built with USE_UART
+# and USE_UART_BROADCAST (frame format in inc/sam_ba_monitor.h). Needs pyserial for a real bus.
+#
+# python3 scripts/rs485_flash.py PORT[@BAUD] firmware.uf2 [ID,ID,...]
+# python3 scripts/rs485_flash.py sim:N[:LOSS][@BAUD] firmware.uf2
+#
+# All nodes have to be in the bootloader. "#" and "M#" put their UART monitors in broadcast mode,
+# then the nodes are found by their replies in random time slots (unless their ids are given, in
+# hex), every block goes out once, and each node is polled for the runs of blocks it missed, which
+# are broadcast again until all of them have the whole image; then they reset into it.
+#
+# sim:N runs the same against N simulated nodes that each lose a LOSS fraction (default 0.05) of
+# the frames, requests and replies alike, and prints what went over the bus. The blocks sent are
+# the image once plus the repairs; only the polls grow with N.
+import binascii
+import random
+import struct
+import sys
+import time
+
+REQ_SYNC = 0xA6
+REPLY_SYNC = 0x6A
+ADDR_ALL = 0xFFFFFFFF
+MAX_RANGES = 64
+MAX_BLOCKS = 1024 * 1024 // 256 + 100
+OP_BLOCK, OP_DISCOVER, OP_STATUS, OP_RESET = range(1, 5)
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+MAX_ROUNDS = 50
+
+
+def crc16(data):
+    # the XMODEM CRC, same as add_crc() in the bootloader
+    return binascii.crc_hqx(data, 0)
+
+
+def frame(sync, op, addr, payload=b""):
+    data = struct.pack("<BBIH", sync, op, addr, len(payload)) + payload
+    return data + struct.pack("<H", crc16(data))
+
+
+def slot_of(node_id, seed, slots):
+    return (((node_id ^ seed) * 0x9E3779B1 & 0xFFFFFFFF) >> 16) % slots
+
+
+def parse_replies(data):
+    """Splits what came back into (op, id, payload) replies; also tells if there was anything else,
+    like replies that ran into each other"""
+    replies, noise, i = [], False, 0
+    while i < len(data):
+        if data[i] == REPLY_SYNC and i + 8 <= len(data):
+            _, op, node, length = struct.unpack_from("<BBIH", data, i)
+            end = i + 8 + length
+            if end + 2 <= len(data) and crc16(data[i:end]) == struct.unpack_from("<H", data, end)[0]:
+                replies.append((op, node, data[i + 8:end]))
+                i = end + 2
+                continue
+        noise = True
+        i += 1
+    return replies, noise
+
+
+class SerialBus:
+    def __init__(self, port, baud):
+        import serial
+        self.ser = serial.Serial(port, baud, timeout=0.01)
+        self.baud = baud
+        self.sent = self.received = 0
+        self.waited = 0.0
+        # Into the UART monitor, then broadcast mode; nobody answers the M
+        self.ser.write(b"#")
+        time.sleep(0.05)
+        self.ser.write(b"M#")
+        time.sleep(0.05)
+        self.ser.reset_input_buffer()
+
+    def send(self, data):
+        self.ser.write(data)
+        self.sent += len(data)
+
+    def collect(self, wait):
+        self.ser.flush()
+        data = b""
+        end = time.time() + wait
+        while time.time() < end:
+            data += self.ser.read(4096)
+        self.received += len(data)
+        self.waited += wait
+        return data
+
+    def now(self):
+        return time.time()
+
+
+class SimNode:
+    """What sam_ba_bcast_run() does with a frame, minus the flash"""
+
+    def __init__(self, node_id):
+        self.id = node_id
+        self.written = set()
+        self.num_blocks = 0
+        self.known = False
+        self.reset = False
+
+    def complete(self):
+        return 0 < self.num_blocks <= MAX_BLOCKS and len(self.written) >= self.num_blocks
+
+    def handle(self, op, addr, payload):
+        if addr not in (ADDR_ALL, self.id):
+            return None
+        if op == OP_BLOCK and len(payload) == 512:
+            magic0, magic1, _, _, _, block_no, num_blocks = struct.unpack_from("<7I", payload)
+            if magic0 != UF2_MAGIC_START0 or magic1 != UF2_MAGIC_START1 or not num_blocks:
+                return None
+            if self.num_blocks != num_blocks:
+                self.num_blocks = 0xFFFFFFFF if num_blocks >= MAX_BLOCKS or self.num_blocks \
+                    else num_blocks
+            if block_no < MAX_BLOCKS:
+                self.written.add(block_no)
+        elif op == OP_DISCOVER and len(payload) == 8:
+            seed, slots, _ = struct.unpack("<IHH", payload)
+            if slots and not self.known:
+                return slot_of(self.id, seed, slots), b""
+        elif op == OP_STATUS and addr == self.id:
+            self.known = True
+            runs, b = [], 0
+            total = self.num_blocks if self.num_blocks <= MAX_BLOCKS else 0
+            while b < total and len(runs) < MAX_RANGES:
+                if b in self.written:
+                    b += 1
+                    continue
+                first = b
+                while b + 1 < total and b + 1 not in self.written:
+                    b += 1
+                runs.append(struct.pack("<HH", first, b - first + 1))
+                b += 1
+            return 0, struct.pack("<II", self.num_blocks, len(self.written)) + b"".join(runs)
+        elif op == OP_RESET and self.complete():
+            self.reset = True
+        return None
+
+
+class SimBus:
+    def __init__(self, count, loss, baud, seed=1):
+        self.rng = random.Random(seed)
+        self.nodes = [SimNode(self.rng.getrandbits(32)) for _ in range(count)]
+        self.loss = loss
+        self.baud = baud
+        self.sent = self.received = 0
+        self.waited = 0.0
+        self.pending = []
+
+    def send(self, data):
+        self.sent += len(data)
+        _, op, addr, length = struct.unpack_from("<BBIH", data)
+        payload = data[8:8 + length]
+        for node in self.nodes:
+            if node.reset or self.rng.random() < self.loss:
+                continue
+            reply = node.handle(op, addr, payload)
+            if reply:
+                self.pending.append((reply[0], frame(REPLY_SYNC, op, node.id, reply[1])))
+
+    def collect(self, wait):
+        # Replies in the same slot run into each other
+        slots = {}
+        for slot, data in self.pending:
+            slots.setdefault(slot, []).append(data)
+        self.pending = []
+        out = b""
+        for slot in sorted(slots):
+            data = slots[slot]
+            if len(data) > 1 or self.rng.random() < self.loss:
+                out += bytes(b ^ 0x5A for b in data[0])
+            else:
+                out += data[0]
+        self.received += len(out)
+        self.waited += wait
+        return out
+
+    def now(self):
+        return (self.sent + self.received) * 10 / self.baud + self.waited
+
+
+def line_time(bus, length):
+    return (8 + length + 2) * 10 / bus.baud
+
+
+def discover(bus):
+    """Rounds of slotted replies, until three in a row are silent. Nodes stop replying once polled
+    for their status, so every round only hears from those not found yet."""
+    found = []
+    slots, slot_ms = 16, max(2, int(line_time(bus, 0) * 2000) + 1)
+    quiet = 0
+    while quiet < 3:
+        seed = random.getrandbits(32)
+        bus.send(frame(REQ_SYNC, OP_DISCOVER, ADDR_ALL, struct.pack("<IHH", seed, slots, slot_ms)))
+        replies, noise = parse_replies(bus.collect(slots * slot_ms / 1000 + 0.02))
+        heard = {node for op, node, _ in replies if op == OP_DISCOVER}
+        # The poll has to get through: a node that saw one keeps quiet from then on
+        found += [node for node in heard if node not in found and status(bus, node, 10)]
+        quiet = 0 if heard or noise else quiet + 1
+        # More room while replies run into each other
+        if noise:
+            slots = min(0xFFFF, slots * 2)
+    return sorted(found)
+
+
+def status(bus, node, tries=3):
+    for _ in range(tries):
+        bus.send(frame(REQ_SYNC, OP_STATUS, node))
+        replies, _ = parse_replies(bus.collect(line_time(bus, 8 + 4 * MAX_RANGES) + 0.02))
+        for op, rid, payload in replies:
+            if op == OP_STATUS and rid == node and len(payload) >= 8:
+                num_blocks, num_written = struct.unpack_from("<II", payload)
+                runs = [struct.unpack_from("<HH", payload, off)
+                        for off in range(8, len(payload) - 3, 4)]
+                return num_blocks, num_written, runs
+    return None
+
+
+def flash(bus, uf2, nodes):
+    blocks = {}
+    for off in range(0, len(uf2) - 511, 512):
+        block = uf2[off:off + 512]
+        blocks[struct.unpack_from("<I", block, 20)[0]] = block
+    todo = sorted(blocks)
+    sent = polls = 0
+    done = set()
+    for rnd in range(MAX_ROUNDS):
+        for b in todo:
+            bus.send(frame(REQ_SYNC, OP_BLOCK, ADDR_ALL, blocks[b]))
+        sent += len(todo)
+        missing = set()
+        for node in nodes:
+            if node in done:
+                continue
+            polls += 1
+            st = status(bus, node)
+            if st is None:
+                print("node {:08x}: no reply".format(node))
+                continue
+            num_blocks, num_written, runs = st
+            if num_blocks == 0xFFFFFFFF:
+                raise SystemExit("node {:08x} got blocks of different images".format(node))
+            if num_blocks and num_written >= num_blocks:
+                done.add(node)
+            elif not num_blocks:
+                missing |= set(blocks)
+            for first, count in runs:
+                missing.update(range(first, first + count))
+        if len(done) == len(nodes):
+            break
+        todo = sorted(missing & set(blocks))
+    else:
+        raise SystemExit("{} of {} nodes still missing blocks".format(len(nodes) - len(done),
+                                                                      len(nodes)))
+    # A node that missed the reset still answers its status poll
+    for _ in range(5):
+        bus.send(frame(REQ_SYNC, OP_RESET, ADDR_ALL))
+        done = [node for node in done if status(bus, node)]
+        if not done:
+            break
+    else:
+        print("{} nodes did not reset".format(len(done)))
+    return len(blocks), sent, polls, rnd + 1
+
+
+def main(args):
+    if len(args) < 2:
+        raise SystemExit("usage: rs485_flash.py PORT[@BAUD]|sim:N[:LOSS][@BAUD] firmware.uf2 "
+                         "[ID,ID,...]")
+    port, _, baud = args[0].partition("@")
+    baud = int(baud or 115200)
+    uf2 = open(args[1], "rb").read()
+    if port.startswith("sim:"):
+        spec = port.split(":")
+        bus = SimBus(int(spec[1]), float(spec[2]) if len(spec) > 2 else 0.05, baud)
+    else:
+        bus = SerialBus(port, baud)
+
+    start = bus.now()
+    if len(args) > 2:
+        nodes = [int(x, 16) for x in args[2].split(",")]
+    else:
+        nodes = discover(bus)
+    print("{} nodes: {}".format(len(nodes), " ".join("{:08x}".format(n) for n in nodes)))
+    if isinstance(bus, SimBus) and set(nodes) != {n.id for n in bus.nodes}:
+        raise SystemExit("discovery missed {} nodes".format(len(bus.nodes) - len(nodes)))
+
+    total, sent, polls, rounds = flash(bus, uf2, nodes)
+    t = bus.now() - start
+    print("{} blocks, {} sent ({} repeats) in {} rounds, {} status polls".format(
+        total, sent, sent - total, rounds, polls))
+    print("{} bytes out, {} back, {:.2f} s at {} baud{}".format(
+        bus.sent, bus.received, t, baud, " (line time)" if isinstance(bus, SimBus) else ""))
+    if isinstance(bus, SimBus):
+        print("one node at a time, without losses: {:.2f} s".format(
+            len(nodes) * total * (8 + 512 + 2) * 10 / baud))
+        if not all(n.reset for n in bus.nodes):
+            raise SystemExit("not every node reset")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
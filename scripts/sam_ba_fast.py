@@ -0,0 +1,184 @@
+# Host side of the binary SAM-BA mode (USE_FAST_MONITOR, frame format in inc/sam_ba_monitor.h).
+# Needs pyserial (pip install pyserial).
+#
+# python3 scripts/sam_ba_fast.py PORT write firmware.bin [ADDR]
+# python3 scripts/sam_ba_fast.py PORT read ADDR LEN out.bin
+# python3 scripts/sam_ba_fast.py PORT erase ADDR LEN
+# python3 scripts/sam_ba_fast.py PORT reset
+# python3 scripts/sam_ba_fast.py PORT bench ADDR KB [bossac]
+#
+# PORT is the CDC port, or a UART as PORT@BAUD (BOOT_USART_BAUD of the bootloader).
+# ADDR defaults to 0x4000 (SAMD51); use 0x2000 on the SAMD21. write erases nothing beforehand:
+# the bootloader erases as it goes and skips rows that are already right. bench flashes KB of
+# random data BENCH_RUNS times, checks it with a CRC request and prints every run and the best;
+# given the path of a bossac binary, it then does the same with "bossac -e -w -v" for comparison.
+# Each run gets new data, so no row is skipped for already being right.
+import binascii
+import collections
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+import serial
+
+REQ_SYNC = 0xA5
+REPLY_SYNC = 0x5A
+OP_WRITE, OP_ERASE, OP_CRC, OP_READ, OP_EXIT, OP_RESET = range(1, 7)
+OK, BAD_CRC, BAD_OP, BAD_ADDR = range(4)
+ROW_SIZE = 256
+WINDOW = 4
+BENCH_RUNS = 3
+
+
+def crc16(data):
+    # the XMODEM CRC, same as add_crc() in the bootloader
+    return binascii.crc_hqx(data, 0)
+
+
+class FastMonitor:
+    def __init__(self, ser):
+        self.ser = ser
+        self.seq = 0
+        ser.reset_input_buffer()
+        ser.write(b"P#")
+        line = ser.read_until(b"\n\r")
+        if not line.startswith(b"P") or not line.endswith(b"#\n\r"):
+            raise SystemExit("no binary mode: {!r} (bootloader built without USE_FAST_MONITOR?)"
+                             .format(line))
+        self.max_payload = int(line[1:9], 16)
+
+    def _frame(self, op, addr, length, payload):
+        self.seq = (self.seq + 1) & 0xFFFF
+        frame = struct.pack("<BBHII", REQ_SYNC, op, self.seq, addr, length) + payload
+        return self.seq, frame + struct.pack("<H", crc16(frame))
+
+    def _reply(self):
+        while True:
+            b = self.ser.read(1)
+            if not b:
+                raise SystemExit("no reply")
+            if b[0] == REPLY_SYNC:
+                break
+        head = b + self.ser.read(7)
+        _, op, seq, status, _, length = struct.unpack("<BBHBBH", head)
+        rest = self.ser.read(length + 2)
+        if len(rest) != length + 2 or crc16(head + rest[:-2]) != struct.unpack("<H", rest[-2:])[0]:
+            raise SystemExit("garbled reply")
+        return seq, status, rest[:-2]
+
+    def run(self, requests):
+        """Sends (op, addr, length, payload) requests, WINDOW at a time; returns the replies"""
+        todo = collections.deque(self._frame(*r) for r in requests)
+        pending = collections.deque()
+        results = []
+        while todo or pending:
+            while todo and len(pending) < WINDOW:
+                seq, frame = todo.popleft()
+                self.ser.write(frame)
+                pending.append((seq, frame))
+            seq, status, data = self._reply()
+            if seq != pending[0][0] and status != BAD_CRC:
+                raise SystemExit("reply {} out of order, expected {}".format(seq, pending[0][0]))
+            if status == BAD_CRC:
+                # the bootloader dropped everything after the bad frame; send it all again
+                todo.extendleft(reversed(pending))
+                pending.clear()
+                continue
+            if status != OK:
+                raise SystemExit("request {} failed with status {}".format(seq, status))
+            pending.popleft()
+            results.append(data)
+        return results
+
+    def write(self, addr, data):
+        data += b"\xff" * (-len(data) % ROW_SIZE)
+        step = self.max_payload - self.max_payload % ROW_SIZE
+        self.run([(OP_WRITE, addr + off, len(data[off:off + step]), data[off:off + step])
+                  for off in range(0, len(data), step)])
+        return data
+
+    def read(self, addr, length):
+        data = b"".join(self.run([(OP_READ, addr + off, min(self.max_payload, length - off), b"")
+                                  for off in range(0, length, self.max_payload)]))
+        if len(data) < length:
+            raise SystemExit("only {} bytes at 0x{:x} are in flash or SRAM".format(len(data), addr))
+        return data
+
+    def crc(self, addr, length):
+        return struct.unpack("<H", self.run([(OP_CRC, addr, length, b"")])[0])[0]
+
+    def erase(self, addr, length):
+        self.run([(OP_ERASE, addr, length, b"")])
+
+    def exit(self, op=OP_EXIT):
+        self.run([(op, 0, 0, b"")])
+
+
+def bench_runs(name, kb, flash):
+    times = []
+    for i in range(BENCH_RUNS):
+        times.append(flash(os.urandom(kb * 1024)))
+        print("{} run {}: {:.2f} s, {:.1f} KB/s".format(name, i + 1, times[-1], kb / times[-1]))
+    best = min(times)
+    print("{}: {} KB, best {:.2f} s, {:.1f} KB/s".format(name, kb, best, kb / best))
+
+
+def bench(port, mon, addr, kb, bossac):
+    def binary(data):
+        t = time.time()
+        mon.write(addr, data)
+        if mon.crc(addr, len(data)) != crc16(data):
+            raise SystemExit("CRC mismatch after writing")
+        return time.time() - t
+
+    def with_bossac(data):
+        with tempfile.NamedTemporaryFile(suffix=".bin", delete=False) as f:
+            f.write(data)
+        t = time.time()
+        subprocess.check_call([bossac, "--port=" + port, "--offset=0x{:x}".format(addr), "-e",
+                               "-w", "-v", f.name])
+        t = time.time() - t
+        os.unlink(f.name)
+        return t
+
+    bench_runs("binary mode", kb, binary)
+    mon.exit()
+    if not bossac:
+        return
+    mon.ser.close()
+    bench_runs("bossac -e -w -v", kb, with_bossac)
+
+
+def main(args):
+    if len(args) < 2:
+        raise SystemExit("usage: sam_ba_fast.py PORT write|read|erase|reset|bench ...")
+    port, _, baud = args[0].partition("@")
+    cmd = args[1]
+    mon = FastMonitor(serial.Serial(port, int(baud or 115200), timeout=3))
+    if cmd == "write":
+        addr = int(args[3], 0) if len(args) > 3 else 0x4000
+        data = mon.write(addr, open(args[2], "rb").read())
+        if mon.crc(addr, len(data)) != crc16(data):
+            raise SystemExit("CRC mismatch after writing")
+        print("wrote {} bytes at 0x{:x}".format(len(data), addr))
+    elif cmd == "read":
+        with open(args[4], "wb") as f:
+            f.write(mon.read(int(args[2], 0), int(args[3], 0)))
+    elif cmd == "erase":
+        mon.erase(int(args[2], 0), int(args[3], 0))
+    elif cmd == "reset":
+        mon.exit(OP_RESET)
+        return
+    elif cmd == "bench":
+        bench(port, mon, int(args[2], 0), int(args[3]), args[4] if len(args) > 4 else None)
+        return
+    else:
+        raise SystemExit("unknown command " + cmd)
+    mon.exit()
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,103 @@
+# Signs module binaries for USE_SIGNED_IMAGES (see inc/ed25519.h).
+#
+# python3 scripts/sign_image.py keygen signing.key
+# python3 scripts/sign_image.py sign signing.key ovule.bin ovule-signed.bin
+#
+# keygen prints the public key to put in inc/signing_key.h (or SIGNING_PUBLIC_KEY in the
+# board's board_config.h). sign seals the image like add_digest.py and appends the Ed25519
+# signature of the digest, so flash_len has to leave room for 96 bytes after the image.
+# Keep signing.key out of version control.
+import hashlib
+import os
+import sys
+
+from add_digest import seal
+
+# RFC 8032 reference arithmetic; slow, but only the host runs it
+P = 2**255 - 19
+L = 2**252 + 27742317777372353535851937790883648493
+D = -121665 * pow(121666, P - 2, P) % P
+SQRT_M1 = pow(2, (P - 1) // 4, P)
+
+
+def recover_x(y, sign):
+    xx = (y * y - 1) * pow(D * y * y + 1, P - 2, P)
+    x = pow(xx, (P + 3) // 8, P)
+    if (x * x - xx) % P:
+        x = x * SQRT_M1 % P
+    if x & 1 != sign:
+        x = P - x
+    return x
+
+
+BASE_Y = 4 * pow(5, P - 2, P) % P
+BASE = (recover_x(BASE_Y, 0), BASE_Y, 1, recover_x(BASE_Y, 0) * BASE_Y % P)
+
+
+def point_add(p, q):
+    a = (p[1] - p[0]) * (q[1] - q[0]) % P
+    b = (p[1] + p[0]) * (q[1] + q[0]) % P
+    c = 2 * p[3] * q[3] * D % P
+    d = 2 * p[2] * q[2] % P
+    e, f, g, h = b - a, d - c, d + c, b + a
+    return (e * f % P, g * h % P, f * g % P, e * h % P)
+
+
+def point_mul(s, p):
+    q = (0, 1, 1, 0)
+    while s:
+        if s & 1:
+            q = point_add(q, p)
+        p = point_add(p, p)
+        s >>= 1
+    return q
+
+
+def point_encode(p):
+    zi = pow(p[2], P - 2, P)
+    x, y = p[0] * zi % P, p[1] * zi % P
+    return (y | (x & 1) << 255).to_bytes(32, "little")
+
+
+def h_int(*parts):
+    return int.from_bytes(hashlib.sha512(b"".join(parts)).digest(), "little")
+
+
+def expand(seed):
+    h = hashlib.sha512(seed).digest()
+    a = int.from_bytes(h[:32], "little")
+    a &= (1 << 254) - 8
+    a |= 1 << 254
+    return a, h[32:]
+
+
+def public_key(seed):
+    return point_encode(point_mul(expand(seed)[0], BASE))
+
+
+def sign(seed, msg):
+    a, prefix = expand(seed)
+    pub = point_encode(point_mul(a, BASE))
+    r = h_int(prefix, msg) % L
+    big_r = point_encode(point_mul(r, BASE))
+    s = (r + h_int(big_r, pub, msg) * a) % L
+    return big_r + s.to_bytes(32, "little")
+
+
+def c_array(data):
+    return "{" + ", ".join("0x%02x" % b for b in data) + "}"
+
+
+if sys.argv[1] == "keygen":
+    seed = os.urandom(32)
+    with open(sys.argv[2], "wb") as key_file:
+        key_file.write(seed)
+    print("#define SIGNING_PUBLIC_KEY " + c_array(public_key(seed)))
+elif sys.argv[1] == "sign":
+    seed = open(sys.argv[2], "rb").read()
+    sealed = seal(open(sys.argv[3], "rb").read())
+    with open(sys.argv[4], "wb") as output:
+        output.write(sealed + sign(seed, sealed[-32:]))
+    print("{}: {} bytes, signed digest {}".format(sys.argv[4], len(sealed) - 32, sealed[-32:].hex()))
+else:
+    raise SystemExit("usage: sign_image.py keygen KEY | sign KEY IN OUT")
@@ -0,0 +1,90 @@
+# Measures flashing over the boot UART at each baud rate, with a bootloader built with USE_UART
+# and USE_UART_AUTOBAUD. Needs pyserial (pip install pyserial).
+#
+# python3 scripts/uart_bench.py PORT [ADDR] [KB] [RATES...]
+#
+# Syncs the bootloader with a break and 0x55 at 115200, then for every rate switches to it with
+# the L command, flashes KB (default 64) of random data at ADDR (default 0x4000; 0x2000 on the
+# SAMD21) with U, checks it with Z and prints the throughput. The data is random, so only run it
+# against a board whose application can be lost.
+import binascii
+import os
+import sys
+import time
+
+import serial
+
+BASE = 115200
+RATES = [115200, 230400, 460800, 921600, 1000000, 2000000, 3000000]
+
+
+def read_reply(ser, end=b"\n\r"):
+    line = ser.read_until(end)
+    if not line.endswith(end):
+        raise IOError("no reply: {!r}".format(line))
+    return line
+
+
+def switch(ser, baud):
+    ser.write("L{:08X}#".format(baud).encode())
+    reply = read_reply(ser)
+    if int(reply[1:9], 16) != baud:
+        return False
+    ser.flush()
+    ser.baudrate = baud
+    time.sleep(0.01)
+    ser.write(b"#")
+    try:
+        read_reply(ser)
+    except IOError:
+        # the bootloader went back to the old rate after a second without the '#'
+        time.sleep(1)
+        return False
+    return True
+
+
+def bench(ser, addr, data):
+    t = time.time()
+    ser.write("U{:08X},{:08X}#".format(addr, len(data)).encode() + data)
+    read_reply(ser)
+    ser.write("Z{:08X},{:08X}#".format(addr, len(data)).encode())
+    reply = read_reply(ser)
+    t = time.time() - t
+    if int(reply[1:9], 16) != binascii.crc_hqx(data, 0):
+        raise IOError("CRC mismatch")
+    return t
+
+
+def main(args):
+    if not args:
+        raise SystemExit("usage: uart_bench.py PORT [ADDR] [KB] [RATES...]")
+    addr = int(args[1], 0) if len(args) > 1 else 0x4000
+    kb = int(args[2]) if len(args) > 2 else 64
+    rates = [int(r) for r in args[3:]] or RATES
+    data = os.urandom(kb * 1024)
+
+    ser = serial.Serial(args[0], BASE, timeout=2)
+    ser.send_break(0.01)
+    ser.write(b"\x55#")
+    time.sleep(0.05)
+    ser.reset_input_buffer()
+    ser.write(b"V#")
+    print(read_reply(ser).decode(errors="replace").strip())
+
+    for baud in rates:
+        if not switch(ser, baud):
+            print("{:8} baud: not accepted".format(baud))
+            continue
+        try:
+            t = bench(ser, addr, data)
+            print("{:8} baud: {} KB in {:.2f} s, {:.1f} KB/s (line limit {:.1f} KB/s)".format(
+                baud, kb, t, kb / t, baud / 10 / 1024))
+        except IOError as e:
+            print("{:8} baud: {}".format(baud, e))
+        if not switch(ser, BASE):
+            # after 16 line errors the bootloader is back at the base rate anyway
+            ser.baudrate = BASE
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,55 @@
+# Appends the transfer digest block for USE_TRANSFER_DIGEST to a UF2 file: a UF2_FLAG_NOFLASH |
+# UF2_FLAG_TRANSFER_DIGEST block holding the XOR of the SHA-256 of every flashable block
+# (targetAddr as 4 little endian bytes, then the payload). numBlocks is bumped in all blocks.
+#
+# python3 scripts/uf2_digest.py firmware.uf2 firmware-digest.uf2
+#
+# Run it before scripts/encrypt_uf2.py, the digest is over the plain payload.
+import hashlib
+import struct
+import sys
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_NOFLASH = 0x00000001
+UF2_FLAG_FAMILYID_PRESENT = 0x00002000
+UF2_FLAG_ENCRYPTED = 0x00100000
+UF2_FLAG_TRANSFER_DIGEST = 0x00200000
+
+
+def add_digest(uf2):
+    """Returns uf2 with the digest block appended"""
+    blocks = [bytearray(uf2[pos:pos + 512]) for pos in range(0, len(uf2), 512)]
+    digest = bytearray(32)
+    family_flags, family = 0, 0
+    for i, bl in enumerate(blocks):
+        start0, start1, flags, addr, size, _, _, family_id = struct.unpack_from("<8I", bl)
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or \
+                struct.unpack_from("<I", bl, 508)[0] != UF2_MAGIC_END:
+            raise SystemExit("not a UF2 block at offset {}".format(i * 512))
+        if flags & UF2_FLAG_TRANSFER_DIGEST:
+            raise SystemExit("the file already has a digest block")
+        if flags & UF2_FLAG_ENCRYPTED:
+            raise SystemExit("add the digest before encrypting")
+        if flags & UF2_FLAG_NOFLASH:
+            continue
+        h = hashlib.sha256(struct.pack("<I", addr) + bl[32:32 + size]).digest()
+        digest = bytearray(a ^ b for a, b in zip(digest, h))
+        family_flags, family = flags & UF2_FLAG_FAMILYID_PRESENT, family_id
+
+    num = len(blocks) + 1
+    for bl in blocks:
+        struct.pack_into("<I", bl, 24, num)
+    blocks.append(bytearray(
+        struct.pack("<8I", UF2_MAGIC_START0, UF2_MAGIC_START1,
+                    UF2_FLAG_NOFLASH | UF2_FLAG_TRANSFER_DIGEST | family_flags, 0, 32, num - 1, num,
+                    family) + bytes(digest).ljust(476, b"\x00") + struct.pack("<I", UF2_MAGIC_END)))
+    return b"".join(blocks), bytes(digest)
+
+
+if __name__ == "__main__":
+    out, digest = add_digest(open(sys.argv[1], "rb").read())
+    with open(sys.argv[2], "wb") as output:
+        output.write(out)
+    print("{}: {} blocks, transfer digest {}".format(sys.argv[2], len(out) // 512, digest.hex()))
@@ -0,0 +1,247 @@
+#include <stddef.h>
+#include "boot_table.h"
+
+static const char scanned_name[] = "";
+
+// A/B slot layout, read from the table on first use; len is 0 without A/B slots
+static struct {
+    bool loaded;
+    bool staged;
+    uint32_t active;
+    uint32_t start[2];
+    uint32_t len;
+} slots;
+
+// Boot state found in the double tap word at reset or else in the boot log, 0 if there was none
+static uint32_t boot_state;
+// Last state in the boot log, 0 if there is none, and the index of the first blank record
+static uint32_t boot_logged, boot_log_next;
+
+static uint16_t boot_table_crc(const BootTable *table) {
+    const uint8_t *data = (const uint8_t *)table;
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < offsetof(BootTable, crc); ++i)
+        crc = add_crc(*data++, crc);
+    return crc;
+}
+
+static bool boot_table_valid(const BootTable *table) {
+    if (table->magic != BOOT_TABLE_MAGIC || table->version != BOOT_TABLE_VERSION ||
+        table->module_cnt > MB_MAX_MODULES)
+        return false;
+
+    for (int i = 0; i < table->module_cnt; ++i) {
+        const BootTableEntry *e = &table->entries[i];
+        if (e->module_name[BOOT_TABLE_NAME_LEN - 1] || e->command_line_opts[BOOT_TABLE_OPTS_LEN - 1])
+            return false;
+    }
+
+    return boot_table_crc(table) == table->crc;
+}
+
+uint32_t boot_table_dbl_tap_ms(void) {
+    const BootTable *table = BOOT_TABLE;
+
+    if (boot_table_valid(table) && table->dbl_tap_ms)
+        return table->dbl_tap_ms;
+    return DBL_TAP_DEFAULT_MS;
+}
+
+// Reads the boot log up to its first blank record
+static void boot_log_read(void) {
+    boot_logged = 0;
+    for (boot_log_next = 0; boot_log_next < BOOT_LOG_RECORDS; boot_log_next++) {
+        uint32_t state = *(const uint32_t *)(BOOT_LOG_ADDR + boot_log_next * BOOT_LOG_UNIT);
+        if (state == 0xffffffff)
+            break;
+        if ((state & UF2_BOOT_STATE_TAG_MASK) == UF2_BOOT_STATE_TAG)
+            boot_logged = state;
+    }
+}
+
+static void boot_slots_init(void) {
+    const BootTable *table = BOOT_TABLE;
+
+    slots.loaded = true;
+    // Before the double tap check overwrites it; after power on the word is random
+    if (!RESET_CONTROLLER->RCAUSE.bit.POR &&
+        (*UF2_BOOT_STATE_PTR & UF2_BOOT_STATE_TAG_MASK) == UF2_BOOT_STATE_TAG)
+        boot_state = *UF2_BOOT_STATE_PTR;
+#if USE_BANK_SWAP
+    // The NVM banks already are the A/B slots
+    return;
+#endif
+    if (!boot_table_valid(table) || !table->module_cnt || !table->slot_b_start)
+        return;
+
+    uint32_t a = table->entries[0].flash_start;
+    uint32_t b = table->slot_b_start;
+    uint32_t len = table->entries[0].flash_len;
+    if (a < APP_START_ADDRESS || b < APP_START_ADDRESS || len > APP_END_ADDRESS - a ||
+        len > APP_END_ADDRESS - b || (a < b + len && b < a + len)) {
+        logval("bad slot b", b);
+        return;
+    }
+
+    slots.active = table->active_slot & 1;
+    slots.start[0] = a;
+    slots.start[1] = b;
+    slots.len = len;
+
+    // The word holds the newest state, but only after a reset that kept RAM
+    boot_log_read();
+    if (!boot_state)
+        boot_state = boot_logged;
+}
+
+// Rewrites the table with another active slot, which also empties the boot log. The table has
+// its erase unit(s) to itself, so this only costs one erase (four rows on the SAMD21); it happens
+// after an update, on rollback and when the log is full, never on a normal boot.
+static void boot_table_set_active(uint32_t slot) {
+    BootTable table;
+
+    memcpy(&table, BOOT_TABLE, sizeof(table));
+    table.active_slot = slot;
+    table.crc = boot_table_crc(&table);
+    flash_erase_range(BOOT_TABLE_ADDR, BOOT_TABLE_SIZE);
+    flash_write_words((uint32_t *)BOOT_TABLE_ADDR, (void *)&table, sizeof(table) / 4);
+    slots.active = slot;
+    boot_logged = boot_log_next = 0;
+}
+
+static void boot_state_set(uint32_t state) {
+    boot_state = state;
+    *UF2_BOOT_STATE_PTR = state;
+    if (state == boot_logged)
+        return;
+    if (boot_log_next >= BOOT_LOG_RECORDS)
+        boot_table_set_active(slots.active);
+    flash_write_words((uint32_t *)(BOOT_LOG_ADDR + boot_log_next++ * BOOT_LOG_UNIT), &state, 1);
+    boot_logged = state;
+}
+
+static void boot_state_reset(uint32_t slot) {
+    boot_state_set(UF2_BOOT_STATE_TAG | slot << 8);
+}
+
+static bool slot_has_image(uint32_t slot) {
+    return ((const MultibootHeader *)slots.start[slot])->magic == MULTIBOOT_MAGIC;
+}
+
+static uint32_t boot_slot_select(void) {
+    uint32_t slot = slots.active;
+
+    if (!boot_state || BOOT_STATE_SLOT(boot_state) != slot)
+        boot_state_reset(slot);
+
+    if (boot_state & UF2_BOOT_CONFIRMED) {
+        // The double tap check cleared the word, the application has to find it again
+        boot_state_set(boot_state);
+        return slot;
+    }
+
+    if (BOOT_STATE_ATTEMPTS(boot_state) >= BOOT_MAX_ATTEMPTS && slot_has_image(slot ^ 1)) {
+        logval("rollback to slot", slot ^ 1);
+        slot ^= 1;
+        boot_table_set_active(slot);
+        // The image we go back to was running before, don't bounce back to the broken one
+        boot_state_set(UF2_BOOT_STATE_TAG | slot << 8 | UF2_BOOT_CONFIRMED);
+        return slot;
+    }
+
+    if (BOOT_STATE_ATTEMPTS(boot_state) < 0xff)
+        boot_state_set(boot_state + 1);
+    else
+        boot_state_set(boot_state);
+    return slot;
+}
+
+uint32_t boot_slot_active_start(void) {
+    if (!slots.loaded)
+        boot_slots_init();
+    return slots.len ? slots.start[slots.active] : APP_START_ADDRESS;
+}
+
+bool boot_slot_write_allowed(uint32_t addr) {
+    if (!slots.loaded)
+        boot_slots_init();
+    if (!slots.len)
+        return true;
+
+    uint32_t active = slots.start[slots.active];
+    uint32_t inactive = slots.start[slots.active ^ 1];
+    if (addr >= active && addr < active + slots.len)
+        return false;
+    if (addr >= inactive && addr < inactive + slots.len)
+        slots.staged = true;
+    return true;
+}
+
+void boot_slot_commit(void) {
+    if (!slots.staged)
+        return;
+    slots.staged = false;
+
+    uint32_t slot = slots.active ^ 1;
+    if (!slot_has_image(slot)) {
+        logval("no image in slot", slot);
+        return;
+    }
+#if USE_IMAGE_DIGEST
+    // The running image stays active if the new one doesn't match its digest
+    if (multiboot_check_digest((const uint8_t *)slots.start[slot], slots.len) == MB_DIGEST_BAD)
+        return;
+#endif
+#if USE_SIGNED_IMAGES
+    if (multiboot_check_signature((const uint8_t *)slots.start[slot], slots.len) != MB_DIGEST_OK)
+        return;
+#endif
+    boot_table_set_active(slot);
+    boot_state_reset(slot);
+}
+
+static int boot_table_scan(BootVectorEntry *entries) {
+    ImageHeaderTag tags[MB_MAX_TAGS];
+    int cnt = 0;
+
+    for (uint32_t addr = APP_START_ADDRESS; addr < APP_END_ADDRESS && cnt < MB_MAX_MODULES;
+         addr += BOOT_TABLE_SCAN_STEP) {
+        if (decode_multiboot_image_headers((uint8_t *)addr, tags, MB_MAX_TAGS) < 0)
+            continue;
+        // Every module runs up to the next one
+        if (cnt)
+            entries[cnt - 1].flash_len = addr - (uint32_t)entries[cnt - 1].flash_start;
+        entries[cnt].id = cnt;
+        entries[cnt].flash_start = (uint32_t *)addr;
+        entries[cnt].flash_len = APP_END_ADDRESS - addr;
+        entries[cnt].module_name = scanned_name;
+        entries[cnt].command_line_opts = scanned_name;
+        cnt++;
+    }
+
+    logval("scanned modules", cnt);
+    return cnt;
+}
+
+int boot_table_load(BootVectorEntry *entries) {
+    const BootTable *table = BOOT_TABLE;
+
+    if (!boot_table_valid(table))
+        return boot_table_scan(entries);
+
+    for (int i = 0; i < table->module_cnt; ++i) {
+        const BootTableEntry *e = &table->entries[i];
+        entries[i].id = e->id;
+        entries[i].flash_start = (uint32_t *)e->flash_start;
+        entries[i].flash_len = e->flash_len;
+        entries[i].module_name = e->module_name;
+        entries[i].command_line_opts = e->command_line_opts;
+    }
+
+    if (!slots.loaded)
+        boot_slots_init();
+    if (slots.len)
+        entries[0].flash_start = (uint32_t *)slots.start[boot_slot_select()];
+
+    return table->module_cnt;
+}
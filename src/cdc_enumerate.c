@@ -488,7 +488,7 @@ void AT91F_InitUSB(void) {
     while (GCLK->STATUS.bit.SYNCBUSY) {}
     #endif
     #ifdef SAMD51
-    GCLK->PCHCTRL[USB_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK0_Val | (1 << GCLK_PCHCTRL_CHEN_Pos);
+    GCLK->PCHCTRL[USB_GCLK_ID].reg = GCLK_48MHZ | (1 << GCLK_PCHCTRL_CHEN_Pos);
     MCLK->AHBMASK.bit.USB_ = true;
     MCLK->APBBMASK.bit.USB_ = true;
 
@@ -746,6 +746,10 @@ static void configureInOut(uint8_t in_ep) {
 
 static uint16_t wLength;
 
+#if USE_CDC_BUFFERED
+static void cdc_buffers_reset(void);
+#endif
+
 static void sendCtrl(const void *data, uint32_t len) { USB_Write(data, MIN(len, wLength), 0); }
 
 //*----------------------------------------------------------------------------
@@ -854,6 +858,9 @@ void AT91F_CDC_Enumerate() {
 
 #if USE_CDC
         configureInOut(USB_EP_IN);
+#if USE_CDC_BUFFERED
+        cdc_buffers_reset();
+#endif
 
         /* Configure INTERRUPT IN endpoint for CDC COMM interface*/
         USB->DEVICE.DeviceEndpoint[USB_EP_COMM].EPCFG.reg = USB_DEVICE_EPCFG_EPTYPE1(4);
@@ -1096,13 +1103,166 @@ void usb_init(void) {
 #include "usart_sam_ba.h"
 
 #if USE_UART
-#define UART(e)                                                                                    
-    if (b_sam_ba_interface_usart)                                                                  
+#define UART(e)                                                                                    \
+    if (b_sam_ba_interface_usart)                                                                  \
         return e;
 #else
 #define UART(e)
 #endif
 
+#if USE_CDC_BUFFERED
+// OUT transfers land in one half of cdc_rx_buf while the monitor reads the other. A transfer takes
+// up to CDC_RX_HALF bytes, several packets, and ends early on a short one; as its BYTE_COUNT grows
+// packet by packet, what has come in can be read before that. With both halves unread nothing is
+// armed, and the host gets NAKs until the monitor catches up.
+#define CDC_RX_HALF 512
+#define CDC_TX_SIZE 128
+#define RX_FREE 0
+#define RX_ARMED 1
+#define RX_DONE 2
+
+__attribute__((__aligned__(4))) static uint8_t cdc_rx_buf[2][CDC_RX_HALF];
+static uint8_t rx_state[2];
+static uint16_t rx_len[2];
+static uint8_t rx_read, rx_fill;
+static uint16_t rx_pos;
+
+// Writes shorter than a packet are gathered in one of these while the other one goes out
+__attribute__((__aligned__(4))) static uint8_t cdc_tx_buf[2][CDC_TX_SIZE];
+static uint8_t tx_fill;
+static uint16_t tx_len;
+static bool tx_busy;
+
+static void cdc_buffers_reset(void) {
+    rx_state[0] = rx_state[1] = RX_FREE;
+    rx_read = rx_fill = 0;
+    rx_pos = 0;
+    tx_fill = 0;
+    tx_len = 0;
+    tx_busy = false;
+}
+
+static void cdc_rx_poll(void) {
+    UsbDeviceDescBank *bank = &usb_endpoint_table[USB_EP_OUT].DeviceDescBank[0];
+
+    if (rx_state[rx_fill] == RX_ARMED &&
+        (USB->DEVICE.DeviceEndpoint[USB_EP_OUT].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0)) {
+        rx_len[rx_fill] = bank->PCKSIZE.bit.BYTE_COUNT;
+        rx_state[rx_fill] = RX_DONE;
+        USB->DEVICE.DeviceEndpoint[USB_EP_OUT].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT0;
+        rx_fill ^= 1;
+    }
+    if (rx_state[rx_fill] == RX_FREE) {
+        bank->ADDR.reg = (uint32_t)cdc_rx_buf[rx_fill];
+        bank->PCKSIZE.bit.BYTE_COUNT = 0;
+        bank->PCKSIZE.bit.MULTI_PACKET_SIZE = CDC_RX_HALF;
+        rx_state[rx_fill] = RX_ARMED;
+        USB->DEVICE.DeviceEndpoint[USB_EP_OUT].EPSTATUSCLR.reg = USB_DEVICE_EPSTATUSCLR_BK0RDY;
+    }
+}
+
+// Bytes that can be read from the current half
+static uint32_t cdc_rx_avail(void) {
+    cdc_rx_poll();
+    if (rx_state[rx_read] == RX_DONE && rx_pos == rx_len[rx_read]) {
+        rx_state[rx_read] = RX_FREE;
+        rx_read ^= 1;
+        rx_pos = 0;
+        cdc_rx_poll();
+    }
+    if (rx_state[rx_read] == RX_ARMED)
+        return usb_endpoint_table[USB_EP_OUT].DeviceDescBank[0].PCKSIZE.bit.BYTE_COUNT - rx_pos;
+    if (rx_state[rx_read] == RX_DONE)
+        return rx_len[rx_read] - rx_pos;
+    return 0;
+}
+
+static uint32_t cdc_rx_read(void *data, uint32_t length) {
+    uint32_t n = cdc_rx_avail();
+
+    if (n > length)
+        n = length;
+    memcpy(data, cdc_rx_buf[rx_read] + rx_pos, n);
+    rx_pos += n;
+    return n;
+}
+
+// Arms the IN endpoint with length bytes at data, which must stay put until the transfer is done
+static void cdc_tx_start(void const *data, uint32_t length) {
+    UsbDeviceDescBank *bank = &usb_endpoint_table[USB_EP_IN].DeviceDescBank[1];
+
+    bank->ADDR.reg = (uint32_t)data;
+    bank->PCKSIZE.bit.BYTE_COUNT = length;
+    bank->PCKSIZE.bit.MULTI_PACKET_SIZE = 0;
+    bank->PCKSIZE.bit.AUTO_ZLP = true;
+    USB->DEVICE.DeviceEndpoint[USB_EP_IN].EPINTFLAG.reg = USB_DEVICE_EPINTFLAG_TRCPT1;
+    USB->DEVICE.DeviceEndpoint[USB_EP_IN].EPSTATUSSET.reg = USB_DEVICE_EPSTATUSSET_BK1RDY;
+    tx_busy = true;
+}
+
+static void cdc_tx_poll(void) {
+    if (tx_busy &&
+        (USB->DEVICE.DeviceEndpoint[USB_EP_IN].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT1))
+        tx_busy = false;
+    if (!tx_busy && tx_len) {
+        cdc_tx_start(cdc_tx_buf[tx_fill], tx_len);
+        tx_fill ^= 1;
+        tx_len = 0;
+    }
+}
+
+// Waits for the host to take the transfer in flight (and with all, what was gathered after it).
+// A host that doesn't read holds the monitor here, which stops it reading in turn; a bus reset
+// drops the lot and returns false.
+static bool cdc_tx_wait(bool all) {
+    while (tx_busy || (all && tx_len)) {
+        cdc_tx_poll();
+        if (!USB_Ok()) {
+            cdc_buffers_reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t cdc_usb_write(void const *data, uint32_t length) {
+    const uint8_t *src = data;
+    uint32_t left = length;
+
+    if (!USB_Ok())
+        return 0;
+    // The USB DMA only reads word aligned SRAM: flash (a SAM-BA read of it) and unaligned buffers
+    // go through cdc_tx_buf like short writes
+    if (length >= PKT_SIZE && !((uint32_t)data & 3) && (uint32_t)data - RAM_START < RAM_SIZE &&
+        (uint32_t)data + length - RAM_START <= RAM_SIZE) {
+        // Straight from the caller's buffer, after what was gathered before; waited for here,
+        // since the caller may reuse the buffer as soon as we return
+        if (!cdc_tx_wait(true))
+            return 0;
+        cdc_tx_start(data, length);
+        return cdc_tx_wait(false) ? length : 0;
+    }
+    while (left) {
+        uint32_t n = CDC_TX_SIZE - tx_len;
+
+        if (!n) {
+            if (!cdc_tx_wait(false))
+                return 0;
+            cdc_tx_poll();
+            continue;
+        }
+        if (n > left)
+            n = left;
+        memcpy(cdc_tx_buf[tx_fill] + tx_len, src, n);
+        tx_len += n;
+        src += n;
+        left -= n;
+        cdc_tx_poll();
+    }
+    return length;
+}
+#endif
+
 bool cdc_is_rx_ready(void) {
     UART(usart_is_rx_ready())
 
@@ -1110,22 +1270,35 @@ bool cdc_is_rx_ready(void) {
     if (!USB_Ok())
         return 0;
 
+#if USE_CDC_BUFFERED
+    cdc_tx_poll();
+    return cdc_rx_avail() != 0;
+#else
     /* Return transfer complete 0 flag status */
     return (USB->DEVICE.DeviceEndpoint[USB_EP_OUT].EPINTFLAG.reg & USB_DEVICE_EPINTFLAG_TRCPT0);
+#endif
 }
 
 uint32_t cdc_write_buf(void const *data, uint32_t length) {
     UART(usart_putdata(data, length))
+#if USE_CDC_BUFFERED
+    return cdc_usb_write(data, length);
+#else
     /* Send the specified number of bytes on USB CDC */
     USB_Write((const char *)data, length, USB_EP_IN);
     return length;
+#endif
 }
 
 uint32_t cdc_write_buf_xmd(void const *data, uint32_t length) {
     UART(usart_putdata_xmd(data, length))
+#if USE_CDC_BUFFERED
+    return cdc_usb_write(data, length);
+#else
     /* Send the specified number of bytes on USB CDC */
     USB_Write((const char *)data, length, USB_EP_IN);
     return length;
+#endif
 }
 
 uint32_t cdc_read_buf(void *data, uint32_t length) {
@@ -1135,8 +1308,13 @@ uint32_t cdc_read_buf(void *data, uint32_t length) {
     if (!USB_Ok())
         return 0;
 
+#if USE_CDC_BUFFERED
+    cdc_tx_poll();
+    return cdc_rx_read(data, length);
+#else
     /* Read from USB CDC */
     return USB_Read((char *)data, length, USB_EP_OUT);
+#endif
 }
 
 uint32_t cdc_read_buf_xmd(void *data, uint32_t length) {
@@ -1145,8 +1323,35 @@ uint32_t cdc_read_buf_xmd(void *data, uint32_t length) {
     if (!USB_Ok())
         return 0;
 
+#if USE_CDC_BUFFERED
+    for (uint32_t left = length; left;) {
+        cdc_tx_poll();
+        uint32_t n = cdc_rx_read(data, left);
+        data = (uint8_t *)data + n;
+        left -= n;
+        // Keeps enumeration going, and gives up on a bus reset
+        if (!USB_Ok()) {
+            cdc_buffers_reset();
+            return length - left;
+        }
+    }
+#else
     /* Blocking read till specified number of bytes is received */
     USB_ReadBlocking((char *)data, length, USB_EP_OUT, 0);
+#endif
 
     return length;
 }
+
+void cdc_flush(void) {
+#if USE_UART
+    if (b_sam_ba_interface_usart) {
+        usart_flush();
+        return;
+    }
+#endif
+#if USE_CDC_BUFFERED
+    if (USB_Ok())
+        cdc_tx_wait(true);
+#endif
+}
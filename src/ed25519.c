@@ -0,0 +1,431 @@
+#include "uf2.h"
+#include "ed25519.h"
+
+// Ed25519 verification in the spirit of TweetNaCl: small rather than fast, and not constant
+// time, which verification of public data doesn't need. Field elements are 8 x 32-bit limbs
+// kept below 2^256 and only fully reduced for output; 2^256 = 38 (mod p) does the folding.
+//
+// The limb products are the hot spot. The M4 accumulates them with UMAAL, which can't
+// overflow; the M0+ has no 32x32->64 multiply, so mul32() builds one from four 16x16 MULS
+// instead of going through the libgcc 64x64 multiply.
+
+typedef uint32_t fe[8];
+typedef fe point[4]; // extended coordinates X, Y, Z, T
+
+static const fe fe_d2 = {0x26b2f159, 0xebd69b94, 0x8283b156, 0x00e0149a,
+                         0xeef3d130, 0x198e80f2, 0x56dffce7, 0x2406d9dc};
+static const fe fe_d = {0x135978a3, 0x75eb4dca, 0x4141d8ab, 0x00700a4d,
+                        0x7779e898, 0x8cc74079, 0x2b6ffe73, 0x52036cee};
+static const fe fe_sqrtm1 = {0x4a0ea0b0, 0xc4ee1b27, 0xad2fe478, 0x2f431806,
+                             0x3dfbd7a7, 0x2b4d0099, 0x4fc1df0b, 0x2b832480};
+static const point base = {
+    {0x8f25d51a, 0xc9562d60, 0x9525a7b2, 0x692cc760, 0xfdd6dc5c, 0xc0a4e231, 0xcd6e53fe,
+     0x216936d3},
+    {0x66666658, 0x66666666, 0x66666666, 0x66666666, 0x66666666, 0x66666666, 0x66666666,
+     0x66666666},
+    {1},
+    {0xa5b7dda3, 0x6dde8ab3, 0x775152f5, 0x20f09f80, 0x64abe37d, 0x66ea4e8e, 0xd78b7665,
+     0x67875f0f},
+};
+
+#if defined(__ARM_ARCH_7EM__)
+// hi:lo = a * b + lo + hi
+#define MUL_ACC(lo, hi, a, b) __asm__("umaal %0, %1, %2, %3" : "+r"(lo), "+r"(hi) : "r"(a), "r"(b))
+#else
+static uint64_t mul32(uint32_t a, uint32_t b) {
+    uint32_t ll = (a & 0xffff) * (b & 0xffff);
+    uint32_t lh = (a & 0xffff) * (b >> 16);
+    uint32_t hl = (a >> 16) * (b & 0xffff);
+    uint32_t hh = (a >> 16) * (b >> 16);
+    uint32_t mid = (ll >> 16) + (lh & 0xffff) + (hl & 0xffff);
+    uint32_t hi = hh + (lh >> 16) + (hl >> 16) + (mid >> 16);
+    return (uint64_t)hi << 32 | (mid << 16 | (ll & 0xffff));
+}
+#define MUL_ACC(lo, hi, a, b)                                                                      \
+    do {                                                                                           \
+        uint64_t _x = mul32(a, b) + lo + hi;                                                       \
+        lo = (uint32_t)_x;                                                                         \
+        hi = (uint32_t)(_x >> 32);                                                                 \
+    } while (0)
+#endif
+
+// Adds carry * 2^256 back in as carry * 38
+static void fe_fold(uint32_t *r, uint32_t carry) {
+    while (carry) {
+        uint64_t x = carry * 38;
+        for (int i = 0; i < 8; ++i) {
+            x += r[i];
+            r[i] = (uint32_t)x;
+            x >>= 32;
+        }
+        carry = (uint32_t)x;
+    }
+}
+
+static void fe_add(fe r, const fe a, const fe b) {
+    uint64_t x = 0;
+    for (int i = 0; i < 8; ++i) {
+        x += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)x;
+        x >>= 32;
+    }
+    fe_fold(r, (uint32_t)x);
+}
+
+// a - b + 4p, which stays positive for any b below 2^256
+static void fe_sub(fe r, const fe a, const fe b) {
+    int64_t x = 0;
+    for (int i = 0; i < 8; ++i) {
+        x += (int64_t)a[i] - b[i] + (i ? 0xffffffff : 0xffffffb4);
+        r[i] = (uint32_t)x;
+        x >>= 32;
+    }
+    fe_fold(r, (uint32_t)(x + 1));
+}
+
+static void fe_mul(fe r, const fe a, const fe b) {
+    uint32_t t[16];
+
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < 8; ++i) {
+        uint32_t carry = 0;
+        for (int j = 0; j < 8; ++j)
+            MUL_ACC(t[i + j], carry, a[i], b[j]);
+        t[i + 8] = carry;
+    }
+
+    uint32_t carry = 0;
+    for (int i = 0; i < 8; ++i) {
+        uint32_t hi = 0;
+        MUL_ACC(t[i], hi, t[i + 8], 38);
+        uint64_t x = (uint64_t)t[i] + carry;
+        r[i] = (uint32_t)x;
+        carry = hi + (uint32_t)(x >> 32);
+    }
+    fe_fold(r, carry);
+}
+
+static void fe_sq(fe r, const fe a) {
+    fe_mul(r, a, a);
+}
+
+// Fully reduced, below p
+static void fe_canon(fe r) {
+    fe s;
+    uint64_t x = (r[7] >> 31) * 19;
+    r[7] &= 0x7fffffff;
+    for (int i = 0; i < 8; ++i) {
+        x += r[i];
+        r[i] = (uint32_t)x;
+        x >>= 32;
+    }
+    x = 19;
+    for (int i = 0; i < 8; ++i) {
+        x += r[i];
+        s[i] = (uint32_t)x;
+        x >>= 32;
+    }
+    if (s[7] >> 31) {
+        s[7] &= 0x7fffffff;
+        memcpy(r, s, sizeof(s));
+    }
+}
+
+static void fe_tobytes(uint8_t *out, const fe a) {
+    fe t;
+    memcpy(t, a, sizeof(t));
+    fe_canon(t);
+    for (int i = 0; i < 32; ++i)
+        out[i] = t[i / 4] >> (8 * (i % 4));
+}
+
+static void fe_frombytes(fe r, const uint8_t *in) {
+    for (int i = 0; i < 8; ++i)
+        r[i] = in[4 * i] | in[4 * i + 1] << 8 | in[4 * i + 2] << 16 | (uint32_t)in[4 * i + 3] << 24;
+    r[7] &= 0x7fffffff;
+}
+
+static bool fe_equal(const fe a, const fe b) {
+    uint8_t x[32], y[32];
+    fe_tobytes(x, a);
+    fe_tobytes(y, b);
+    return memcmp(x, y, 32) == 0;
+}
+
+static int fe_parity(const fe a) {
+    uint8_t x[32];
+    fe_tobytes(x, a);
+    return x[0] & 1;
+}
+
+// a^(p - 2)
+static void fe_invert(fe r, const fe a) {
+    fe c;
+    memcpy(c, a, sizeof(c));
+    for (int i = 253; i >= 0; --i) {
+        fe_sq(c, c);
+        if (i != 2 && i != 4)
+            fe_mul(c, c, a);
+    }
+    memcpy(r, c, sizeof(c));
+}
+
+// a^((p - 5) / 8)
+static void fe_pow2523(fe r, const fe a) {
+    fe c;
+    memcpy(c, a, sizeof(c));
+    for (int i = 250; i >= 0; --i) {
+        fe_sq(c, c);
+        if (i != 1)
+            fe_mul(c, c, a);
+    }
+    memcpy(r, c, sizeof(c));
+}
+
+// p += q; unified, so it doubles too
+static void point_add(point p, const point q) {
+    fe a, b, c, d, t, e, f, g, h;
+
+    fe_sub(a, p[1], p[0]);
+    fe_sub(t, q[1], q[0]);
+    fe_mul(a, a, t);
+    fe_add(b, p[0], p[1]);
+    fe_add(t, q[0], q[1]);
+    fe_mul(b, b, t);
+    fe_mul(c, p[3], q[3]);
+    fe_mul(c, c, fe_d2);
+    fe_mul(d, p[2], q[2]);
+    fe_add(d, d, d);
+    fe_sub(e, b, a);
+    fe_sub(f, d, c);
+    fe_add(g, d, c);
+    fe_add(h, b, a);
+
+    fe_mul(p[0], e, f);
+    fe_mul(p[1], h, g);
+    fe_mul(p[2], g, f);
+    fe_mul(p[3], e, h);
+}
+
+static void point_encode(uint8_t *out, const point p) {
+    fe zi, x, y;
+    fe_invert(zi, p[2]);
+    fe_mul(x, p[0], zi);
+    fe_mul(y, p[1], zi);
+    fe_tobytes(out, y);
+    out[31] ^= fe_parity(x) << 7;
+}
+
+// Decodes the public key negated, as that is what the check needs
+static bool point_decode_neg(point r, const uint8_t *in) {
+    fe num, den, den2, den4, den6, t, chk;
+    static const fe one = {1};
+
+    memcpy(r[2], one, sizeof(fe));
+    fe_frombytes(r[1], in);
+    fe_sq(num, r[1]);
+    fe_mul(den, num, fe_d);
+    fe_sub(num, num, r[2]);
+    fe_add(den, r[2], den);
+
+    fe_sq(den2, den);
+    fe_sq(den4, den2);
+    fe_mul(den6, den4, den2);
+    fe_mul(t, den6, num);
+    fe_mul(t, t, den);
+
+    fe_pow2523(t, t);
+    fe_mul(t, t, num);
+    fe_mul(t, t, den);
+    fe_mul(t, t, den);
+    fe_mul(r[0], t, den);
+
+    fe_sq(chk, r[0]);
+    fe_mul(chk, chk, den);
+    if (!fe_equal(chk, num))
+        fe_mul(r[0], r[0], fe_sqrtm1);
+
+    fe_sq(chk, r[0]);
+    fe_mul(chk, chk, den);
+    if (!fe_equal(chk, num))
+        return false;
+
+    if (fe_parity(r[0]) == (in[31] >> 7)) {
+        static const fe zero;
+        fe_sub(r[0], zero, r[0]);
+    }
+    fe_mul(r[3], r[0], r[1]);
+    return true;
+}
+
+// Group order L, little endian
+static const uint8_t order[32] = {0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58,
+                                  0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+                                  0,    0,    0,    0,    0,    0,    0,    0,
+                                  0,    0,    0,    0,    0,    0,    0,    0x10};
+
+// r = x mod L, x being 64 little endian bytes
+static void mod_order(uint8_t *r, int64_t *x) {
+    int64_t carry;
+    int i, j;
+
+    for (i = 63; i >= 32; --i) {
+        carry = 0;
+        for (j = i - 32; j < i - 12; ++j) {
+            x[j] += carry - 16 * x[i] * order[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+    carry = 0;
+    for (j = 0; j < 32; ++j) {
+        x[j] += carry - (x[31] >> 4) * order[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; ++j)
+        x[j] -= carry * order[j];
+    for (i = 0; i < 32; ++i) {
+        x[i + 1] += x[i] >> 8;
+        r[i] = x[i] & 255;
+    }
+}
+
+// Without ULL constants, which -Wlong-long rejects
+#define K64(hi, lo) ((uint64_t)(hi) << 32 | (lo))
+
+static const uint64_t sha512_k[80] = {
+    K64(0x428a2f98, 0xd728ae22), K64(0x71374491, 0x23ef65cd), K64(0xb5c0fbcf, 0xec4d3b2f),
+    K64(0xe9b5dba5, 0x8189dbbc), K64(0x3956c25b, 0xf348b538), K64(0x59f111f1, 0xb605d019),
+    K64(0x923f82a4, 0xaf194f9b), K64(0xab1c5ed5, 0xda6d8118), K64(0xd807aa98, 0xa3030242),
+    K64(0x12835b01, 0x45706fbe), K64(0x243185be, 0x4ee4b28c), K64(0x550c7dc3, 0xd5ffb4e2),
+    K64(0x72be5d74, 0xf27b896f), K64(0x80deb1fe, 0x3b1696b1), K64(0x9bdc06a7, 0x25c71235),
+    K64(0xc19bf174, 0xcf692694), K64(0xe49b69c1, 0x9ef14ad2), K64(0xefbe4786, 0x384f25e3),
+    K64(0x0fc19dc6, 0x8b8cd5b5), K64(0x240ca1cc, 0x77ac9c65), K64(0x2de92c6f, 0x592b0275),
+    K64(0x4a7484aa, 0x6ea6e483), K64(0x5cb0a9dc, 0xbd41fbd4), K64(0x76f988da, 0x831153b5),
+    K64(0x983e5152, 0xee66dfab), K64(0xa831c66d, 0x2db43210), K64(0xb00327c8, 0x98fb213f),
+    K64(0xbf597fc7, 0xbeef0ee4), K64(0xc6e00bf3, 0x3da88fc2), K64(0xd5a79147, 0x930aa725),
+    K64(0x06ca6351, 0xe003826f), K64(0x14292967, 0x0a0e6e70), K64(0x27b70a85, 0x46d22ffc),
+    K64(0x2e1b2138, 0x5c26c926), K64(0x4d2c6dfc, 0x5ac42aed), K64(0x53380d13, 0x9d95b3df),
+    K64(0x650a7354, 0x8baf63de), K64(0x766a0abb, 0x3c77b2a8), K64(0x81c2c92e, 0x47edaee6),
+    K64(0x92722c85, 0x1482353b), K64(0xa2bfe8a1, 0x4cf10364), K64(0xa81a664b, 0xbc423001),
+    K64(0xc24b8b70, 0xd0f89791), K64(0xc76c51a3, 0x0654be30), K64(0xd192e819, 0xd6ef5218),
+    K64(0xd6990624, 0x5565a910), K64(0xf40e3585, 0x5771202a), K64(0x106aa070, 0x32bbd1b8),
+    K64(0x19a4c116, 0xb8d2d0c8), K64(0x1e376c08, 0x5141ab53), K64(0x2748774c, 0xdf8eeb99),
+    K64(0x34b0bcb5, 0xe19b48a8), K64(0x391c0cb3, 0xc5c95a63), K64(0x4ed8aa4a, 0xe3418acb),
+    K64(0x5b9cca4f, 0x7763e373), K64(0x682e6ff3, 0xd6b2b8a3), K64(0x748f82ee, 0x5defb2fc),
+    K64(0x78a5636f, 0x43172f60), K64(0x84c87814, 0xa1f0ab72), K64(0x8cc70208, 0x1a6439ec),
+    K64(0x90befffa, 0x23631e28), K64(0xa4506ceb, 0xde82bde9), K64(0xbef9a3f7, 0xb2c67915),
+    K64(0xc67178f2, 0xe372532b), K64(0xca273ece, 0xea26619c), K64(0xd186b8c7, 0x21c0c207),
+    K64(0xeada7dd6, 0xcde0eb1e), K64(0xf57d4f7f, 0xee6ed178), K64(0x06f067aa, 0x72176fba),
+    K64(0x0a637dc5, 0xa2c898a6), K64(0x113f9804, 0xbef90dae), K64(0x1b710b35, 0x131c471b),
+    K64(0x28db77f5, 0x23047d84), K64(0x32caab7b, 0x40c72493), K64(0x3c9ebe0a, 0x15c9bebc),
+    K64(0x431d67c4, 0x9c100d4c), K64(0x4cc5d4be, 0xcb3e42b6), K64(0x597f299c, 0xfc657e2a),
+    K64(0x5fcb6fab, 0x3ad6faec), K64(0x6c44198c, 0x4a475817),
+};
+
+static const uint64_t sha512_iv[8] = {
+    K64(0x6a09e667, 0xf3bcc908), K64(0xbb67ae85, 0x84caa73b), K64(0x3c6ef372, 0xfe94f82b),
+    K64(0xa54ff53a, 0x5f1d36f1), K64(0x510e527f, 0xade682d1), K64(0x9b05688c, 0x2b3e6c1f),
+    K64(0x1f83d9ab, 0xfb41bd6b), K64(0x5be0cd19, 0x137e2179),
+};
+
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static void sha512_block(uint64_t *state, const uint8_t *p) {
+    uint64_t w[16], s[8];
+
+    memcpy(s, state, sizeof(s));
+    for (int i = 0; i < 80; ++i) {
+        uint64_t x;
+        if (i < 16) {
+            x = 0;
+            for (int j = 0; j < 8; ++j)
+                x = x << 8 | *p++;
+        } else {
+            uint64_t a = w[(i + 1) & 15], b = w[(i + 14) & 15];
+            x = w[i & 15] + w[(i + 9) & 15] + (ROR64(a, 1) ^ ROR64(a, 8) ^ (a >> 7)) +
+                (ROR64(b, 19) ^ ROR64(b, 61) ^ (b >> 6));
+        }
+        w[i & 15] = x;
+
+        uint64_t t1 = s[7] + (ROR64(s[4], 14) ^ ROR64(s[4], 18) ^ ROR64(s[4], 41)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha512_k[i] + x;
+        uint64_t t2 = (ROR64(s[0], 28) ^ ROR64(s[0], 34) ^ ROR64(s[0], 39)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        for (int j = 7; j > 0; --j)
+            s[j] = s[j - 1];
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; ++i)
+        state[i] += s[i];
+}
+
+// SHA-512 of len (<= 64 + ED25519_MAX_MESSAGE) bytes in buf, which must have room for the
+// padding; the digest is returned as 64 little endian bytes widened for mod_order()
+static void sha512_small(int64_t *out, uint8_t *buf, uint32_t len) {
+    uint64_t state[8];
+    uint32_t total = len < 112 ? 128 : 256;
+
+    memcpy(state, sha512_iv, sizeof(state));
+    buf[len] = 0x80;
+    memset(buf + len + 1, 0, total - len - 1);
+    buf[total - 2] = len >> 5;
+    buf[total - 1] = len << 3;
+    for (uint32_t i = 0; i < total; i += 128)
+        sha512_block(state, buf + i);
+    for (int i = 0; i < 64; ++i)
+        out[i] = (uint8_t)(state[i / 8] >> (56 - 8 * (i % 8)));
+}
+
+bool ed25519_verify(const uint8_t *sig, const uint8_t *public_key, const uint8_t *msg,
+                    uint32_t len) {
+    uint8_t buf[256];
+    int64_t wide[64];
+    uint8_t k[32], check[32];
+    point neg_a, sum, q;
+
+    if (len > ED25519_MAX_MESSAGE)
+        return false;
+
+    // S has to be below L
+    for (int i = 31; i >= 0; --i) {
+        if (sig[32 + i] < order[i])
+            break;
+        if (sig[32 + i] > order[i] || i == 0)
+            return false;
+    }
+
+    if (!point_decode_neg(neg_a, public_key))
+        return false;
+
+    // k = SHA-512(R || A || M) mod L
+    memcpy(buf, sig, 32);
+    memcpy(buf + 32, public_key, 32);
+    memcpy(buf + 64, msg, len);
+    sha512_small(wide, buf, 64 + len);
+    mod_order(k, wide);
+
+    // [S]B - [k]A, both scalars in one pass (Shamir's trick)
+    memcpy(sum, base, sizeof(point));
+    point_add(sum, (const fe *)neg_a);
+    memset(q, 0, sizeof(q));
+    q[1][0] = q[2][0] = 1;
+    for (int i = 255; i >= 0; --i) {
+        point_add(q, (const fe *)q);
+        int s_bit = (sig[32 + i / 8] >> (i & 7)) & 1;
+        int k_bit = (k[i / 8] >> (i & 7)) & 1;
+        if (s_bit && k_bit)
+            point_add(q, (const fe *)sum);
+        else if (s_bit)
+            point_add(q, base);
+        else if (k_bit)
+            point_add(q, (const fe *)neg_a);
+    }
+
+    point_encode(check, (const fe *)q);
+    return memcmp(check, sig, 32) == 0;
+}
@@ -0,0 +1,196 @@
+#include "uf2.h"
+#include "esp_ota.h"
+#include "uart_driver.h"
+
+#if USE_ESP_OTA
+// Two frames: one comes in over SPI while the block of the other is flashed. Words, for the
+// UF2 block at offset 4.
+static uint32_t ota_frames[2][(ESP_OTA_FRAME_SIZE + 3) / 4];
+static uint8_t ota_cur;
+static uint8_t ota_reply[ESP_OTA_REPLY_SIZE];
+// The rest of a transaction, after the reply: zeros from a fixed address, in SRAM like the rest
+static DmacDescriptor ota_fill __attribute__((aligned(16)));
+static uint8_t ota_zero;
+static WriteState ota_state;
+static uint8_t ota_status = ESP_OTA_NONE;
+static uint16_t ota_seq;
+static uint32_t ota_trigger;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+}
+
+static uint16_t ota_crc(const uint8_t *p, uint32_t length) {
+    uint16_t crc = 0;
+    while (length--)
+        crc = add_crc(*p++, crc);
+    return crc;
+}
+
+static void ota_pinmux(uint32_t pinmux) {
+    uint32_t pin = pinmux >> 16;
+    uint32_t shift = 4 * (pin & 1);
+    PortGroup *group = &PORT->Group[pin / 32];
+
+    group->PINCFG[pin % 32].bit.PMUXEN = 1;
+    group->PMUX[(pin % 32) / 2].reg =
+        (group->PMUX[(pin % 32) / 2].reg & ~(0xF << shift)) | (pinmux & 0xF) << shift;
+}
+
+// Waits up to us for ESP_BUSY to read level, on the cycle counter
+static bool ota_wait_busy(bool level, uint32_t us) {
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles = us * current_cpu_frequency_MHz;
+
+    while (PINREAD(ESP_BUSY) != level) {
+        if (DWT->CYCCNT - start >= cycles)
+            return false;
+    }
+    return true;
+}
+
+void esp_ota_init(void) {
+    Sercom *sercom = ESP_SPI_MODULE;
+
+    PINOP(ESP_CS, OUTSET);
+    PINOP(ESP_CS, DIRSET);
+    ota_pinmux(ESP_SPI_MOSI);
+    ota_pinmux(ESP_SPI_SCK);
+    ota_pinmux(ESP_SPI_MISO);
+
+    GCLK->PCHCTRL[ESP_GCLK_ID_CORE].reg = GCLK_48MHZ | (1 << GCLK_PCHCTRL_CHEN_Pos);
+    MCLK->ESP_SPI_MASK.reg |= ESP_SPI_BUS_CLOCK_INDEX;
+
+    sercom->SPI.CTRLA.reg = SERCOM_SPI_CTRLA_SWRST;
+    while (sercom->SPI.SYNCBUSY.bit.SWRST)
+        ;
+    // Master, mode 0, MSB first
+    sercom->SPI.CTRLA.reg = SERCOM_SPI_CTRLA_MODE(3) | ESP_SPI_PAD_SETTINGS;
+    sercom->SPI.CTRLB.reg = SERCOM_SPI_CTRLB_RXEN;
+    while (sercom->SPI.SYNCBUSY.bit.CTRLB)
+        ;
+    sercom->SPI.BAUD.reg = 48000000 / (2 * ESP_SPI_FREQ) - 1;
+    sercom->SPI.CTRLA.bit.ENABLE = 1;
+    while (sercom->SPI.SYNCBUSY.bit.ENABLE)
+        ;
+
+    // The triggers of each SERCOM are RX, TX, in SERCOM order
+    ota_trigger = SERCOM0_DMAC_ID_RX + 2 * uart_get_sercom_index(sercom);
+    dmac_init();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// Selects the ESP32 and has the DMAC run a transaction into rx, with the status of the frame
+// handled last going out; false if the ESP32 doesn't acknowledge
+static bool ota_begin(uint8_t *rx) {
+    Sercom *sercom = ESP_SPI_MODULE;
+    DmacDescriptor *d;
+
+    ota_reply[0] = ESP_OTA_REPLY_SYNC;
+    ota_reply[1] = ota_status;
+    ota_reply[2] = ota_seq;
+    ota_reply[3] = ota_seq >> 8;
+    put_le32(ota_reply + 4, ota_state.numBlocks);
+    put_le32(ota_reply + 8, ota_state.numWritten);
+    uint16_t crc = ota_crc(ota_reply, 12);
+    ota_reply[12] = crc;
+    ota_reply[13] = crc >> 8;
+
+    PINOP(ESP_CS, OUTCLR);
+    if (!ota_wait_busy(true, ESP_OTA_ACK_US)) {
+        PINOP(ESP_CS, OUTSET);
+        return false;
+    }
+    // Goes out once the ESP32 has seen it
+    ota_status = ESP_OTA_NONE;
+
+    // With DSTINC or SRCINC, the address is the end of the block
+    d = dmac_descriptor(ESP_DMA_RX_CH);
+    d->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_DSTINC;
+    d->BTCNT.reg = ESP_OTA_FRAME_SIZE;
+    d->SRCADDR.reg = (uint32_t)&sercom->SPI.DATA.reg;
+    d->DSTADDR.reg = (uint32_t)rx + ESP_OTA_FRAME_SIZE;
+    d->DESCADDR.reg = 0;
+
+    d = dmac_descriptor(ESP_DMA_TX_CH);
+    d->BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC;
+    d->BTCNT.reg = ESP_OTA_REPLY_SIZE;
+    d->SRCADDR.reg = (uint32_t)ota_reply + ESP_OTA_REPLY_SIZE;
+    d->DSTADDR.reg = (uint32_t)&sercom->SPI.DATA.reg;
+    d->DESCADDR.reg = (uint32_t)&ota_fill;
+    ota_fill.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE;
+    ota_fill.BTCNT.reg = ESP_OTA_FRAME_SIZE - ESP_OTA_REPLY_SIZE;
+    ota_fill.SRCADDR.reg = (uint32_t)&ota_zero;
+    ota_fill.DSTADDR.reg = (uint32_t)&sercom->SPI.DATA.reg;
+    ota_fill.DESCADDR.reg = 0;
+
+    // Receiving first, so that no byte clocked in by the TX channel is missed
+    dmac_channel_start(ESP_DMA_RX_CH, ota_trigger);
+    dmac_channel_start(ESP_DMA_TX_CH, ota_trigger + 1);
+    return true;
+}
+
+static void ota_end(void) {
+    // The last byte is in once the RX channel is done, so it is out too
+    while (dmac_channel_busy(ESP_DMA_RX_CH))
+        ;
+    PINOP(ESP_CS, OUTSET);
+}
+
+static bool ota_has_block(uint32_t block_no) {
+    return block_no < MAX_BLOCKS && (ota_state.writtenMask[block_no / 8] & (1 << (block_no % 8)));
+}
+
+static void ota_handle(uint8_t *frame) {
+    UF2_Block *bl = (void *)(frame + 4);
+    uint16_t crc = frame[ESP_OTA_FRAME_SIZE - 2] | frame[ESP_OTA_FRAME_SIZE - 1] << 8;
+    uint8_t status = ESP_OTA_OK;
+
+    ota_seq = frame[2] | frame[3] << 8;
+    if (frame[0] != ESP_OTA_FRAME_SYNC || ota_crc(frame, ESP_OTA_FRAME_SIZE - 2) != crc) {
+        status = ESP_OTA_BAD_CRC;
+    } else if (frame[1] == ESP_OTA_OP_BLOCK) {
+        if (!ota_has_block(bl->blockNo))
+            write_block(bl->blockNo, frame + 4, true, &ota_state);
+        if (!ota_has_block(bl->blockNo))
+            status = ESP_OTA_BAD_BLOCK;
+    } else if (frame[1] == ESP_OTA_OP_START) {
+        update_sync(&ota_state.update);
+        memset(&ota_state, 0, sizeof(ota_state));
+    } else if (frame[1] == ESP_OTA_OP_RESET) {
+        if (ota_state.rejected) {
+            status = ESP_OTA_REJECTED;
+        } else {
+            if (ota_state.numBlocks && ota_state.numBlocks <= MAX_BLOCKS &&
+                ota_state.numWritten >= ota_state.numBlocks)
+                resetIntoApp();
+            status = ESP_OTA_NOT_DONE;
+        }
+    } else if (frame[1] != ESP_OTA_OP_NOP) {
+        status = ESP_OTA_BAD_OP;
+    }
+    ota_status = status;
+}
+
+void esp_ota_poll(void) {
+    uint8_t *last = NULL;
+
+    // After a frame, give the ESP32 a moment to arm the next one, which then comes in while the
+    // block of this one is flashed (the DMAC works from SRAM, through the NVM stalls)
+    while (ota_wait_busy(false, last ? ESP_OTA_ARM_US : 0)) {
+        uint8_t *next = (uint8_t *)ota_frames[ota_cur];
+        if (!ota_begin(next))
+            break;
+        if (last)
+            ota_handle(last);
+        ota_end();
+        last = next;
+        ota_cur ^= 1;
+    }
+    if (last)
+        ota_handle(last);
+}
+#endif
@@ -1,5 +1,12 @@
 
 #include "uf2.h"
+#include "boot_table.h"
+#if USE_ENCRYPTED_UF2
+#include "aes.h"
+#endif
+#if USE_TRANSFER_DIGEST
+#include "sha256.h"
+#endif
 
 #define SERIAL0 (*(uint32_t *)0x0080A00C)
 #define SERIAL1 (*(uint32_t *)0x0080A040)
@@ -195,7 +202,8 @@ void read_block(uint32_t block_no, uint8_t *data) {
         } else {
             sectionIdx -= NUM_FILES - 1;
             uint32_t addr = sectionIdx * 256;
-            if (addr < FLASH_SIZE) {
+            // A protected row reads as zeros, which copying the file back doesn't flash
+            if (addr < FLASH_SIZE && read_allowed(addr, 256)) {
                 UF2_Block *bl = (void *)data;
                 bl->magicStart0 = UF2_MAGIC_START0;
                 bl->magicStart1 = UF2_MAGIC_START1;
@@ -213,14 +221,143 @@ void read_block(uint32_t block_no, uint8_t *data) {
 #endif
 }
 
+#if USE_ENCRYPTED_UF2
+// The device key sits in the user page, past the fuses; it is provisioned over SWD
+#define UF2_KEY_ADDR (NVMCTRL_USER + 0x40)
+
+#if USE_LOGS && defined(SAMD51)
+static uint32_t decrypt_cycles, decrypt_rows;
+#endif
+
+// The user page of the SAMD51; on the SAMD21 the rest is reserved
+#define USER_PAGE_SIZE 512
+
+static bool overlaps(uint32_t addr, uint32_t end, uint32_t start, uint32_t size) {
+    return addr < start + size && end > start;
+}
+
+bool read_allowed(uint32_t addr, uint32_t len) {
+    // Up to the end of the address space if it wraps
+    uint32_t end = addr + len < addr ? 0xffffffff : addr + len;
+
+    if (!len)
+        return true;
+    return !overlaps(addr, end, APP_START_ADDRESS, FLASH_SIZE - APP_START_ADDRESS) &&
+           !overlaps(addr, end, NVMCTRL_USER, USER_PAGE_SIZE) &&
+           !overlaps(addr, end, RAM_START, RAM_SIZE);
+}
+
+// Decrypts the payload of an encrypted block in place, right before it is flashed. Returns false
+// for blocks that must not be flashed.
+static bool uf2_decrypt_block(UF2_Block *bl) {
+    // 0 not looked at yet, 1 loaded, 2 missing
+    static uint8_t key_state;
+
+    if (!(bl->flags & UF2_FLAG_ENCRYPTED))
+        return USE_ENCRYPTED_UF2 < 2;
+
+    if (!key_state) {
+        const uint8_t *key = (const uint8_t *)UF2_KEY_ADDR;
+        uint8_t ones = 0xff, zeros = 0;
+        for (int i = 0; i < AES_KEY_SIZE; ++i) {
+            ones &= key[i];
+            zeros |= key[i];
+        }
+        // An erased or cleared user page holds no key
+        key_state = ones == 0xff || !zeros ? 2 : 1;
+        if (key_state == 1)
+            aes_set_key(key);
+    }
+    if (key_state != 1) {
+        logmsg("no device key");
+        return false;
+    }
+
+#if USE_LOGS && defined(SAMD51)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    uint32_t t0 = DWT->CYCCNT;
+#endif
+    aes_ctr(bl->data + bl->payloadSize, bl->targetAddr / AES_BLOCK_SIZE, bl->data,
+            bl->payloadSize);
+#if USE_LOGS && defined(SAMD51)
+    decrypt_cycles += DWT->CYCCNT - t0;
+    if (++decrypt_rows == 64) {
+        logval("aes cycles/KB", decrypt_cycles / 16);
+        decrypt_cycles = decrypt_rows = 0;
+    }
+#endif
+    return true;
+}
+#else
+static inline bool uf2_decrypt_block(UF2_Block *bl) {
+    return true;
+}
+#endif
+
+#if USE_TRANSFER_DIGEST
+// Folds a newly counted block into the transfer digest
+static void transfer_digest_add(const UF2_Block *bl, bool flashed, WriteState *state) {
+    if ((bl->flags & UF2_FLAG_TRANSFER_DIGEST) && (bl->flags & UF2_FLAG_NOFLASH) &&
+        bl->payloadSize == SHA256_DIGEST_SIZE) {
+        memcpy(state->expected, bl->data, SHA256_DIGEST_SIZE);
+        state->hasExpected = true;
+        return;
+    }
+    if (!flashed)
+        return;
+
+    Sha256 ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_init(&ctx);
+    sha256_update(&ctx, &bl->targetAddr, sizeof(bl->targetAddr));
+    sha256_update(&ctx, bl->data, bl->payloadSize);
+    sha256_final(&ctx, digest);
+    for (int i = 0; i < SHA256_DIGEST_SIZE; ++i)
+        state->digest[i] ^= digest[i];
+
+    if (!state->firstAddr || bl->targetAddr < state->firstAddr)
+        state->firstAddr = bl->targetAddr;
+}
+
+// Whether the completed transfer matches its digest. A mismatch zeroes the lowest row written,
+// which holds the vector table of a plain image, so the corrupt copy doesn't boot later either;
+// nothing around it is touched. With bank swapping the image is in the inactive bank, and
+// forgetting it is enough.
+static bool transfer_digest_ok(WriteState *state) {
+    if (state->hasExpected ? !memcmp(state->digest, state->expected, SHA256_DIGEST_SIZE)
+                           : USE_TRANSFER_DIGEST < 2)
+        return true;
+
+    logval("bad transfer digest", state->firstAddr);
+    if (state->firstAddr) {
+        update_sync(&state->update);
+#if USE_BANK_SWAP
+        bank_discard();
+#else
+        uint32_t zeros[FLASH_ROW_SIZE / 4] = {0};
+        flash_rewrite_row((uint32_t *)state->firstAddr, zeros);
+#endif
+    }
+    return false;
+}
+#endif
+
 void write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state) {
+    static UpdateSession stateless = {.flags = UPDATE_IMAGE};
+    UpdateSession *update = state ? &state->update : &stateless;
     UF2_Block *bl = (void *)data;
+#if USE_TRANSFER_DIGEST
+    bool flashed = false;
+#endif
     if (!is_uf2_block(bl) || !UF2_IS_MY_FAMILY(bl)) {
         return;
     }
 
+    if (!(update->flags & UPDATE_ACTIVE))
+        update_begin(update, UPDATE_IMAGE);
     if ((bl->flags & UF2_FLAG_NOFLASH) || bl->payloadSize != 256 || (bl->targetAddr & 0xff) ||
-        bl->targetAddr < APP_START_ADDRESS || bl->targetAddr >= FLASH_SIZE) {
+        !update_addr_ok(bl->targetAddr) || !uf2_decrypt_block(bl)) {
 #if USE_DBG_MSC
         if (!quiet)
             logval("invalid target addr", bl->targetAddr);
@@ -229,7 +366,10 @@ void write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state
         // copied from a device; we still want to count these blocks to reset properly
     } else {
         // logval("write block at", bl->targetAddr);
-        flash_write_row((void *)bl->targetAddr, (void *)bl->data);
+        update_submit(update, bl->targetAddr, bl->data, 256);
+#if USE_TRANSFER_DIGEST
+        flashed = true;
+#endif
     }
 
     if (state && bl->numBlocks) {
@@ -246,17 +386,25 @@ void write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state
                 // logval("incr", state->numWritten);
                 state->writtenMask[pos] |= mask;
                 state->numWritten++;
+#if USE_TRANSFER_DIGEST
+                transfer_digest_add(bl, flashed, state);
+#endif
             }
             if (state->numWritten >= state->numBlocks) {
+#if USE_TRANSFER_DIGEST
+                // A corrupted copy stays in the bootloader instead of resetting into it
+                if (!transfer_digest_ok(state)) {
+                    state->rejected = true;
+                    return;
+                }
+#endif
                 // wait a little bit before resetting, to avoid Windows transmit error
                 // https://github.com/Microsoft/uf2-samd21/issues/11
-                if (!quiet)
-                    resetHorizon = timerHigh + 30;
-                // resetIntoApp();
+                state->rejected = !update_finalize(update, quiet ? 0 : 30);
             }
         }
     } else {
         if (!quiet)
-            resetHorizon = timerHigh + 300;
+            update_reset_after(300);
     }
 }
@@ -15,18 +15,44 @@ void flash_erase_row(uint32_t *dst) {
     wait_ready();
 }
 
+// Rows flash_erase_to_end() asked for, erased by flash_erase_pending() before their first write
+static uint8_t erase_pending[FLASH_SIZE / FLASH_ROW_SIZE / 8];
+
+static bool flash_is_blank(const uint32_t *p, uint32_t n_words) {
+    while (n_words--)
+        if (*p++ != 0xffffffff)
+            return false;
+    return true;
+}
+
 void flash_erase_to_end(uint32_t *start_address) {
     // Note: the flash memory is erased in ROWS, that is in
     // block of 4 pages.
     //       Even if the starting address is the last byte
     //       of a ROW the entire
     //       ROW is erased anyway.
+    // The rows are only marked here: the ones the new image never reaches are left alone.
+    for (uint32_t row = (uint32_t)start_address / FLASH_ROW_SIZE; row < FLASH_SIZE / FLASH_ROW_SIZE;
+         ++row)
+        erase_pending[row / 8] |= 1 << (row % 8);
+}
 
-    uint32_t dst_addr = (uint32_t) start_address; // starting address
+void flash_erase_range(uint32_t addr, uint32_t len) {
+    for (uint32_t a = addr & ~(FLASH_ROW_SIZE - 1); a < addr + len; a += FLASH_ROW_SIZE) {
+        uint32_t row = a / FLASH_ROW_SIZE;
+        flash_erase_row((uint32_t *)a);
+        erase_pending[row / 8] &= ~(1 << (row % 8));
+    }
+}
 
-    while (dst_addr < FLASH_SIZE) {
-        flash_erase_row((void *)dst_addr);
-        dst_addr += FLASH_ROW_SIZE;
+void flash_erase_pending(uint32_t addr, uint32_t len) {
+    for (uint32_t row = addr / FLASH_ROW_SIZE;
+         row * FLASH_ROW_SIZE < addr + len && row < FLASH_SIZE / FLASH_ROW_SIZE; ++row) {
+        if (!(erase_pending[row / 8] & (1 << (row % 8))))
+            continue;
+        erase_pending[row / 8] &= ~(1 << (row % 8));
+        if (!flash_is_blank((uint32_t *)(row * FLASH_ROW_SIZE), FLASH_ROW_SIZE / 4))
+            flash_erase_row((uint32_t *)(row * FLASH_ROW_SIZE));
     }
 }
 
@@ -36,6 +62,8 @@ void copy_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
 }
 
 void flash_write_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
+    flash_erase_pending((uint32_t)dst, n_words * 4);
+
     // Set automatic page write
     NVMCTRL->CTRLB.bit.MANW = 0;
 
@@ -96,6 +124,8 @@ void flash_write(void) {
 #define QUICK_FLASH 1
 
 void flash_write_row(uint32_t *dst, uint32_t *src) {
+    flash_erase_pending((uint32_t)dst, FLASH_ROW_SIZE);
+
 #if QUICK_FLASH
     bool src_different = false;
     for (int i = 0; i < FLASH_ROW_SIZE / 4; ++i) {
@@ -110,6 +140,7 @@ void flash_write_row(uint32_t *dst, uint32_t *src) {
     }
 #endif
 
-    flash_erase_row(dst);
+    if (!flash_is_blank(dst, FLASH_ROW_SIZE / 4))
+        flash_erase_row(dst);
     flash_write_words(dst, src, FLASH_ROW_SIZE / 4);
 }
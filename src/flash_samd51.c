@@ -5,19 +5,98 @@
     while (NVMCTRL->STATUS.bit.READY == 0)                                                        \
         ;
 
-void flash_erase_block(uint32_t *dst) {
+// Commands in the bank mapped at 0, the one we run from, are waited for. Those in the other bank
+// don't stall our fetches: they are started and left running, the next command waits for them.
+static void nvm_exec(uint32_t addr, uint32_t cmd) {
     wait_ready();
+    NVMCTRL->ADDR.reg = addr;
+    NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | cmd;
+    if (addr < FLASH_SIZE / 2) {
+        wait_ready();
+    }
+}
 
-    // Execute "ER" Erase Row
-    NVMCTRL->ADDR.reg = (uint32_t)dst;
-    NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | NVMCTRL_CTRLB_CMD_EB;
+// Fills the page buffer with a quad word at dst and writes it
+static void nvm_write_quad(volatile uint32_t *dst, const uint32_t *src, uint32_t len) {
     wait_ready();
+    for (uint32_t i = 0; i < 4; i++) {
+        dst[i] = i < len ? src[i] : 0xffffffff;
+    }
+    nvm_exec((uint32_t)dst, NVMCTRL_CTRLB_CMD_WQW);
 }
 
-void flash_erase_to_end(uint32_t *dst) {
-    for (uint32_t i = ((uint32_t) dst); i < FLASH_SIZE; i += NVMCTRL_BLOCK_SIZE) {
-        flash_erase_block((uint32_t *)i);
+// The CMCC is 4KB, 4 ways of 64 lines of 16 bytes
+#define CMCC_SIZE 4096
+#define CMCC_WAYS 4
+#define CMCC_LINE_SIZE 16
+#define CMCC_LINES (CMCC_SIZE / CMCC_WAYS / CMCC_LINE_SIZE)
+
+// Rev A parts can read stale data through the NVMCTRL line caches after an erase or write, so
+// they get those turned off before touching the NVM and never enable the CMCC. Later revisions
+// keep both on; the CMCC doesn't see NVM commands, so what they change is invalidated below.
+static bool flash_cache_errata(void) {
+    return (DSU->DID.reg & DSU_DID_REVISION_Msk) >> DSU_DID_REVISION_Pos == 0;
+}
+
+static void flash_cache_prepare(void) {
+    if (flash_cache_errata()) {
+        NVMCTRL->CTRLA.bit.CACHEDIS0 = true;
+        NVMCTRL->CTRLA.bit.CACHEDIS1 = true;
+    }
+}
+
+void flash_cache_init(void) {
+    if (flash_cache_errata())
+        return;
+    CMCC->MAINT0.reg = CMCC_MAINT0_INVALL;
+    CMCC->CTRL.reg = CMCC_CTRL_CEN;
+}
+
+static void flash_cache_invalidate(uint32_t addr, uint32_t len) {
+    if (!(CMCC->SR.reg & CMCC_SR_CSTS))
+        return;
+
+    if (len >= CMCC_SIZE) {
+        CMCC->MAINT0.reg = CMCC_MAINT0_INVALL;
+        return;
+    }
+
+    // Invalidating by line needs the cache disabled, and the line can be in any way
+    CMCC->CTRL.reg = 0;
+    while (CMCC->SR.reg & CMCC_SR_CSTS)
+        ;
+    for (uint32_t a = addr & ~(CMCC_LINE_SIZE - 1); a < addr + len; a += CMCC_LINE_SIZE) {
+        uint32_t index = (a / CMCC_LINE_SIZE) % CMCC_LINES;
+        for (uint32_t way = 0; way < CMCC_WAYS; ++way)
+            CMCC->MAINT1.reg = CMCC_MAINT1_INDEX(index) | CMCC_MAINT1_WAY(way);
     }
+    CMCC->CTRL.reg = CMCC_CTRL_CEN;
+}
+
+void flash_erase_block(uint32_t *dst) {
+    flash_cache_prepare();
+
+    // Execute "EB" Erase Block; reads of the block wait for it to finish, so the cache lines can
+    // be dropped right away
+    nvm_exec((uint32_t)dst, NVMCTRL_CTRLB_CMD_EB);
+    flash_cache_invalidate((uint32_t)dst & ~(NVMCTRL_BLOCK_SIZE - 1), NVMCTRL_BLOCK_SIZE);
+}
+
+// Blocks flash_erase_to_end() asked for, erased by flash_erase_pending() before their first write
+static uint8_t erase_pending[FLASH_SIZE / NVMCTRL_BLOCK_SIZE / 8];
+
+// Erasing up to the end of a 512KB flash takes seconds, mostly for blocks the new image never
+// reaches, so the blocks are only marked here
+void flash_erase_to_end(uint32_t *dst) {
+    for (uint32_t b = (uint32_t)dst / NVMCTRL_BLOCK_SIZE; b < FLASH_SIZE / NVMCTRL_BLOCK_SIZE; ++b)
+        erase_pending[b / 8] |= 1 << (b % 8);
+}
+
+static bool flash_is_blank(const uint32_t *p, uint32_t n_words) {
+    while (n_words--)
+        if (*p++ != 0xffffffff)
+            return false;
+    return true;
 }
 
 void copy_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
@@ -27,13 +106,16 @@ void copy_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
 
 #define QUAD_WORD (4 * 4)
 void flash_write_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
-    // Set manual page write
+    uint32_t start = (uint32_t)dst;
+
+    flash_erase_pending(start, n_words * 4);
+    flash_cache_prepare();
+    // Set manual page write, once an erase of the other bank is done
+    wait_ready();
     NVMCTRL->CTRLA.bit.WMODE = NVMCTRL_CTRLA_WMODE_MAN;
 
     // Execute "PBC" Page Buffer Clear
-    wait_ready();
-    NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | NVMCTRL_CTRLB_CMD_PBC;
-    wait_ready();
+    nvm_exec((uint32_t)dst, NVMCTRL_CTRLB_CMD_PBC);
 
     while (n_words > 0) {
         // We write quad words so that we can write 256 byte blocks like UF2
@@ -41,24 +123,16 @@ void flash_write_words(uint32_t *dst, uint32_t *src, uint32_t n_words) {
         // of flash for the neighboring row.
         uint32_t len = 4 < n_words ? 4 : n_words;
 
-        wait_ready();
-        for (uint32_t i = 0; i < 4; i++) {
-            if (i < len) {
-                dst[i] = src[i];
-            } else {
-                dst[i] = 0xffffffff;
-            }
-        }
-
-        // Trigger the quad word write.
-        NVMCTRL->ADDR.reg = (uint32_t)dst;
-        NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | NVMCTRL_CTRLB_CMD_WQW;
+        nvm_write_quad(dst, src, len);
 
         // Advance to quad word
         dst += len;
         src += len;
         n_words -= len;
     }
+
+    wait_ready();
+    flash_cache_invalidate(start, (uint32_t)dst - start);
 }
 
 // On the SAMD51 we can only erase 4KiB blocks of 512 byte pages. To reduce wear
@@ -76,12 +150,33 @@ bool row_same[FLASH_SIZE / NVMCTRL_BLOCK_SIZE][NVMCTRL_BLOCK_SIZE / FLASH_ROW_SI
 // only disable for debugging/timing
 #define QUICK_FLASH 1
 
+void flash_erase_range(uint32_t addr, uint32_t len) {
+    for (uint32_t a = addr & ~(NVMCTRL_BLOCK_SIZE - 1); a < addr + len; a += NVMCTRL_BLOCK_SIZE) {
+        uint32_t b = a / NVMCTRL_BLOCK_SIZE;
+        flash_erase_block((uint32_t *)a);
+        erase_pending[b / 8] &= ~(1 << (b % 8));
+        // Rows written from now on don't need another erase
+        block_erased[b] = true;
+    }
+}
+
+void flash_erase_pending(uint32_t addr, uint32_t len) {
+    for (uint32_t b = addr / NVMCTRL_BLOCK_SIZE;
+         b * NVMCTRL_BLOCK_SIZE < addr + len && b < FLASH_SIZE / NVMCTRL_BLOCK_SIZE; ++b) {
+        if (!(erase_pending[b / 8] & (1 << (b % 8))))
+            continue;
+        erase_pending[b / 8] &= ~(1 << (b % 8));
+        uint32_t *block = (uint32_t *)(b * NVMCTRL_BLOCK_SIZE);
+        if (!flash_is_blank(block, NVMCTRL_BLOCK_SIZE / 4))
+            flash_erase_block(block);
+        block_erased[b] = true;
+    }
+}
+
 void flash_write_row(uint32_t *dst, uint32_t *src) {
     const uint32_t FLASH_ROW_SIZE_WORDS = FLASH_ROW_SIZE / 4;
 
-    // The cache in Rev A isn't reliable when reading and writing to the NVM.
-    NVMCTRL->CTRLA.bit.CACHEDIS0 = true;
-    NVMCTRL->CTRLA.bit.CACHEDIS1 = true;
+    flash_erase_pending((uint32_t)dst, FLASH_ROW_SIZE);
 
     uint32_t block = ((uint32_t) dst) / NVMCTRL_BLOCK_SIZE;
     uint8_t row = (((uint32_t) dst) % NVMCTRL_BLOCK_SIZE) / FLASH_ROW_SIZE;
@@ -102,6 +197,15 @@ void flash_write_row(uint32_t *dst, uint32_t *src) {
     }
 #endif
 
+    // A blank row doesn't need its block erased. Once written it counts as the same, so it is
+    // kept if the block gets erased for another row later.
+    if (!block_erased[block] && flash_is_blank(dst, FLASH_ROW_SIZE_WORDS)) {
+        flash_write_words(dst, src, FLASH_ROW_SIZE_WORDS);
+        wait_ready();
+        row_same[block][row] = true;
+        return;
+    }
+
     if (!block_erased[block]) {
         uint8_t rows_per_block = NVMCTRL_BLOCK_SIZE / FLASH_ROW_SIZE;
         uint32_t* block_address = (uint32_t *) (block * NVMCTRL_BLOCK_SIZE);
@@ -137,3 +241,94 @@ void flash_write_row(uint32_t *dst, uint32_t *src) {
     // a reset.
     wait_ready();
 }
+
+#if USE_TRANSFER_DIGEST
+// flash_write_row() keeps only the rows of a block the current transfer wrote; this keeps them all,
+// whoever wrote them, at the cost of a block on the stack
+void flash_rewrite_row(uint32_t *dst, uint32_t *src) {
+    uint32_t *block = (uint32_t *)((uint32_t)dst & ~(NVMCTRL_BLOCK_SIZE - 1));
+    uint32_t cache[NVMCTRL_BLOCK_SIZE / 4];
+
+    memcpy(cache, block, NVMCTRL_BLOCK_SIZE);
+    memcpy(cache + (dst - block), src, FLASH_ROW_SIZE);
+    flash_erase_block(block);
+    flash_write_words(block, cache, NVMCTRL_BLOCK_SIZE / 4);
+}
+#endif
+
+#if USE_BANK_SWAP
+// Dual bank updates: the image is written to the inactive bank while the running one is left
+// alone, so a failed update costs nothing and a good one only a reset. Per row we keep whether
+// it was written and the CRC-16 of what was written, to verify the whole bank before swapping;
+// that CRC is the only check of a written row. Nothing is swapped in unless bank_commit() said
+// the image is complete.
+#define BANK_ROWS (FLASH_BANK_SIZE / FLASH_ROW_SIZE)
+static uint8_t bank_written[BANK_ROWS / 8];
+static uint16_t bank_crc[BANK_ROWS];
+static bool bank_dirty, bank_ready;
+
+static uint16_t row_crc(const uint32_t *row) {
+    const uint8_t *p = (const uint8_t *)row;
+    uint16_t crc = 0;
+    for (uint32_t i = 0; i < FLASH_ROW_SIZE; ++i)
+        crc = add_crc(p[i], crc);
+    return crc;
+}
+
+void bank_write_row(uint32_t addr, uint32_t *src) {
+    if (addr >= FLASH_BANK_SIZE)
+        return;
+    uint32_t row = addr / FLASH_ROW_SIZE;
+    flash_write_row((uint32_t *)(addr + FLASH_BANK_SIZE), src);
+    bank_written[row / 8] |= 1 << (row % 8);
+    bank_crc[row] = row_crc(src);
+    bank_dirty = true;
+}
+
+void bank_commit(void) {
+    bank_ready = bank_dirty;
+}
+
+void bank_discard(void) {
+    memset(bank_written, 0, sizeof(bank_written));
+    bank_dirty = bank_ready = false;
+}
+
+void bank_swap_finish(void) {
+    if (!bank_ready)
+        return;
+    bank_dirty = bank_ready = false;
+
+    // Everything the update didn't cover, the bootloader included, comes from the running bank
+    for (uint32_t row = 0; row < BANK_ROWS; ++row) {
+        if (!(bank_written[row / 8] & (1 << (row % 8))))
+            flash_write_row((uint32_t *)(row * FLASH_ROW_SIZE + FLASH_BANK_SIZE),
+                            (uint32_t *)(row * FLASH_ROW_SIZE));
+    }
+
+    for (uint32_t row = 0; row < BANK_ROWS; ++row) {
+        uint32_t *dst = (uint32_t *)(row * FLASH_ROW_SIZE + FLASH_BANK_SIZE);
+        bool ok = bank_written[row / 8] & (1 << (row % 8))
+                      ? row_crc(dst) == bank_crc[row]
+                      : memcmp(dst, (uint32_t *)(row * FLASH_ROW_SIZE), FLASH_ROW_SIZE) == 0;
+        if (!ok) {
+            logval("bank verify failed at", row * FLASH_ROW_SIZE);
+            memset(bank_written, 0, sizeof(bank_written));
+            return;
+        }
+    }
+
+    uint32_t reset_handler = *(uint32_t *)(FLASH_BANK_SIZE + APP_START_ADDRESS + 4);
+    if (reset_handler < APP_START_ADDRESS || reset_handler > FLASH_BANK_SIZE) {
+        logval("no app in new bank", reset_handler);
+        memset(bank_written, 0, sizeof(bank_written));
+        return;
+    }
+
+    // Swaps the banks and resets; the new bank comes up at 0
+    wait_ready();
+    NVMCTRL->CTRLB.reg = NVMCTRL_CTRLB_CMDEX_KEY | NVMCTRL_CTRLB_CMD_BKSWRST;
+    while (1) {
+    }
+}
+#endif
@@ -1,4 +1,5 @@
 #include "uf2.h"
+#include "boot_table.h"
 
 #if USE_HID || USE_WEBUSB
 
@@ -90,6 +91,11 @@ static void checksum_pages(HID_InBuffer *pkt, int start, int num) {
     send_hf2_response(pkt, num * 2);
 }
 
+// Pages from WRITE_FLASH_PAGE, as an image; RESET_INTO_APP finalizes it once hf2_image_len bytes
+// are in, or whatever was written when START_FLASH came without a length (hosts from before it)
+static UpdateSession hf2_update = {.flags = UPDATE_IMAGE};
+static uint32_t hf2_image_len;
+
 void process_core(HID_InBuffer *pkt) {
     int sz = recv_hf2(pkt);
 
@@ -143,22 +149,38 @@ void process_core(HID_InBuffer *pkt) {
         return;
 
     case HF2_CMD_RESET_INTO_APP:
+        tmp = update_progress(&hf2_update)->bytes - update_progress(&hf2_update)->rejected;
+        if (hf2_image_len ? tmp >= hf2_image_len : tmp > 0) {
+            if (!update_finalize(&hf2_update, 0)) {
+                // Nothing was committed, the host can write the image again
+                hf2_image_len = 0;
+                resp->status16 = HF2_STATUS_EXEC_ERR;
+                break;
+            }
+        } else {
+            // Not a complete image: what was written stays, but isn't committed or swapped in
+            update_sync(&hf2_update);
+#if USE_BANK_SWAP
+            bank_discard();
+#endif
+        }
         resetIntoApp();
         break;
     case HF2_CMD_RESET_INTO_BOOTLOADER:
         resetIntoBootloader();
         break;
     case HF2_CMD_START_FLASH:
-        // userspace app should reboot into bootloader on this command; we just ignore it
+        // userspace app should reboot into bootloader on this command; here a new update starts
         // userspace can also call hf2_handover() here
+        update_begin(&hf2_update, UPDATE_IMAGE);
+        hf2_image_len = sz >= 8 + (int)sizeof(cmd->start_flash) ? cmd->start_flash.image_len : 0;
         break;
     case HF2_CMD_WRITE_FLASH_PAGE:
         checkDataSize(write_flash_page, FLASH_ROW_SIZE);
         // first send ACK and then start writing, while getting the next packet
         send_hf2_response(pkt, 0);
-        if (cmd->write_flash_page.target_addr >= APP_START_ADDRESS) {
-            flash_write_row((void *)cmd->write_flash_page.target_addr, cmd->write_flash_page.data);
-        }
+        update_submit(&hf2_update, cmd->write_flash_page.target_addr, cmd->write_flash_page.data,
+                      FLASH_ROW_SIZE);
         return;
 #if USE_HID_EXT
     case HF2_CMD_WRITE_WORDS:
@@ -169,12 +191,33 @@ void process_core(HID_InBuffer *pkt) {
     case HF2_CMD_READ_WORDS:
         checkDataSize(read_words, 0);
         tmp = cmd->read_words.num_words;
+        if (tmp > FLASH_SIZE / 4 || !read_allowed(cmd->read_words.target_addr, tmp << 2)) {
+            resp->status16 = HF2_STATUS_EXEC_ERR;
+            break;
+        }
         copy_words(resp->data32, (void *)cmd->read_words.target_addr, tmp);
         send_hf2_response(pkt, tmp << 2);
         return;
+#endif
+#if USE_BOOT_PROFILE
+    case HF2_CMD_BOOT_PROFILE:
+        tmp = UF2_BOOT_PROFILE->count;
+        if (UF2_BOOT_PROFILE->magic != UF2_BOOT_PROFILE_MAGIC || tmp > UF2_BOOT_PROFILE_MAX)
+            tmp = 0;
+        tmp = offsetof(UF2_BootProfile, marks) + tmp * sizeof(UF2_BOOT_PROFILE->marks[0]);
+        copy_words(resp->data32, (void *)UF2_BOOT_PROFILE, tmp >> 2);
+        send_hf2_response(pkt, tmp);
+        return;
 #endif
     case HF2_CMD_CHKSUM_PAGES:
         checkDataSize(chksum_pages, 0);
+        if (cmd->chksum_pages.num_pages > FLASH_SIZE / FLASH_ROW_SIZE ||
+            !read_allowed(cmd->chksum_pages.target_addr,
+                          cmd->chksum_pages.num_pages * FLASH_ROW_SIZE)) {
+            resp->status16 = HF2_STATUS_EXEC_ERR;
+            break;
+        }
+        update_sync(&hf2_update);
         checksum_pages(pkt, cmd->chksum_pages.target_addr, cmd->chksum_pages.num_pages);
         return;
 
@@ -122,6 +122,7 @@ void system_init(void) {
         GCLK_GENCTRL_ID(0) | GCLK_GENCTRL_SRC_DFLL48M | GCLK_GENCTRL_IDC | GCLK_GENCTRL_GENEN;
     gclk_sync();
 
+    // LED_TICK() runs at 48kHz, as on the SAMD51
     SysTick_Config(1000);
 
     // Uncomment these two lines to output GCLK0 on the SWCLK pin.
@@ -72,6 +72,55 @@ void system_init(void) {
       /* Wait for synchronization */
     }
 
+#if USE_120MHZ
+    // USB and the UART keep the 48MHz DFLL on GCLK1 (GCLK_48MHZ). GCLK5 divides it down to 1MHz
+    // as DPLL0 reference, DPLL0 multiplies that up to 120MHz for GCLK0.
+    GCLK->GENCTRL[1].reg = GCLK_GENCTRL_SRC(GCLK_GENCTRL_SRC_DFLL) | GCLK_GENCTRL_IDC |
+                           GCLK_GENCTRL_GENEN;
+    while (GCLK->SYNCBUSY.bit.GENCTRL1) {
+    }
+
+    GCLK->GENCTRL[5].reg = GCLK_GENCTRL_SRC(GCLK_GENCTRL_SRC_DFLL) | GCLK_GENCTRL_DIV(48) |
+                           GCLK_GENCTRL_GENEN;
+    while (GCLK->SYNCBUSY.bit.GENCTRL5) {
+    }
+
+    GCLK->PCHCTRL[OSCCTRL_GCLK_ID_FDPLL0].reg = GCLK_PCHCTRL_GEN_GCLK5 | GCLK_PCHCTRL_CHEN;
+
+    OSCCTRL->Dpll[0].DPLLRATIO.reg = OSCCTRL_DPLLRATIO_LDR(CPU_FREQUENCY / 1000000 - 1);
+    while (OSCCTRL->Dpll[0].DPLLSYNCBUSY.reg & OSCCTRL_DPLLSYNCBUSY_DPLLRATIO) {
+    }
+    OSCCTRL->Dpll[0].DPLLCTRLB.reg = OSCCTRL_DPLLCTRLB_REFCLK_GCLK | OSCCTRL_DPLLCTRLB_LBYPASS;
+    OSCCTRL->Dpll[0].DPLLCTRLA.reg = OSCCTRL_DPLLCTRLA_ENABLE;
+    while (OSCCTRL->Dpll[0].DPLLSYNCBUSY.reg & OSCCTRL_DPLLSYNCBUSY_ENABLE) {
+    }
+    while ((OSCCTRL->Dpll[0].DPLLSTATUS.reg & (OSCCTRL_DPLLSTATUS_LOCK | OSCCTRL_DPLLSTATUS_CLKRDY)) !=
+           (OSCCTRL_DPLLSTATUS_LOCK | OSCCTRL_DPLLSTATUS_CLKRDY)) {
+    }
+
+#if USE_BOOT_PROFILE
+    // Keep the profile in cycles of the final clock: scale what was counted at 48MHz, per us so
+    // that any CPU_FREQUENCY in whole MHz works
+    const uint32_t mhz = CPU_FREQUENCY / 1000000;
+    volatile UF2_BootProfile *prof = UF2_BOOT_PROFILE;
+    for (uint32_t i = 0; i < prof->count; ++i)
+        prof->marks[i].cycles = prof->marks[i].cycles / 48 * mhz;
+    DWT->CYCCNT = DWT->CYCCNT / 48 * mhz;
+    prof->cpu_hz = CPU_FREQUENCY;
+#endif
+
+    // The flash wait state table of the datasheet (NVM characteristics) asks for 5 at 120MHz, up
+    // from 1 at 48MHz. Set them before the clock goes up instead of leaving them to AUTOWS, which
+    // the datasheet doesn't tie to a frequency.
+    NVMCTRL->CTRLA.reg = (NVMCTRL->CTRLA.reg & ~(NVMCTRL_CTRLA_AUTOWS | NVMCTRL_CTRLA_RWS_Msk)) |
+                         NVMCTRL_CTRLA_RWS(5);
+
+    GCLK->GENCTRL[0].reg = GCLK_GENCTRL_SRC(GCLK_GENCTRL_SRC_DPLL0) | GCLK_GENCTRL_IDC |
+                           GCLK_GENCTRL_OE | GCLK_GENCTRL_GENEN;
+    while (GCLK->SYNCBUSY.bit.GENCTRL0) {
+    }
+#endif
+
     /* Turn on the digital interface clock */
     //MCLK->APBAMASK.reg |= MCLK_APBAMASK_GCLK;
 
@@ -81,9 +130,11 @@ void system_init(void) {
      */
     MCLK->CPUDIV.reg = MCLK_CPUDIV_DIV_DIV1;
 
-    SysTick_Config(1000);
-    // No change from initial frequency.
-    // current_cpu_frequency_MHz = 48;
+    flash_cache_init();
+
+    // LED_TICK() runs at 48kHz whatever the clock
+    SysTick_Config(CPU_FREQUENCY / 48000);
+    current_cpu_frequency_MHz = CPU_FREQUENCY / 1000000;
 }
 
 void SysTick_Handler(void) { LED_TICK(); }
@@ -74,18 +74,89 @@
 #include "uf2.h"
 #include "multiboot.h"
 #include "boot_table.h"
+#include "esp_ota.h"
 
 static void check_start_application(void);
 
 static volatile bool main_b_cdc_enable = false;
 extern int8_t led_tick_step;
 
-#if defined(SAMD21)
-    #define RESET_CONTROLLER PM
-#elif defined(SAMD51)
-    #define RESET_CONTROLLER RSTC
+// Deadline of the BOD33 wait, in ms since main() was entered
+#ifndef BOD33_SETTLE_MS
+#define BOD33_SETTLE_MS 1000
+#endif
+// Deadline of the ESP_BUSY wait, in ms since the ESP32 was started
+#ifndef ESP_BUSY_TIMEOUT_MS
+#define ESP_BUSY_TIMEOUT_MS 10000
+#endif
+// How long a fitted ESP32 takes at most to pull ESP_BUSY low after its reset. ESP_BUSY has the
+// pull-up on, so until then the pin reads high either way; after it, high means ready, or that
+// there is no ESP32 to wait for.
+#ifndef ESP_BOOT_MS
+#define ESP_BOOT_MS 1000
 #endif
 
+#define ESP_STATE_BOOTING 0
+#define ESP_STATE_READY 1
+#define ESP_STATE_TIMEOUT 2
+
+// Bring-up runs as a few cooperative tasks: the ESP32 boots while we wait out the double tap
+// window and, when we stay in the bootloader, USB. Before system_init() there is no timer, so
+// time is counted by bringup_wait() in delay(1) steps; SysTick counts on from there.
+static uint32_t bringup_ms, esp_start_ms;
+static uint8_t esp_state;
+
+static uint32_t bringup_now(void) {
+    return bringup_ms + systick_ms;
+}
+
+static void esp_poll(void) {
+    uint32_t t = bringup_now() - esp_start_ms;
+
+    if (esp_state != ESP_STATE_BOOTING)
+        return;
+    // ESP_BUSY goes high once the ESP32 is connected to the MQTT server
+    if (t >= ESP_BOOT_MS && PINREAD(ESP_BUSY)) {
+        esp_state = ESP_STATE_READY;
+        boot_profile_mark(UF2_BOOT_PHASE_ESP_READY);
+        logval("esp ready ms", t);
+    } else if (t >= ESP_BUSY_TIMEOUT_MS) {
+        esp_state = ESP_STATE_TIMEOUT;
+        logmsg("esp timeout");
+    }
+}
+
+static void bringup_wait(uint32_t ms) {
+    while (ms--) {
+        delay(1);
+        bringup_ms++;
+        esp_poll();
+    }
+}
+
+static void esp_start(void) {
+    // Set the ESP32 reset pin to a known state in case it was pulled low
+    PINOP(ESP_RST, DIRSET);
+    PINOP(ESP_RST, OUTSET);
+
+    // Pass a little time to let the ESP32 bootloader start
+    for (int i = 1; i < 10000; ++i) {
+        asm("nop");
+    }
+    // Pulled up, so that a board without an ESP32 reads as ready once ESP_BOOT_MS is over
+    PINOP(ESP_BUSY, OUTSET);
+    PINPULLEN(ESP_BUSY);
+    PININEN(ESP_BUSY);
+    esp_start_ms = bringup_now();
+}
+
+// The kernel expects a connected ESP32; it gets it, or ESP_BUSY_TIMEOUT_MS passes. Without an
+// ESP32 fitted this takes ESP_BOOT_MS.
+static void esp_wait(void) {
+    while (esp_state == ESP_STATE_BOOTING)
+        bringup_wait(1);
+}
+
 typedef struct {
     bool valid; 
     const BootVectorEntry *entry;
@@ -94,11 +165,6 @@ typedef struct {
     MemorySpace memory_space;
 } BootImage;
 
-typedef struct {
-    uint32_t start;
-    uint32_t end;
-} MemorySpace;
-
 #define KERNEL_OPTS(board, version) -b ## board ## -v ## version
 
 const char kernel_name[] = "ovule";
@@ -114,7 +180,90 @@ const BootVectorEntry h_boot_entries[] = {
     }
 };
 
-int registered_module_cnt = sizeof(h_boot_entries) / sizeof(h_boot_entries[0]);
+// Filled from the boot table at boot; h_boot_entries is only used when there is none
+static BootVectorEntry boot_entries[MB_MAX_MODULES];
+int registered_module_cnt;
+
+/**
+ * \brief Move a relocatable module to a slot allowed by its relocatable tag
+ *
+ * The relocation table sits at tag->reloc_offset from the image header. The module is copied
+ * and fixed up in one pass; modules already placed by an earlier boot only cost a compare, as
+ * flash_write_row() skips identical rows.
+ */
+static bool load_relocatable(BootImage *module, const MultibootRelocatableTag *tag,
+                             ModuleMap *map, int n, int idx) {
+    const uint8_t *src = (const uint8_t *)module->entry->flash_start;
+    const MultibootRelocTable *rel = (const void *)(src + tag->reloc_offset);
+
+    uint32_t rel_len = module->entry->flash_len - tag->reloc_offset;
+
+    if (tag->reloc_offset > module->entry->flash_len || rel_len < sizeof(*rel) ||
+        rel->magic != MB_RELOC_MAGIC || rel->image_len > tag->reloc_offset) {
+        return false;
+    }
+
+    // Linked for where it sits, nothing to do
+    if (rel->link_addr == (uint32_t)src &&
+        multiboot_tag_allows(tag, (uint32_t)src, rel->image_len)) {
+        return true;
+    }
+
+    uint32_t load_addr = multiboot_pick_load_addr(tag, rel->image_len, module->memory_space.start,
+                                                  module->memory_space.end);
+    if (!load_addr) {
+        return false;
+    }
+
+    // The new slot must not land on another module either
+    int bad_module;
+    map[idx].flash.start = load_addr;
+    map[idx].flash.end = load_addr + rel->image_len;
+    if (multiboot_validate_map(map, n, &bad_module) != MB_MAP_OK ||
+        multiboot_relocate_module(src, rel, rel_len, load_addr) < 0) {
+        return false;
+    }
+
+    module->memory_space.start = load_addr;
+    module->memory_space.end = load_addr + rel->image_len;
+    return true;
+}
+
+#if USE_FAST_DBL_TAP
+// The RTC and its backup registers only reset on power-on or brownout. The first tap leaves the
+// RTC count in BKUP[1]; a reset within the window finds it there. The RTC runs from the 1.024 kHz
+// ULP oscillator, unless the application set it up differently, in which case we go back to
+// waiting out the window.
+#define DBL_TAP_RTC_CTRLA                                                                          \
+    (RTC_MODE0_CTRLA_MODE_COUNT32 | RTC_MODE0_CTRLA_PRESCALER_DIV1 | RTC_MODE0_CTRLA_COUNTSYNC |   \
+     RTC_MODE0_CTRLA_ENABLE)
+
+static bool dbl_tap_rtc_ready(void) {
+    MCLK->APBAMASK.reg |= MCLK_APBAMASK_RTC;
+    if (RTC->MODE0.CTRLA.reg & RTC_MODE0_CTRLA_ENABLE)
+        return RTC->MODE0.CTRLA.reg == DBL_TAP_RTC_CTRLA &&
+               OSC32KCTRL->RTCCTRL.reg == OSC32KCTRL_RTCCTRL_RTCSEL_ULP1K;
+
+    OSC32KCTRL->RTCCTRL.reg = OSC32KCTRL_RTCCTRL_RTCSEL_ULP1K;
+    RTC->MODE0.CTRLA.reg = DBL_TAP_RTC_CTRLA & ~RTC_MODE0_CTRLA_ENABLE;
+    while (RTC->MODE0.SYNCBUSY.reg) {}
+    RTC->MODE0.CTRLA.reg = DBL_TAP_RTC_CTRLA;
+    while (RTC->MODE0.SYNCBUSY.reg) {}
+    return true;
+}
+
+// Arms the double tap for the next reset; true if this reset is the second tap
+static bool dbl_tap_rtc_check(void) {
+    while (RTC->MODE0.SYNCBUSY.reg & RTC_MODE0_SYNCBUSY_COUNT) {}
+    uint32_t now = RTC->MODE0.COUNT.reg;
+    bool second = RTC->MODE0.BKUP[0].reg == DBL_TAP_MAGIC &&
+                  now - RTC->MODE0.BKUP[1].reg < boot_table_dbl_tap_ms() * 1024 / 1000;
+
+    RTC->MODE0.BKUP[0].reg = second ? 0 : DBL_TAP_MAGIC;
+    RTC->MODE0.BKUP[1].reg = now;
+    return second;
+}
+#endif
 
 /**
  * \brief Check the application startup condition
@@ -123,8 +272,8 @@ int registered_module_cnt = sizeof(h_boot_entries) / sizeof(h_boot_entries[0]);
 static void check_start_application(void) {
     uint32_t app_start_address;
 
-    /* Load the Reset Handler address of the application */
-    app_start_address = *(uint32_t *)(APP_START_ADDRESS + 4);
+    /* Load the Reset Handler address of the application (of the active A/B slot) */
+    app_start_address = *(uint32_t *)(boot_slot_active_start() + 4);
 
     /**
      * Test reset vector of application @APP_START_ADDRESS+4
@@ -155,13 +304,22 @@ static void check_start_application(void) {
         *DBL_TAP_PTR = 0;
         return; // stay in bootloader
     }
+#if USE_FAST_DBL_TAP
+    else if (*DBL_TAP_PTR != DBL_TAP_MAGIC_QUICK_BOOT && dbl_tap_rtc_ready()) {
+        *DBL_TAP_PTR = 0;
+        if (dbl_tap_rtc_check())
+            return; // stay in bootloader
+    }
+#endif
     else {
         if (*DBL_TAP_PTR != DBL_TAP_MAGIC_QUICK_BOOT) {
             *DBL_TAP_PTR = DBL_TAP_MAGIC;
-            delay(500);
+            // The ESP32 keeps booting meanwhile
+            bringup_wait(boot_table_dbl_tap_ms());
         }
         *DBL_TAP_PTR = 0;
     }
+    boot_profile_mark(UF2_BOOT_PHASE_DBL_TAP);
 
     LED_MSC_OFF();
 
@@ -182,49 +340,118 @@ static void check_start_application(void) {
     BootImage boot_modules[MB_MAX_MODULES];
     int modules_to_load = 0;
 
+    memset(boot_modules, 0, sizeof(boot_modules));
+
+    registered_module_cnt = boot_table_load(boot_entries);
+    if (!registered_module_cnt) {
+        memcpy(boot_entries, h_boot_entries, sizeof(h_boot_entries));
+        registered_module_cnt = sizeof(h_boot_entries) / sizeof(h_boot_entries[0]);
+    }
+
     for(int i = 0; i < registered_module_cnt; i++) {
+        uint32_t flash_start = (uint32_t)boot_entries[i].flash_start;
+        uint32_t flash_len = boot_entries[i].flash_len;
+
+        // The table comes from flash anyone can write; only look at modules that sit in the
+        // application flash, header and all
+        if (flash_start < APP_START_ADDRESS || flash_start >= FLASH_SIZE || (flash_start & 3) ||
+            flash_len < sizeof(MultibootHeader) || flash_len > FLASH_SIZE - flash_start) {
+            continue;
+        }
+
+        MultibootHeader *header = (void *)flash_start;
+
         // Check for the multiboot magic within the header
-        if (* h_boot_entries[i].flash_start != MULTIBOOT_MAGIC) {
+        if (header->magic != MULTIBOOT_MAGIC) {
             // Not a valid image! We cannot load it
             continue;
         }
 
         // Check to ensure the module is using the right ISA
-        if (*(h_boot_entries[i].flash_start + 4) != MULTIBOOT_ARM7M_ISA){
+        if (header->architecture != MULTIBOOT_ARM7M_ISA){
             continue;
         }
 
-        uint32_t header_len = *(h_boot_entries[i].flash_start + 8);
+        uint32_t header_len = header->header_length;
         // Check the size of the header
-        if(header_len < 16 || header_len > MB_MAX_IMAGE_HEADER_LEN) {
+        if(header_len < 16 || header_len > MB_MAX_IMAGE_HEADER_LEN || header_len > flash_len) {
             continue;
         }
         
-        uint32_t checksum = 0 - (*(h_boot_entries[i].flash_start)) 
-            -  *(h_boot_entries[i].flash_start + 4) 
-            -  *(h_boot_entries[i].flash_start + 8);
+        uint32_t checksum = 0 - header->magic - header->architecture - header->header_length;
 
         
         // Compare the calculated checksum with the checksum in the disk image
-        if(*(h_boot_entries[i].flash_start + 12)!=checksum) {
+        if(header->checksum != checksum) {
             // For now lets still attempt to load it
             // continue;
         }
 
-        boot_modules[modules_to_load].entry = &h_boot_entries[i];
+        boot_modules[modules_to_load].entry = &boot_entries[i];
+        boot_modules[modules_to_load].memory_space.start = (uint32_t)boot_entries[i].flash_start;
+        boot_modules[modules_to_load].memory_space.end =
+            (uint32_t)boot_entries[i].flash_start + boot_entries[i].flash_len;
 
         // Lets create an  array of tags so we can go through them when we create the OS
         // info tags.
-        uint32_t *index = h_boot_entries[i].flash_start + 16;
-        while((uint32_t)index < ((uint32_t) h_boot_entries[i].flash_start) + header_len) {
-            boot_modules[modules_to_load].image_tags[boot_modules[modules_to_load].tags_loaded].type = *(uint16_t*)index;
-            boot_modules[modules_to_load].image_tags[boot_modules[modules_to_load].tags_loaded].flags = *(uint16_t*)(index+2);
-            boot_modules[modules_to_load].image_tags[boot_modules[modules_to_load].tags_loaded].size = *(index+4);
-            boot_modules[modules_to_load].image_tags[boot_modules[modules_to_load].tags_loaded].data = index+8;
-            index += boot_modules[modules_to_load].image_tags[boot_modules[modules_to_load].tags_loaded].size + 8;
+        int tags = multiboot_parse_tags((void *)header, boot_modules[modules_to_load].image_tags, MB_MAX_TAGS);
+        if (tags < 0) {
+            continue;
+        }
+#if USE_IMAGE_DIGEST >= 2
+        if (multiboot_check_digest((void *)header, boot_entries[i].flash_len) == MB_DIGEST_BAD) {
+            // Corrupt or tampered with, stay in bootloader
+            return;
         }
+#endif
+#if USE_SIGNED_IMAGES
+        if (multiboot_check_signature((void *)header, boot_entries[i].flash_len) != MB_DIGEST_OK) {
+            // Unsigned or not signed by us, stay in bootloader
+            return;
+        }
+#endif
+        boot_modules[modules_to_load].tags_loaded = tags;
+        boot_modules[modules_to_load].valid = true;
         ++modules_to_load;
     }
+#if USE_SIGNED_IMAGES
+    if (modules_to_load < registered_module_cnt) {
+        // Something without a (signed) multiboot header, stay in bootloader
+        return;
+    }
+#endif
+
+    // Lay out every module in flash and SRAM and refuse the set before anything gets copied or
+    // run; a bad image has to keep us in the bootloader rather than hard fault.
+    ModuleMap module_map[MB_MAX_MODULES];
+    bool align_modules = false;
+    int bad_module;
+
+    memset(module_map, 0, sizeof(module_map));
+    for(int i = 0; i < modules_to_load; i++) {
+        module_map[i].flash = boot_modules[i].memory_space;
+        for(int m = 0; m < boot_modules[i].tags_loaded; m++) {
+            ImageHeaderTag *tag = &boot_modules[i].image_tags[m];
+            if (tag->type == MB_IMAGE_HEADER_TYPE_ADDRESS && tag->size >= 8 + sizeof(MultibootAddressTag)) {
+                // Text is executed in place, only a load address outside flash claims SRAM
+                const MultibootAddressTag *addr = (void *)tag->data;
+                if (addr->load_addr >= FLASH_SIZE) {
+                    module_map[i].ram.start = addr->load_addr;
+                    module_map[i].ram.end = addr->bss_end_addr ? addr->bss_end_addr : addr->load_end_addr;
+                }
+            } else if (tag->type == MB_IMAGE_HEADER_TYPE_ALIGN_MODULE) {
+                align_modules = true;
+            }
+        }
+    }
+    // The alignment tag applies to all modules
+    for(int i = 0; align_modules && i < modules_to_load; i++) {
+        module_map[i].align = MB_LOAD_ALIGN;
+    }
+    if (multiboot_validate_map(module_map, modules_to_load, &bad_module) != MB_MAP_OK) {
+        /* Stay in bootloader */
+        return;
+    }
 
     uint32_t info_requests[MB_MAX_MB_REQ];
     int info_req_cnt = 0;
@@ -241,18 +468,22 @@ static void check_start_application(void) {
         */
 
         // Iterator over tags in modules
-        for(int m = 0; m < boot_modules[modules_to_load].tags_loaded; m++){
-            switch(boot_modules[modules_to_load].image_tags[m].type){
+        for(int m = 0; m < boot_modules[i].tags_loaded; m++){
+            switch(boot_modules[i].image_tags[m].type){
                 case MB_IMAGE_HEADER_TYPE_INFO_REQ:
                 // Lets assemble out info requests into an array
-                for(int iri = 0; iri < boot_modules[modules_to_load].image_tags[m].size / 4; iri++){
-                    if(boot_modules[modules_to_load].image_tags[m].data[iri] > 0x21) {
-                        info_requests[info_req_cnt++] = boot_modules[modules_to_load].image_tags[m].data[iri];
+                for(int iri = 0; iri < boot_modules[i].image_tags[m].size / 4; iri++){
+                    if(boot_modules[i].image_tags[m].data[iri] > 0x21) {
+                        if (info_req_cnt >= MB_MAX_MB_REQ) {
+                            // More than any image can ask for, stay in bootloader
+                            return;
+                        }
+                        info_requests[info_req_cnt++] = boot_modules[i].image_tags[m].data[iri];
                     }
                 }
                 break;
                 case MB_IMAGE_HEADER_TYPE_ADDRESS:
-
+                // Checked by multiboot_validate_map()
                 break;
                 case MB_IMAGE_HEADER_TYPE_ENTRY_ADDR:
                 // TODO must be implemented
@@ -264,12 +495,18 @@ static void check_start_application(void) {
                 // We are not going to have a display
                 continue;
                 case MB_IMAGE_HEADER_TYPE_ALIGN_MODULE:
-                // TODO we need to align 
-
+                // Checked by multiboot_validate_map()
+                break;
                 case MB_IMAGE_HEADER_TYPE_EFI_BOOT_SERVICES:
                 // TODO we need to assert some error in loading the module
                 break;
                 case MB_IMAGE_HEADER_TYPE_RELOCATABLE:
+                if (!load_relocatable(&boot_modules[i], (void *)boot_modules[i].image_tags[m].data,
+                                      module_map, modules_to_load, i)) {
+                    // The module can't run where it sits, stay in bootloader
+                    return;
+                }
+                break;
             }
         }
     }
@@ -301,13 +538,16 @@ static void check_start_application(void) {
 
 
     // Jump to kernel
-
+    uint32_t kernel_start = modules_to_load ? boot_modules[0].memory_space.start : APP_START_ADDRESS;
+    app_start_address = *(uint32_t *)(kernel_start + 4);
+    esp_wait();
+    boot_profile_mark(UF2_BOOT_PHASE_JUMP);
 
     /* Rebase the Stack Pointer */
-    __set_MSP(*(uint32_t *)APP_START_ADDRESS);
+    __set_MSP(*(uint32_t *)kernel_start);
 
     /* Rebase the vector table base address */
-    SCB->VTOR = ((uint32_t)APP_START_ADDRESS & SCB_VTOR_TBLOFF_Msk);
+    SCB->VTOR = ((uint32_t)kernel_start & SCB_VTOR_TBLOFF_Msk);
 
     /* Jump to application Reset Handler in the application */
     asm("bx %0" ::"r"(app_start_address));
@@ -325,6 +565,7 @@ int main(void) {
     if (SCB->VTOR)
         while (1) {
         }
+    boot_profile_mark(UF2_BOOT_PHASE_MAIN);
 
 #if defined(SAMD21)
     // If fuses have been reset to all ones, the watchdog ALWAYS-ON is
@@ -361,6 +602,9 @@ int main(void) {
     // Disable the watchdog, in case the application set it.
     WDT->CTRLA.reg = 0;
     while(WDT->SYNCBUSY.reg) {}
+#endif
+
+#if defined(SAMD51)
 
     // Enable 2.7V brownout detection. The default fuse value is 1.7
     // Set brownout detection to ~2.7V. Default from factory is 1.7V,
@@ -378,8 +622,10 @@ int main(void) {
     // Wait for BOD33 peripheral to be ready.
     while (!SUPC->STATUS.bit.BOD33RDY) {}
 
-    // Wait for voltage to rise above BOD33 value.
-    while (SUPC->STATUS.bit.BOD33DET) {}
+    // Wait for voltage to rise above BOD33 value. Past BOD33_SETTLE_MS we go on, and the
+    // brownout reset enabled below retries the boot if it is still too low.
+    while (SUPC->STATUS.bit.BOD33DET && bringup_ms < BOD33_SETTLE_MS)
+        bringup_wait(1);
 
     // If we are starting from a power-on or a brownout,
     // wait for the voltage to stabilize. Don't do this on an
@@ -388,8 +634,8 @@ int main(void) {
     if (RSTC->RCAUSE.bit.POR || RSTC->RCAUSE.bit.BODVDD) {
         do {
             // Check again in 100ms.
-            delay(100);
-        } while (SUPC->STATUS.bit.BOD33DET);
+            bringup_wait(100);
+        } while (SUPC->STATUS.bit.BOD33DET && bringup_ms < BOD33_SETTLE_MS);
     }
 
     // Now enable reset if voltage falls below minimum.
@@ -397,30 +643,20 @@ int main(void) {
     while (!SUPC->STATUS.bit.B33SRDY) {}  // Wait for BOD33 to synchronize.
     SUPC->BOD33.bit.ACTION = SUPC_BOD33_ACTION_RESET_Val;
     SUPC->BOD33.bit.ENABLE = 1;
+    boot_profile_mark(UF2_BOOT_PHASE_BOD33);
 #endif
 
+    // Only on a settled supply; it boots while everything below runs
+    esp_start();
+
 #if USB_VID == 0x239a && USB_PID == 0x0013     // Adafruit Metro M0
     // Delay a bit so SWD programmer can have time to attach.
     delay(15);
 #endif
     led_init();
-    // Set the ESP32 reset pin to a known state in case it was pulled
-    // low
-    PINOP(ESP_RST, DIRSET);
-    PINOP(ESP_RST, OUTSET);
-
-    // Pass a little time to let the ESP32 bootloader start
-    for (int i = 1; i < 10000; ++i) {
-        asm("nop");
-    }
-
-    // Set a white color while we wait for the esp32 to boot
-    PININEN(ESP_BUSY);
-    RGBLED_set_color(0xA0A0A0);
-
-    // Wait until the ESP32 is connected to the MQTT server
-    while(!PINREAD(ESP_BUSY));
-    RGBLED_set_color(COLOR_NO_IMAGE);
+    // White while the ESP32 boots, the kernel is only started once it is up
+    esp_poll();
+    RGBLED_set_color(esp_state == ESP_STATE_BOOTING ? 0xA0A0A0 : COLOR_NO_IMAGE);
 
     logmsg("Start");
     assert((uint32_t)&_etext < APP_START_ADDRESS);
@@ -432,10 +668,12 @@ int main(void) {
 
     /* Jump in application if condition is satisfied */
     check_start_application();
+    boot_profile_mark(UF2_BOOT_PHASE_STAY);
 
     /* We have determined we should stay in the monitor. */
     /* System initialization */
     system_init();
+    boot_profile_mark(UF2_BOOT_PHASE_SYSTEM_INIT);
 
     __DMB();
     __enable_irq();
@@ -445,6 +683,10 @@ int main(void) {
     usart_open();
     #endif
 
+#if USE_ESP_OTA
+    esp_ota_init();
+#endif
+
     logmsg("Before main loop");
     // uart_basic_init(SERCOM0, 115200, UART_RX_PAD1_TX_PAD0);
     
@@ -453,6 +695,7 @@ int main(void) {
     //uart_write_byte(SERCOM0, '\n');
 
     usb_init();
+    boot_profile_mark(UF2_BOOT_PHASE_USB_INIT);
 
     // not enumerated yet
     RGBLED_set_color(COLOR_START);
@@ -460,6 +703,14 @@ int main(void) {
     
     /* Wait for a complete enum on usb or a '#' char on serial line */
     while (1) {
+        // Only tracked from here on: USB doesn't wait for the ESP32
+        esp_poll();
+#if USE_ESP_OTA
+        // Units in the field get their updates from the ESP32, over SPI
+        if (esp_state == ESP_STATE_READY)
+            esp_ota_poll();
+#endif
+
         if (USB_Ok()) {
             if (!main_b_cdc_enable) {
 #if USE_SINGLE_RESET
@@ -468,6 +719,7 @@ int main(void) {
 #endif
                 RGBLED_set_color(COLOR_USB);
                 led_tick_step = 1;
+                boot_profile_mark(UF2_BOOT_PHASE_USB_READY);
 
 #if USE_SCREEN
                 screen_init();
@@ -489,6 +741,18 @@ int main(void) {
             }
         }
 
+#if USE_UART
+        // Or a '#' on the UART (after a break and 0x55 with USE_UART_AUTOBAUD)
+        if (!main_b_cdc_enable && usart_sharp_received()) {
+            RGBLED_set_color(COLOR_UART);
+            sam_ba_monitor_init(SAM_BA_INTERFACE_USART);
+            // SAM-BA on UART loop
+            while (1) {
+                sam_ba_monitor_run();
+            }
+        }
+#endif
+
 #else // no monitor
         if (main_b_cdc_enable) {
             process_msc();
@@ -1,9 +1,19 @@
 #include "multiboot.h"
+#include "boot_table.h"
 #include "uf2.h"
+#include "sha256.h"
+#include "ed25519.h"
+
+const char bootloader_version[] = UF2_VERSION_BASE;
+const char bootloader_name[] =  MB_NAME(UF2_VERSION_BASE);
+
+#define ALIGN_UP(v, a) (((v) + (a) - 1) & ~((a) - 1))
+#define ALIGN_DOWN(v, a) ((v) & ~((a) - 1))
 
 uint8_t *find_multiboot_header(uint8_t *start) {
-    for(unsigned long i = 0; i<32768; i++) {
-        if((uint32_t)start[i] == MULTIBOOT_MAGIC){
+    // The header is 64-bit aligned
+    for(unsigned long i = 0; i<32768; i += 8) {
+        if(*(uint32_t *)(void *)&start[i] == MULTIBOOT_MAGIC){
             // We found a valid multiboot header!
             return &start[i];
         }
@@ -12,33 +22,397 @@ uint8_t *find_multiboot_header(uint8_t *start) {
 }
 
 int decode_multiboot_image_headers(uint8_t *start, ImageHeaderTag *result, int result_len) {
-    uint32_t h_len = 0;
+    MultibootHeader *hd = (void *)start;
     // If the magic isn't here, then we are not decoding the right location
-    if((uint32_t)start[0] != MULTIBOOT_MAGIC) {
+    if(hd->magic != MULTIBOOT_MAGIC) {
         return -1;
     }
     // Let's ensure we're using the right ISA
-    if((uint32_t)start[3] != MULTIBOOT_ARM7M_ISA) {
+    if(hd->architecture != MULTIBOOT_ARM7M_ISA) {
         return -2;
     }
     // Is the header longer than we support?
-    if((uint32_t)start[7] > MB_MAX_IMAGE_HEADER_LEN) {
+    if(hd->header_length < sizeof(*hd) || hd->header_length > MB_MAX_IMAGE_HEADER_LEN) {
         return -3;
     }
     // Check the very simple header checksum
-    if((uint32_t)start[0] + (uint32_t)start[3] + (uint32_t)start[7] + (uint32_t)start [11] < 1) {
+    if(hd->magic + hd->architecture + hd->header_length + hd->checksum != MULTIBOOT_CHECKSUM_SUM) {
         return -4;
     }
 
-    h_len = start[2];
+    return multiboot_parse_tags(start, result, result_len);
+}
+
+int multiboot_parse_tags(uint8_t *start, ImageHeaderTag *result, int result_len) {
+    MultibootHeader *hd = (void *)start;
     int tags = 0;
-    uint8_t *cursor = start[4];
+    uint8_t *cursor = start + sizeof(*hd);
     // Lets go through the image
-    while(start+h_len > cursor) {
+    while(start + hd->header_length >= cursor + 8) {
         // "‘type’ is divided into 2 parts. Lower contains an identifier of contents of the rest of the tag. ‘size’ contains the size of tag including header fields. If bit ‘0’ of ‘flags’ (also known as ‘optional’) is set, the bootloader may ignore this tag if it lacks relevant support. Tags are terminated by a tag of type ‘0’ and size ‘8’."
-        result[tags].type = (uint16_t)
+        uint16_t type = *(uint16_t *)(void *)cursor;
+        uint32_t size = *(uint32_t *)(void *)(cursor + 4);
+        if(type == MB_IMAGE_HEADER_TYPE_END) {
+            return tags;
+        }
+        if(size < 8 || cursor + size > start + hd->header_length) {
+            return -5;
+        }
+        if(tags == result_len) {
+            return -6;
+        }
+        result[tags].type = type;
+        result[tags].flags = *(uint16_t *)(void *)(cursor + 2);
+        result[tags].size = size;
+        result[tags].data = cursor + 8;
         ++tags;
+        // Tags are padded to 8 bytes
+        cursor += ALIGN_UP(size, 8);
+    }
+
+    return tags;
+}
+
+bool multiboot_tag_allows(const MultibootRelocatableTag *tag, uint32_t addr, uint32_t len) {
+    return addr >= tag->min_addr && len <= tag->max_addr && addr <= tag->max_addr - len;
+}
+
+uint32_t multiboot_pick_load_addr(const MultibootRelocatableTag *tag, uint32_t len,
+                                  uint32_t avoid_start, uint32_t avoid_end) {
+    uint32_t align = tag->align > MB_LOAD_ALIGN ? tag->align : MB_LOAD_ALIGN;
+    uint32_t lo = tag->min_addr > APP_START_ADDRESS ? tag->min_addr : APP_START_ADDRESS;
+    uint32_t hi = tag->max_addr < APP_END_ADDRESS ? tag->max_addr : APP_END_ADDRESS;
+
+    // Alignment has to be a power of two
+    if (align & (align - 1))
+        return 0;
+
+    lo = ALIGN_UP(lo, align);
+    if (len > hi || hi - len < lo)
+        return 0;
+    hi = ALIGN_DOWN(hi - len, align);
+
+    if (tag->preference == MB_RELOC_PREFERENCE_HIGHEST) {
+        uint32_t addr = hi;
+        if (addr < avoid_end && addr + len > avoid_start) {
+            if (avoid_start < lo + len)
+                return 0;
+            addr = ALIGN_DOWN(avoid_start - len, align);
+        }
+        return addr >= lo ? addr : 0;
+    } else {
+        uint32_t addr = lo;
+        if (addr < avoid_end && addr + len > avoid_start)
+            addr = ALIGN_UP(avoid_end, align);
+        return addr <= hi ? addr : 0;
+    }
+}
+
+uint32_t module_map_error;
+
+#ifdef SAMD51
+#define MB_RAM_START HSRAM_ADDR
+#else
+#define MB_RAM_START HMCRAMC0_ADDR
+#endif
+// The double tap word (and boot state) at the top of SRAM has to survive the jump
+#if USE_BOOT_PROFILE
+#define MB_RAM_END ((uint32_t)UF2_BOOT_PROFILE)
+#else
+#define MB_RAM_END ((uint32_t)DBL_TAP_PTR)
+#endif
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    int module;
+} MapInterval;
+
+static void sift_down(MapInterval *iv, int root, int n) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= n)
+            return;
+        if (child + 1 < n && iv[child + 1].start > iv[child].start)
+            child++;
+        if (iv[root].start >= iv[child].start)
+            return;
+        MapInterval tmp = iv[root];
+        iv[root] = iv[child];
+        iv[child] = tmp;
+        root = child;
+    }
+}
+
+// Heap sort by start address; after sorting only neighbours can overlap
+static int check_overlap(MapInterval *iv, int n) {
+    for (int i = n / 2 - 1; i >= 0; i--)
+        sift_down(iv, i, n);
+    for (int i = n - 1; i > 0; i--) {
+        MapInterval tmp = iv[0];
+        iv[0] = iv[i];
+        iv[i] = tmp;
+        sift_down(iv, 0, i);
+    }
+    for (int i = 1; i < n; i++) {
+        if (iv[i].start < iv[i - 1].end)
+            return iv[i].module;
+    }
+    return -1;
+}
+
+static int map_fail(int reason, int module, int *bad_module) {
+    *bad_module = module;
+    module_map_error = (module << 8) | reason;
+    logval("module map error", module_map_error);
+    return reason;
+}
+
+int multiboot_validate_map(const ModuleMap *map, int n, int *bad_module) {
+    MapInterval flash[MB_MAX_MODULES];
+    MapInterval ram[MB_MAX_MODULES];
+    int n_ram = 0;
+
+    if (n > MB_MAX_MODULES)
+        n = MB_MAX_MODULES;
+
+    for (int i = 0; i < n; i++) {
+        const ModuleMap *m = &map[i];
+        if (m->flash.start < APP_START_ADDRESS || m->flash.end > APP_END_ADDRESS ||
+            m->flash.start >= m->flash.end)
+            return map_fail(MB_MAP_FLASH_RANGE, i, bad_module);
+        if (m->align & (m->align - 1))
+            return map_fail(MB_MAP_MISALIGNED, i, bad_module);
+        if ((m->flash.start & 3) || (m->align && (m->flash.start & (m->align - 1))))
+            return map_fail(MB_MAP_MISALIGNED, i, bad_module);
+        flash[i].start = m->flash.start;
+        flash[i].end = m->flash.end;
+        flash[i].module = i;
+
+        if (m->ram.start == m->ram.end)
+            continue;
+        if (m->ram.start < MB_RAM_START || m->ram.end > MB_RAM_END || m->ram.start > m->ram.end)
+            return map_fail(MB_MAP_RAM_RANGE, i, bad_module);
+        ram[n_ram].start = m->ram.start;
+        ram[n_ram].end = m->ram.end;
+        ram[n_ram].module = i;
+        n_ram++;
+    }
+
+    int bad = check_overlap(flash, n);
+    if (bad >= 0)
+        return map_fail(MB_MAP_FLASH_OVERLAP, bad, bad_module);
+    bad = check_overlap(ram, n_ram);
+    if (bad >= 0)
+        return map_fail(MB_MAP_RAM_OVERLAP, bad, bad_module);
+
+    module_map_error = MB_MAP_OK;
+    return MB_MAP_OK;
+}
+
+// Moves to the next fixup, skipping over MB_RELOC_SKIP gaps
+static uint32_t next_fixup(const MultibootRelocTable *rel, uint32_t *entry, uint32_t pos) {
+    while (*entry < rel->num_entries) {
+        uint16_t d = rel->entries[(*entry)++];
+        pos += d;
+        if (d != MB_RELOC_SKIP)
+            return pos;
+    }
+    return 0xffffffff;
+}
+
+int multiboot_relocate_module(const uint8_t *src, const MultibootRelocTable *rel, uint32_t rel_len,
+                              uint32_t load_addr) {
+    const uint32_t ROW_WORDS = FLASH_ROW_SIZE / 4;
+    uint32_t row[FLASH_ROW_SIZE / 4];
+    uint32_t n_words = (rel->image_len + 3) / 4;
+    uint32_t offset = load_addr - rel->link_addr;
+
+    if (rel_len < sizeof(*rel) || rel->magic != MB_RELOC_MAGIC ||
+        (load_addr & (FLASH_ROW_SIZE - 1)))
+        return -1;
+    if (rel->num_entries > (rel_len - sizeof(*rel)) / sizeof(rel->entries[0]))
+        return -2;
+
+    // Only the table is scanned here, so that a bad one doesn't leave half a module behind
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < rel->num_entries; ++i) {
+        if (i && !rel->entries[i])
+            return -2;
+        pos += rel->entries[i];
+    }
+    if (rel->num_entries && pos >= n_words)
+        return -2;
+
+    uint32_t entry = 0;
+    uint32_t fixup = next_fixup(rel, &entry, 0);
+
+    // Single forward pass: every row is fixed up in RAM and flashed straight away
+    for (uint32_t w = 0; w < n_words; w += ROW_WORDS) {
+        uint32_t len = n_words - w < ROW_WORDS ? n_words - w : ROW_WORDS;
+        memcpy(row, src + w * 4, len * 4);
+        memset(row + len, 0xff, (ROW_WORDS - len) * 4);
+        while (fixup < w + len) {
+            row[fixup - w] += offset;
+            fixup = next_fixup(rel, &entry, fixup);
+        }
+        flash_write_row((uint32_t *)(load_addr + w * 4), row);
+    }
+
+    return 0;
+}
+
+#if USE_SIGNED_IMAGES && !defined(SIGNING_PUBLIC_KEY)
+#error "USE_SIGNED_IMAGES needs SIGNING_PUBLIC_KEY in board_config.h, see scripts/sign_image.py"
+#endif
+
+#if USE_SIGNED_IMAGES
+static const uint8_t signing_key[ED25519_PUBLIC_KEY_SIZE] = SIGNING_PUBLIC_KEY;
+
+// Hash of the module being transferred, fed as its rows arrive. Transfers normally come in
+// address order, so the check at the end needs no second pass over flash; rows out of order
+// leave done unset, and a row written again after it was hashed sets stale, and the check hashes
+// flash instead.
+static struct {
+    uint32_t start;
+    uint32_t len;
+    uint32_t next;
+    bool done;
+    bool stale;
+    bool checked;
+    bool ok;
+    Sha256 sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+} stream;
+#endif
+
+static const MultibootDigestTag *find_digest_tag(const uint8_t *start) {
+    ImageHeaderTag tags[MB_MAX_TAGS];
+
+    if (((const MultibootHeader *)(const void *)start)->magic != MULTIBOOT_MAGIC)
+        return NULL;
+    int n = multiboot_parse_tags((uint8_t *)start, tags, MB_MAX_TAGS);
+    for (int i = 0; i < n; ++i) {
+        if (tags[i].type == MB_IMAGE_HEADER_TYPE_SHA256 && tags[i].size >= 8 + sizeof(uint32_t))
+            return (const void *)tags[i].data;
     }
+    return NULL;
+}
+
+// Hashes the first image_len bytes at start, which have to be followed by trailer bytes
+// (digest and signature) within flash_len, and compares with the stored digest
+static int check_module_digest(const uint8_t *start, uint32_t flash_len, uint32_t image_len,
+                               uint32_t trailer) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
 
- 
-}
\ No newline at end of file
+    if (image_len > flash_len || flash_len - image_len < trailer)
+        return MB_DIGEST_BAD;
+
+#if USE_SIGNED_IMAGES
+    if (stream.done && stream.start == (uint32_t)start && stream.len == image_len) {
+        memcpy(digest, stream.digest, sizeof(digest));
+    } else
+#endif
+    {
+#if USE_LOGS && defined(SAMD51)
+        // Leave CYCCNT running, the boot profile uses it too
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        uint32_t t0 = DWT->CYCCNT;
+#elif USE_LOGS
+        uint32_t t0 = systick_cycles();
+#endif
+        sha256_flash(start, image_len, digest);
+#if USE_LOGS && defined(SAMD51)
+        logval("sha256 cycles/KB", (DWT->CYCCNT - t0) / (image_len / 1024 + 1));
+#elif USE_LOGS
+        logval("sha256 cycles/KB", (systick_cycles() - t0) / (image_len / 1024 + 1));
+#endif
+    }
+
+    if (memcmp(digest, start + image_len, SHA256_DIGEST_SIZE)) {
+        logval("bad digest at", (uint32_t)start);
+        return MB_DIGEST_BAD;
+    }
+    return MB_DIGEST_OK;
+}
+
+int multiboot_check_digest(const uint8_t *start, uint32_t flash_len) {
+    const MultibootDigestTag *tag = find_digest_tag(start);
+    if (!tag)
+        return MB_DIGEST_NONE;
+    return check_module_digest(start, flash_len, tag->image_len, SHA256_DIGEST_SIZE);
+}
+
+#if USE_SIGNED_IMAGES
+int multiboot_check_signature(const uint8_t *start, uint32_t flash_len) {
+    const MultibootDigestTag *tag = find_digest_tag(start);
+    if (!tag)
+        return MB_DIGEST_NONE;
+
+    int res = check_module_digest(start, flash_len, tag->image_len,
+                                  SHA256_DIGEST_SIZE + ED25519_SIGNATURE_SIZE);
+    if (res != MB_DIGEST_OK)
+        return res;
+
+    const uint8_t *digest = start + tag->image_len;
+    if (!ed25519_verify(digest + SHA256_DIGEST_SIZE, signing_key, digest, SHA256_DIGEST_SIZE)) {
+        logval("bad signature at", (uint32_t)start);
+        return MB_DIGEST_BAD;
+    }
+    return MB_DIGEST_OK;
+}
+
+void multiboot_stream_row(uint32_t addr, const uint8_t *data) {
+    // A new module starts
+    if (((const MultibootHeader *)(const void *)data)->magic == MULTIBOOT_MAGIC) {
+        const MultibootDigestTag *tag = find_digest_tag(data);
+        stream.start = addr;
+        stream.len = tag ? tag->image_len : 0;
+        stream.next = 0;
+        stream.done = false;
+        stream.stale = false;
+        stream.checked = false;
+        sha256_init(&stream.sha);
+    }
+
+    if (!stream.len || stream.stale)
+        return;
+    if (addr >= stream.start && addr < stream.start + stream.next) {
+        // What was hashed isn't what is in flash any more
+        stream.stale = true;
+        stream.done = false;
+        stream.checked = false;
+        return;
+    }
+    if (stream.done || addr != stream.start + stream.next)
+        return;
+    uint32_t n = stream.len - stream.next;
+    if (n > FLASH_ROW_SIZE)
+        n = FLASH_ROW_SIZE;
+    sha256_update(&stream.sha, data, n);
+    stream.next += n;
+    if (stream.next == stream.len) {
+        sha256_final(&stream.sha, stream.digest);
+        stream.done = true;
+    }
+}
+
+void multiboot_stream_begin(void) {
+    memset(&stream, 0, sizeof(stream));
+}
+
+bool multiboot_transfer_ok(void) {
+    // A transfer without a module header brought nothing that could be signed
+    if (!stream.start)
+        return false;
+    if (!stream.checked) {
+        // The boot table bounds it again before booting; with USE_BANK_SWAP the module sits
+        // in the upper bank here
+        stream.ok = multiboot_check_signature((const uint8_t *)stream.start,
+                                             FLASH_SIZE - stream.start) == MB_DIGEST_OK;
+        stream.checked = true;
+    }
+    return stream.ok;
+}
+#endif
@@ -90,6 +90,17 @@ void sam_ba_putdata_term(uint8_t *data, uint32_t length) {
     return;
 }
 
+// Sends length zeros, the answer to R on memory that read_allowed() protects
+static void put_zeros(uint32_t length) {
+    static const uint8_t zeros[64];
+
+    while (length) {
+        uint32_t n = length < sizeof(zeros) ? length : sizeof(zeros);
+        cdc_write_buf_xmd(zeros, n);
+        length -= n;
+    }
+}
+
 volatile uint32_t sp;
 void call_applet(uint32_t address) {
     uint32_t app_start_address;
@@ -123,6 +134,375 @@ void put_uint32(uint32_t n) {
     cdc_write_buf(buff, 8);
 }
 
+// Blocking read; cdc_read_buf_xmd() would run XMODEM on the UART
+static void read_raw(uint8_t *dst, uint32_t length) {
+#if USE_UART
+    if (b_sam_ba_interface_usart) {
+        while (length--)
+            *dst++ = usart_getc();
+        return;
+    }
+#endif
+    cdc_read_buf_xmd(dst, length);
+}
+
+// Where Y, U, B (binaries) and the binary mode write, raw; X starts it over
+static UpdateSession monitor_update;
+
+// U: flashes size bytes at addr as they arrive, a row at a time, through the update engine and
+// the compare in flash_write_row(). The first pre_len bytes came with the command.
+static void write_direct(uint32_t addr, uint32_t size, const uint8_t *pre, uint32_t pre_len) {
+    static uint32_t row_buf[FLASH_ROW_SIZE / 4];
+    uint8_t *row = (uint8_t *)row_buf;
+
+    while (size) {
+        uint32_t offset = addr % FLASH_ROW_SIZE;
+        uint32_t len = FLASH_ROW_SIZE - offset < size ? FLASH_ROW_SIZE - offset : size;
+
+        uint32_t from_pre = pre_len < len ? pre_len : len;
+        memcpy(row, pre, from_pre);
+        pre += from_pre;
+        pre_len -= from_pre;
+        read_raw(row + from_pre, len - from_pre);
+
+#if !USE_CDC_BUFFERED
+        // Have the next USB packet come in while the row is erased and written (the other half
+        // of the buffer does that with USE_CDC_BUFFERED)
+        if (!b_sam_ba_interface_usart)
+            USB_Read(NULL, 0, USB_EP_OUT);
+#endif
+
+        update_submit(&monitor_update, addr, row, len);
+        addr += len;
+        size -= len;
+    }
+    update_sync(&monitor_update);
+}
+
+#if USE_YMODEM
+// B: the files of a YMODEM batch go to flash as they arrive, a UF2 block or two rows at a time.
+// A .uf2 file goes through write_block() like a copy to the drive (resetting once it is all
+// there); anything else is a binary, flashed from ymodem_addr on.
+static uint32_t ymodem_addr;
+static bool ymodem_uf2;
+static uint32_t ymodem_stage[512 / 4];
+static uint32_t ymodem_fill, ymodem_block;
+static WriteState ymodem_state;
+
+static void ymodem_flush(void) {
+    uint8_t *stage = (uint8_t *)ymodem_stage;
+
+    if (ymodem_uf2) {
+        if (ymodem_fill == sizeof(ymodem_stage))
+            write_block(ymodem_block++, stage, false, &ymodem_state);
+    } else {
+        update_submit(&monitor_update, ymodem_addr, stage, ymodem_fill);
+        update_sync(&monitor_update);
+        ymodem_addr += ymodem_fill;
+    }
+    ymodem_fill = 0;
+}
+
+static bool ymodem_start(const char *name, uint32_t size) {
+    uint32_t n = strlen(name);
+
+    ymodem_uf2 = n > 4 && (!strcmp(name + n - 4, ".uf2") || !strcmp(name + n - 4, ".UF2"));
+    ymodem_fill = 0;
+    // A binary needs its size, to know it fits
+    return ymodem_uf2 || (ymodem_addr >= APP_START_ADDRESS && size <= FLASH_SIZE - ymodem_addr);
+}
+
+static void ymodem_data(uint32_t offset, const uint8_t *data, uint32_t len) {
+    while (len) {
+        uint32_t n = sizeof(ymodem_stage) - ymodem_fill;
+        if (n > len)
+            n = len;
+        memcpy((uint8_t *)ymodem_stage + ymodem_fill, data, n);
+        ymodem_fill += n;
+        data += n;
+        len -= n;
+        if (ymodem_fill == sizeof(ymodem_stage))
+            ymodem_flush();
+    }
+}
+
+static const YmodemSink ymodem_sink = {ymodem_start, ymodem_data, ymodem_flush};
+#endif
+
+#if USE_FAST_MONITOR || USE_UART_BROADCAST
+static uint16_t fast_crc(const uint8_t *p, uint32_t length) {
+    uint16_t crc = 0;
+    while (length--)
+        crc = add_crc(*p++, crc);
+    return crc;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+#endif
+
+#if USE_FAST_MONITOR
+#define FAST_HEADER_SIZE 12
+#define FAST_REPLY_HEADER_SIZE 8
+
+// A request with its payload and CRC, then the reply built in its place; words, so that rows can
+// go to the update engine straight from here
+static uint32_t fast_buf[(FAST_HEADER_SIZE + SAM_BA_FAST_MAX_PAYLOAD + 2 + 3) / 4];
+
+// Reads whatever is there, without blocking (cdc_read_buf() waits for a byte on the UART)
+static uint32_t fast_poll(uint8_t *dst, uint32_t length) {
+    if (b_sam_ba_interface_usart && !cdc_is_rx_ready())
+        return 0;
+    return cdc_read_buf(dst, length);
+}
+
+static bool fast_flash_range_ok(uint32_t addr, uint32_t len) {
+    return addr >= APP_START_ADDRESS && len <= FLASH_SIZE && addr <= FLASH_SIZE - len;
+}
+
+// How many of the len bytes at addr are in flash or SRAM, up to the end of the one addr is in
+static uint32_t fast_read_len(uint32_t addr, uint32_t len) {
+    uint32_t end;
+
+    if (addr < FLASH_SIZE)
+        end = FLASH_SIZE;
+    else if (addr - RAM_START < RAM_SIZE)
+        end = RAM_START + RAM_SIZE;
+    else
+        return 0;
+    return len < end - addr ? len : end - addr;
+}
+
+static void sam_ba_fast_run(void) {
+    uint8_t *buf = (uint8_t *)fast_buf;
+
+    while (1) {
+        // Keep the drive going in between frames
+        while (!fast_poll(buf, 1))
+            process_msc();
+        if (buf[0] != SAM_BA_FAST_REQ_SYNC)
+            continue;
+
+        read_raw(buf + 1, FAST_HEADER_SIZE - 1);
+        uint8_t op = buf[1];
+        uint16_t seq = buf[2] | buf[3] << 8;
+        uint32_t addr = get_le32(buf + 4);
+        uint32_t len = get_le32(buf + 8);
+        uint32_t in_len = op == SAM_BA_FAST_OP_WRITE ? len : 0;
+        uint32_t out_len = 0;
+        uint8_t status = SAM_BA_FAST_OK;
+
+        // A payload longer than the host was told about means the header itself is garbled
+        if (in_len > SAM_BA_FAST_MAX_PAYLOAD) {
+            status = SAM_BA_FAST_BAD_CRC;
+        } else {
+            read_raw(buf + FAST_HEADER_SIZE, in_len + 2);
+            const uint8_t *crc = buf + FAST_HEADER_SIZE + in_len;
+            if (fast_crc(buf, FAST_HEADER_SIZE + in_len) != (crc[0] | crc[1] << 8))
+                status = SAM_BA_FAST_BAD_CRC;
+        }
+
+        if (status == SAM_BA_FAST_BAD_CRC) {
+#if USE_UART
+            if (b_sam_ba_interface_usart)
+                usart_line_error();
+#endif
+            // Drop the rest of the frame and whatever the host pipelined after it, until nothing
+            // has come in for 10ms
+            for (int idle = 0; idle < 10; ++idle) {
+                delay(1);
+                while (fast_poll(buf, SIZEBUFMAX))
+                    idle = 0;
+            }
+        } else if (op == SAM_BA_FAST_OP_WRITE) {
+            if (!fast_flash_range_ok(addr, len) || addr % FLASH_ROW_SIZE || len % FLASH_ROW_SIZE ||
+                !update_submit(&monitor_update, addr, buf + FAST_HEADER_SIZE, len))
+                status = SAM_BA_FAST_BAD_ADDR;
+        } else if (op == SAM_BA_FAST_OP_ERASE) {
+            if (!fast_flash_range_ok(addr, len))
+                status = SAM_BA_FAST_BAD_ADDR;
+            else
+                flash_erase_range(addr, len);
+        } else if (op == SAM_BA_FAST_OP_CRC &&
+                   (fast_read_len(addr, len) != len || !read_allowed(addr, len))) {
+            status = SAM_BA_FAST_BAD_ADDR;
+        } else if (op == SAM_BA_FAST_OP_CRC) {
+            uint16_t crc = fast_crc((const uint8_t *)addr, len);
+            buf[FAST_REPLY_HEADER_SIZE] = crc;
+            buf[FAST_REPLY_HEADER_SIZE + 1] = crc >> 8;
+            out_len = 2;
+        } else if (op == SAM_BA_FAST_OP_READ) {
+            uint32_t n = fast_read_len(addr, len);
+            if ((len && !n) || len > SAM_BA_FAST_MAX_PAYLOAD || !read_allowed(addr, n)) {
+                status = SAM_BA_FAST_BAD_ADDR;
+            } else {
+                memcpy(buf + FAST_REPLY_HEADER_SIZE, (const void *)addr, n);
+                out_len = n;
+            }
+        } else if (op != SAM_BA_FAST_OP_EXIT && op != SAM_BA_FAST_OP_RESET) {
+            status = SAM_BA_FAST_BAD_OP;
+        }
+
+        buf[0] = SAM_BA_FAST_REPLY_SYNC;
+        buf[1] = op;
+        buf[2] = seq;
+        buf[3] = seq >> 8;
+        buf[4] = status;
+        buf[5] = 0;
+        buf[6] = out_len;
+        buf[7] = out_len >> 8;
+        uint16_t crc = fast_crc(buf, FAST_REPLY_HEADER_SIZE + out_len);
+        buf[FAST_REPLY_HEADER_SIZE + out_len] = crc;
+        buf[FAST_REPLY_HEADER_SIZE + out_len + 1] = crc >> 8;
+        cdc_write_buf(buf, FAST_REPLY_HEADER_SIZE + out_len + 2);
+
+        if (status == SAM_BA_FAST_OK && op == SAM_BA_FAST_OP_EXIT)
+            return;
+        if (status == SAM_BA_FAST_OK && op == SAM_BA_FAST_OP_RESET) {
+            cdc_flush();
+            resetIntoApp();
+        }
+    }
+}
+#endif
+
+#if USE_UART_BROADCAST
+#define BCAST_HEADER_SIZE 8
+
+// A request with its payload and CRC, then the reply; words, for the UF2 block in there
+static uint32_t bcast_buf[(BCAST_HEADER_SIZE + 512 + 2 + 3) / 4];
+static WriteState bcast_state;
+static uint32_t bcast_id;
+// Polled for its status, so the host knows this node: no more replies to discovery
+static bool bcast_known;
+
+static void put_le16(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static uint32_t bcast_node_id(void) {
+    // The words load_serial_number() makes the USB serial number of
+#ifdef SAMD21
+    const uint32_t *words[4] = {(uint32_t *)0x0080A00C, (uint32_t *)0x0080A040,
+                                (uint32_t *)0x0080A044, (uint32_t *)0x0080A048};
+#endif
+#ifdef SAMD51
+    const uint32_t *words[4] = {(uint32_t *)0x008061FC, (uint32_t *)0x00806010,
+                                (uint32_t *)0x00806014, (uint32_t *)0x00806018};
+#endif
+    uint32_t id = 0;
+    for (int i = 0; i < 4; i++)
+        id = (id << 7 | id >> 25) ^ *words[i];
+    return id == SAM_BA_BCAST_ADDR_ALL ? 0 : id;
+}
+
+static bool bcast_has_block(uint32_t block_no) {
+    return block_no < MAX_BLOCKS && (bcast_state.writtenMask[block_no / 8] & (1 << (block_no % 8)));
+}
+
+// The runs of blocks still missing, as first block and count; none while the size of the image
+// isn't known (nothing came in yet, or blocks of different images did)
+static uint32_t bcast_missing(uint8_t *out) {
+    uint32_t total = bcast_state.numBlocks, runs = 0;
+
+    if (total > MAX_BLOCKS)
+        return 0;
+    for (uint32_t b = 0; b < total && runs < SAM_BA_BCAST_MAX_RANGES; b++) {
+        if (bcast_has_block(b))
+            continue;
+        uint32_t first = b;
+        while (b + 1 < total && !bcast_has_block(b + 1))
+            b++;
+        put_le16(out, first);
+        put_le16(out + 2, b - first + 1);
+        out += 4;
+        runs++;
+    }
+    return runs;
+}
+
+static void bcast_reply(uint8_t op, uint32_t len) {
+    uint8_t *buf = (uint8_t *)bcast_buf;
+
+    buf[0] = SAM_BA_BCAST_REPLY_SYNC;
+    buf[1] = op;
+    put_le32(buf + 2, bcast_id);
+    put_le16(buf + 6, len);
+    put_le16(buf + BCAST_HEADER_SIZE + len, fast_crc(buf, BCAST_HEADER_SIZE + len));
+#ifdef BOOT_RS485_DE_PIN
+    PINOP(BOOT_RS485_DE_PIN, OUTSET);
+#endif
+    usart_putdata(buf, BCAST_HEADER_SIZE + len + 2);
+    // The driver has to stay on until the stop bit of the last byte is out
+    usart_flush();
+#ifdef BOOT_RS485_DE_PIN
+    PINOP(BOOT_RS485_DE_PIN, OUTCLR);
+#endif
+}
+
+static void sam_ba_bcast_run(void) {
+    uint8_t *buf = (uint8_t *)bcast_buf;
+    uint8_t *payload = buf + BCAST_HEADER_SIZE;
+
+    bcast_id = bcast_node_id();
+    memset(&bcast_state, 0, sizeof(bcast_state));
+    bcast_known = false;
+#ifdef BOOT_RS485_DE_PIN
+    PINOP(BOOT_RS485_DE_PIN, OUTCLR);
+    PINOP(BOOT_RS485_DE_PIN, DIRSET);
+#endif
+
+    while (1) {
+        read_raw(buf, 1);
+        if (buf[0] != SAM_BA_BCAST_REQ_SYNC)
+            continue;
+
+        read_raw(buf + 1, BCAST_HEADER_SIZE - 1);
+        uint8_t op = buf[1];
+        uint32_t addr = get_le32(buf + 2);
+        uint32_t len = buf[6] | buf[7] << 8;
+        if (len > 512)
+            continue;
+        read_raw(payload, len + 2);
+        // Not a line error: the replies of other nodes go by here too, and a 0xA6 in one of them
+        // looks like the start of a request
+        if (fast_crc(buf, BCAST_HEADER_SIZE + len) != (payload[len] | payload[len + 1] << 8))
+            continue;
+        if (addr != SAM_BA_BCAST_ADDR_ALL && addr != bcast_id)
+            continue;
+
+        if (op == SAM_BA_BCAST_OP_BLOCK) {
+            UF2_Block *bl = (void *)payload;
+            if (len == 512 && !bcast_has_block(bl->blockNo))
+                write_block(bl->blockNo, payload, true, &bcast_state);
+        } else if (op == SAM_BA_BCAST_OP_DISCOVER && len == 8) {
+            uint32_t slots = payload[4] | payload[5] << 8;
+            uint32_t slot_ms = payload[6] | payload[7] << 8;
+            if (slots && !bcast_known) {
+                delay(((bcast_id ^ get_le32(payload)) * 0x9E3779B1 >> 16) % slots * slot_ms);
+                bcast_reply(op, 0);
+            }
+        } else if (op == SAM_BA_BCAST_OP_STATUS && addr == bcast_id) {
+            bcast_known = true;
+            put_le32(payload, bcast_state.numBlocks);
+            put_le32(payload + 4, bcast_state.numWritten);
+            bcast_reply(op, 8 + 4 * bcast_missing(payload + 8));
+        } else if (op == SAM_BA_BCAST_OP_RESET) {
+            if (bcast_state.numBlocks && bcast_state.numBlocks <= MAX_BLOCKS &&
+                bcast_state.numWritten >= bcast_state.numBlocks && !bcast_state.rejected)
+                resetIntoApp();
+        }
+    }
+}
+#endif
+
 /**
  * \brief This function starts the SAM-BA monitor.
  */
@@ -173,8 +553,22 @@ void sam_ba_monitor_run(void) {
                             cdc_read_buf_xmd(ptr_data, current_number - j);
 
                         __asm("nop");
+                    } else if (command == 'U') {
+                        // Syntax: U[ADDR],[SIZE]#, followed by SIZE bytes
+                        // Flashes the bytes as they arrive; S and Y in one, without the copy in
+                        // SRAM. Returns U when done.
+                        u32tmp = length - i - 1;
+                        if (u32tmp > current_number)
+                            u32tmp = current_number;
+                        write_direct((uint32_t)ptr_data, current_number, ptr + 1, u32tmp);
+                        i += u32tmp;
+                        ptr += u32tmp;
+                        cdc_write_buf("U\n\r", 3);
                     } else if (command == 'R') {
-                        cdc_write_buf_xmd(ptr_data, current_number);
+                        if (read_allowed((uint32_t)ptr_data, current_number))
+                            cdc_write_buf_xmd(ptr_data, current_number);
+                        else
+                            put_zeros(current_number);
                     } else if (command == 'O') {
                         *ptr_data = (char)current_number;
                     } else if (command == 'H') {
@@ -185,15 +579,23 @@ void sam_ba_monitor_run(void) {
                             RGBLED_set_color(COLOR_LEAVE);
                         *((int *)(void *)ptr_data) = current_number;
                     } else if (command == 'o') {
-                        sam_ba_putdata_term(ptr_data, 1);
+                        current_number = read_allowed((uint32_t)ptr_data, 1) ? *ptr_data : 0;
+                        sam_ba_putdata_term((uint8_t *)&current_number, 1);
                     } else if (command == 'h') {
-                        current_number = *((uint16_t *)(void *)ptr_data);
+                        current_number = read_allowed((uint32_t)ptr_data, 2)
+                                             ? *((uint16_t *)(void *)ptr_data)
+                                             : 0;
                         sam_ba_putdata_term((uint8_t *)&current_number, 2);
                     } else if (command == 'w') {
-                        current_number = *((uint32_t *)(void *)ptr_data);
+                        current_number = read_allowed((uint32_t)ptr_data, 4)
+                                             ? *((uint32_t *)(void *)ptr_data)
+                                             : 0;
                         sam_ba_putdata_term((uint8_t *)&current_number, 4);
                     } else if (command == 'G') {
+#if !USE_ENCRYPTED_UF2
+                        // An applet could read anything, the device key included
                         call_applet(current_number);
+#endif
                         if (b_sam_ba_interface_usart) {
                             cdc_write_buf("\x06", 1);
                         }
@@ -214,9 +616,10 @@ void sam_ba_monitor_run(void) {
                     } else if (command == 'X') {
                         // Syntax: X[ADDR]#
                         // Erase the flash memory starting from ADDR to the end
-                        // of flash.
-
+                        // of flash; the erase of each block only happens right before it is
+                        // first written, see flash_erase_to_end().
                         flash_erase_to_end((uint32_t *) current_number);
+                        update_begin(&monitor_update, 0);
 
                         // Notify command completed
                         cdc_write_buf("X\n\r", 3);
@@ -239,7 +642,9 @@ void sam_ba_monitor_run(void) {
                             src_buff_addr = (void *)ptr_data;
 
                         } else {
-                            flash_write_words((void *)ptr_data, src_buff_addr, current_number / 4);
+                            update_submit(&monitor_update, (uint32_t)ptr_data, src_buff_addr,
+                                          current_number);
+                            update_sync(&monitor_update);
                         }
 
                         // Notify command completed
@@ -258,6 +663,9 @@ void sam_ba_monitor_run(void) {
                         uint32_t size = current_number;
                         uint16_t crc = 0;
                         uint32_t i = 0;
+                        // The CRC of a byte or two gives the bytes away
+                        if (!read_allowed((uint32_t)data, size))
+                            size = 0;
                         for (i = 0; i < size; i++)
                             crc = add_crc(*data++, crc);
 
@@ -265,6 +673,60 @@ void sam_ba_monitor_run(void) {
                         cdc_write_buf("Z", 1);
                         put_uint32(crc);
                         cdc_write_buf("#\n\r", 3);
+#if USE_UART_AUTOBAUD
+                    } else if (command == 'L') {
+                        // Syntax: L[BAUD]#
+                        // UART only: replies L[BAUD]# at the current rate (L00000000# if the
+                        // rate can't be set), then switches; the host confirms with '#' at
+                        // the new rate within a second, or both stay at the old one.
+                        // Returns: L at the new rate, once confirmed
+                        if (b_sam_ba_interface_usart) {
+                            u32tmp = current_number >= 1200 && current_number <= 6000000
+                                         ? current_number
+                                         : 0;
+                            cdc_write_buf("L", 1);
+                            put_uint32(u32tmp);
+                            cdc_write_buf("#\n\r", 3);
+                            if (u32tmp && usart_switch_baud(u32tmp))
+                                cdc_write_buf("L\n\r", 3);
+                        }
+#endif
+#if USE_YMODEM
+                    } else if (command == 'B') {
+                        // Syntax: B[ADDR]#
+                        // UART only: receives files over YMODEM and flashes them as they come
+                        // in, binaries at ADDR (APP_START_ADDRESS if 0) and on.
+                        // Returns: B[FILES]#
+                        if (b_sam_ba_interface_usart) {
+                            ymodem_addr = current_number ? current_number : APP_START_ADDRESS;
+                            if (ymodem_addr % FLASH_ROW_SIZE)
+                                ymodem_addr = 0;
+                            memset(&ymodem_state, 0, sizeof(ymodem_state));
+                            ymodem_block = 0;
+                            u32tmp = usart_ymodem_receive(&ymodem_sink);
+                            cdc_write_buf("B", 1);
+                            put_uint32(u32tmp);
+                            cdc_write_buf("#\n\r", 3);
+                        }
+#endif
+#if USE_FAST_MONITOR
+                    } else if (command == 'P') {
+                        // Syntax: P#
+                        // Returns: P[MAX_PAYLOAD]#, then takes binary frames until their exit
+                        // request (see sam_ba_monitor.h)
+                        cdc_write_buf("P", 1);
+                        put_uint32(SAM_BA_FAST_MAX_PAYLOAD);
+                        cdc_write_buf("#\n\r", 3);
+                        sam_ba_fast_run();
+#endif
+#if USE_UART_BROADCAST
+                    } else if (command == 'M') {
+                        // Syntax: M#
+                        // UART only: RS-485 broadcast mode, until the node resets (see
+                        // sam_ba_monitor.h). Every node on the bus gets this, so none replies.
+                        if (b_sam_ba_interface_usart)
+                            sam_ba_bcast_run();
+#endif
                     }
 
                     command = 'z';
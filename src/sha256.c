@@ -0,0 +1,202 @@
+#include "uf2.h"
+#include "sha256.h"
+
+// Plain FIPS 180-4 SHA-256, written for size rather than speed; not measured on the M0+ yet.
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t *state, const uint8_t *p) {
+    uint32_t w[16];
+    uint32_t s[8];
+
+    for (int i = 0; i < 8; ++i)
+        s[i] = state[i];
+
+    for (int i = 0; i < 64; ++i) {
+        uint32_t x;
+        if (i < 16) {
+            x = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+            p += 4;
+        } else {
+            uint32_t a = w[(i + 1) & 15], b = w[(i + 14) & 15];
+            x = w[i & 15] + w[(i + 9) & 15] + (ROR(a, 7) ^ ROR(a, 18) ^ (a >> 3)) +
+                (ROR(b, 17) ^ ROR(b, 19) ^ (b >> 10));
+        }
+        w[i & 15] = x;
+
+        uint32_t t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + K[i] + x;
+        uint32_t t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        for (int j = 7; j > 0; --j)
+            s[j] = s[j - 1];
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; ++i)
+        state[i] += s[i];
+}
+
+void sha256_init(Sha256 *ctx) {
+    memcpy(ctx->state, H0, sizeof(H0));
+    ctx->count = 0;
+}
+
+void sha256_update(Sha256 *ctx, const void *data, uint32_t len) {
+    const uint8_t *p = data;
+    while (len--) {
+        ctx->buf[ctx->count++ & 63] = *p++;
+        if (!(ctx->count & 63))
+            sha256_block(ctx->state, ctx->buf);
+    }
+}
+
+// Padding of a message of len bytes, whose last len % 64 bytes are already in buf; returns the
+// number of bytes (64 or 128) to hash from buf
+static uint32_t sha256_pad(uint8_t *buf, uint32_t len) {
+    uint32_t n = len & 63;
+    uint32_t total = n < 56 ? 64 : 128;
+    buf[n++] = 0x80;
+    memset(buf + n, 0, total - n);
+    // Bit count, big endian; images are well below 512 MB
+    buf[total - 4] = len >> 21;
+    buf[total - 3] = len >> 13;
+    buf[total - 2] = len >> 5;
+    buf[total - 1] = len << 3;
+    return total;
+}
+
+static void sha256_output(const uint32_t *state, uint8_t *digest) {
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i] = state[i] >> 24;
+        digest[4 * i + 1] = state[i] >> 16;
+        digest[4 * i + 2] = state[i] >> 8;
+        digest[4 * i + 3] = state[i];
+    }
+}
+
+void sha256_final(Sha256 *ctx, uint8_t *digest) {
+    uint8_t pad[128];
+    memcpy(pad, ctx->buf, ctx->count & 63);
+    uint32_t n = sha256_pad(pad, ctx->count);
+    for (uint32_t i = 0; i < n; i += 64)
+        sha256_block(ctx->state, pad + i);
+    sha256_output(ctx->state, digest);
+}
+
+static void sha256_soft(const uint8_t *data, uint32_t len, uint8_t *digest) {
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
+
+// FIPS 180-4 examples: "abc" is a single padded block, the 112-byte message a full block followed
+// by a padded one, which on the ICM are the two kinds of region
+static const char kat_short[] = "abc";
+static const char kat_long[] = "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+                               "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+static const uint8_t kat_digest[2][SHA256_DIGEST_SIZE] = {
+    {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde,
+     0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+     0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad},
+    {0xcf, 0x5b, 0x16, 0xa7, 0x78, 0xaf, 0x83, 0x80, 0x03, 0x6c, 0xe5, 0x9e,
+     0x7b, 0x04, 0x92, 0x37, 0x0b, 0x24, 0x9b, 0x11, 0xe8, 0xf0, 0x7a, 0x51,
+     0xaf, 0xac, 0x45, 0x03, 0x7a, 0xfe, 0xe9, 0xd1},
+};
+
+static bool sha256_known_answers(void (*hash)(const uint8_t *, uint32_t, uint8_t *)) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    hash((const uint8_t *)kat_short, sizeof(kat_short) - 1, digest);
+    if (memcmp(digest, kat_digest[0], SHA256_DIGEST_SIZE))
+        return false;
+    hash((const uint8_t *)kat_long, sizeof(kat_long) - 1, digest);
+    return !memcmp(digest, kat_digest[1], SHA256_DIGEST_SIZE);
+}
+
+#ifdef SAMD51
+// The ICM hashes straight from flash over the AHB. It doesn't pad, so the full blocks are one
+// region and the tail with the padding is a second one, chained from a RAM buffer through the
+// secondary list. The CPU only waits, and the cost is mostly the flash reads.
+static IcmDescriptor icm_dscr[2] __attribute__((aligned(64)));
+static uint32_t icm_hash[32] __attribute__((aligned(128)));
+static uint8_t icm_tail[128] __attribute__((aligned(4)));
+// 0 before the ICM has been checked against the known answers, 1 if it gave them, -1 if not
+static int8_t icm_state;
+
+static void sha256_icm(const uint8_t *data, uint32_t len, uint8_t *digest) {
+    uint32_t full = len & ~63;
+    memcpy(icm_tail, data + full, len - full);
+    uint32_t tail = sha256_pad(icm_tail, len);
+
+    MCLK->AHBMASK.reg |= MCLK_AHBMASK_ICM;
+    MCLK->APBCMASK.reg |= MCLK_APBCMASK_ICM;
+    ICM->CTRL.reg = ICM_CTRL_SWRST;
+
+    IcmDescriptor *first = &icm_dscr[0];
+    IcmDescriptor *second = &icm_dscr[1];
+    first->RCFG.reg = ICM_RCFG_EOM | ICM_RCFG_ALGO(ICM_CFG_UALGO_SHA256_Val);
+    second->RADDR.reg = (uint32_t)icm_tail;
+    second->RCFG.reg = 0;
+    second->RCTRL.reg = tail / 64 - 1;
+    second->RNEXT.reg = 0;
+    if (full) {
+        first->RADDR.reg = (uint32_t)data;
+        first->RCTRL.reg = full / 64 - 1;
+        first->RNEXT.reg = (uint32_t)second;
+    } else {
+        first->RADDR.reg = (uint32_t)icm_tail;
+        first->RCTRL.reg = tail / 64 - 1;
+        first->RNEXT.reg = 0;
+    }
+
+    ICM->CFG.reg = 0;
+    ICM->DSCR.reg = (uint32_t)icm_dscr;
+    ICM->HASH.reg = (uint32_t)icm_hash;
+    ICM->CTRL.reg = ICM_CTRL_ENABLE;
+    while (!(ICM->ISR.reg & ICM_ISR_RHC(1)))
+        ;
+    ICM->CTRL.reg = ICM_CTRL_DISABLE;
+
+    // The ICM writes the digest out in message byte order, which the known answers check
+    memcpy(digest, icm_hash, SHA256_DIGEST_SIZE);
+}
+
+// The first digest checks the ICM: if its byte order or chaining is off, the software one is used
+void sha256_flash(const uint8_t *data, uint32_t len, uint8_t *digest) {
+    if (!icm_state) {
+        icm_state = sha256_known_answers(sha256_icm) ? 1 : -1;
+        if (icm_state < 0)
+            logmsg("ICM fails the SHA-256 known answers, hashing in software");
+    }
+    if (icm_state > 0)
+        sha256_icm(data, len, digest);
+    else
+        sha256_soft(data, len, digest);
+}
+#else
+void sha256_flash(const uint8_t *data, uint32_t len, uint8_t *digest) {
+    sha256_soft(data, len, digest);
+}
+#endif
+
+bool sha256_self_test(void) {
+    return sha256_known_answers(sha256_flash);
+}
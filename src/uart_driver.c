@@ -134,4 +134,266 @@ void uart_read_buffer_polled(Sercom *sercom, uint8_t *ptr, uint16_t length) {
         /* Store the read data to the buffer */
         *ptr++ = (uint8_t)sercom->USART.DATA.reg;
     } while (length--);
-}
\ No newline at end of file
+}
+
+void uart_set_baud(Sercom *sercom, uint32_t baud, uint32_t fref) {
+    /* 16x oversampling, or 8x for rates above fref / 16 */
+    uint32_t samples = baud > fref / 16 ? 8 : 16;
+    uint32_t q = samples * baud;
+    uint32_t frac = 0;
+
+    /* BAUD = 65536 * (1 - samples * baud / fref); the fraction one bit at a time, as the
+       product doesn't fit 32 bits */
+    if (q >= fref) {
+        frac = 0x10000;
+    } else {
+        for (int i = 0; i < 16; i++) {
+            q <<= 1;
+            frac <<= 1;
+            if (q >= fref) {
+                q -= fref;
+                frac |= 1;
+            }
+        }
+        /* Round to nearest */
+        if (q << 1 >= fref && frac < 0xffff)
+            frac++;
+    }
+
+    uart_disable(sercom);
+    sercom->USART.CTRLA.reg = (sercom->USART.CTRLA.reg & ~SERCOM_USART_CTRLA_SAMPR_Msk) |
+                              SERCOM_USART_CTRLA_SAMPR(samples == 8 ? 2 : 0);
+    sercom->USART.BAUD.reg = 0x10000 - frac;
+    while (sercom->USART.SYNCBUSY.bit.ENABLE)
+        ;
+    sercom->USART.CTRLA.bit.ENABLE = 1;
+}
+
+void uart_enable_autobaud(Sercom *sercom) {
+    uart_disable(sercom);
+    sercom->USART.CTRLA.reg = (sercom->USART.CTRLA.reg & ~SERCOM_USART_CTRLA_FORM_Msk) |
+                              SERCOM_USART_CTRLA_FORM(4);
+    while (sercom->USART.SYNCBUSY.bit.ENABLE)
+        ;
+    sercom->USART.CTRLA.bit.ENABLE = 1;
+}
+
+uint32_t uart_get_baud(Sercom *sercom, uint32_t fref) {
+    uint32_t factor = sercom->USART.CTRLA.bit.SAMPR == 2 ? 2 : 1;
+    /* fref / 16 * (65536 - BAUD) / 65536, scaled down by 64 to stay within 32 bits; twice that
+       with 8x oversampling */
+    return ((0x10000 - sercom->USART.BAUD.reg) * (fref / 16 / 64) >> 10) * factor;
+}
+
+/* The DMAC is shared by the transports: each has its channels (UART_DMA_*_CH, ESP_DMA_*_CH) and
+   their descriptors in these tables. */
+static DmacDescriptor dma_desc[DMAC_USED_CHANNELS] __attribute__((aligned(16)));
+static DmacDescriptor dma_wb[DMAC_USED_CHANNELS] __attribute__((aligned(16)));
+
+void dmac_init(void) {
+    if ((DMAC->CTRL.reg & DMAC_CTRL_DMAENABLE) && DMAC->BASEADDR.reg == (uint32_t)dma_desc)
+        return;
+#ifdef SAMD51
+    MCLK->AHBMASK.reg |= MCLK_AHBMASK_DMAC;
+#else
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+#endif
+    DMAC->CTRL.reg = 0;
+    DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+    while (DMAC->CTRL.reg & DMAC_CTRL_SWRST)
+        ;
+    DMAC->BASEADDR.reg = (uint32_t)dma_desc;
+    DMAC->WRBADDR.reg = (uint32_t)dma_wb;
+    DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN0;
+}
+
+DmacDescriptor *dmac_descriptor(uint32_t ch) {
+    return &dma_desc[ch];
+}
+
+void dmac_channel_start(uint32_t ch, uint32_t trigsrc) {
+#ifdef SAMD51
+    DMAC->Channel[ch].CHCTRLA.reg = DMAC_CHCTRLA_TRIGSRC(trigsrc) | DMAC_CHCTRLA_TRIGACT_BURST |
+                                    DMAC_CHCTRLA_BURSTLEN_SINGLE | DMAC_CHCTRLA_ENABLE;
+#else
+    DMAC->CHID.reg = ch;
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_TRIGSRC(trigsrc) | DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+#endif
+}
+
+bool dmac_channel_busy(uint32_t ch) {
+#ifdef SAMD51
+    return DMAC->Channel[ch].CHCTRLA.bit.ENABLE;
+#else
+    DMAC->CHID.reg = ch;
+    return DMAC->CHCTRLA.bit.ENABLE;
+#endif
+}
+
+bool dmac_channel_block_done(uint32_t ch) {
+#ifdef SAMD51
+    if (!(DMAC->Channel[ch].CHINTFLAG.reg & DMAC_CHINTFLAG_TCMPL))
+        return false;
+    DMAC->Channel[ch].CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+#else
+    DMAC->CHID.reg = ch;
+    if (!(DMAC->CHINTFLAG.reg & DMAC_CHINTFLAG_TCMPL))
+        return false;
+    DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_TCMPL;
+#endif
+    return true;
+}
+
+void dmac_channel_stop(uint32_t ch) {
+#ifdef SAMD51
+    DMAC->Channel[ch].CHCTRLA.reg = 0;
+    while (DMAC->Channel[ch].CHCTRLA.bit.ENABLE)
+        ;
+#else
+    DMAC->CHID.reg = ch;
+    DMAC->CHCTRLA.reg = 0;
+    while (DMAC->CHCTRLA.bit.ENABLE)
+        ;
+#endif
+}
+
+/* DMA transport: channel 0 copies every received byte into rx_ring, looping over it through a
+   descriptor that links to itself; channel 1 sends runs of tx_ring. Both work from SRAM only, so
+   they go on while the CPU is stalled on an NVM command.
+   The RX side counts bytes from the start, written and read, so that a writer that has gone
+   round past the reader shows: the end of every lap sets the channel's TCMPL flag, which
+   rx_written() counts. Two laps between looks count as one, so the reader has to look at least
+   once per ring for an overrun to be caught for sure. */
+static volatile uint8_t rx_ring[UART_RX_RING_SIZE];
+static uint32_t rx_laps, rx_read;
+static bool rx_overflow;
+static uint8_t tx_ring[UART_TX_RING_SIZE];
+static uint32_t tx_head, tx_tail, tx_inflight;
+
+static Sercom *dma_sercom;
+static uint32_t sercom_dma_trigger;
+
+void uart_dma_init(Sercom *sercom) {
+    dma_sercom = sercom;
+    /* The triggers of each SERCOM are RX, TX, in SERCOM order */
+    sercom_dma_trigger = SERCOM0_DMAC_ID_RX + 2 * uart_get_sercom_index(sercom);
+
+    dmac_init();
+    dma_desc[UART_DMA_RX_CH].BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+                                          DMAC_BTCTRL_DSTINC | DMAC_BTCTRL_BLOCKACT_INT;
+    dma_desc[UART_DMA_RX_CH].BTCNT.reg = UART_RX_RING_SIZE;
+    dma_desc[UART_DMA_RX_CH].SRCADDR.reg = (uint32_t)&sercom->USART.DATA.reg;
+    /* With DSTINC, DSTADDR is the end of the block */
+    dma_desc[UART_DMA_RX_CH].DSTADDR.reg = (uint32_t)rx_ring + UART_RX_RING_SIZE;
+    dma_desc[UART_DMA_RX_CH].DESCADDR.reg = (uint32_t)&dma_desc[UART_DMA_RX_CH];
+
+    rx_laps = rx_read = 0;
+    rx_overflow = false;
+    dmac_channel_block_done(UART_DMA_RX_CH);
+    tx_head = tx_tail = tx_inflight = 0;
+    dmac_channel_start(UART_DMA_RX_CH, sercom_dma_trigger);
+}
+
+void uart_dma_stop(void) {
+    uart_dma_flush();
+    dmac_channel_stop(UART_DMA_RX_CH);
+}
+
+/* Where channel 0 writes the next byte. The channel gives up the bus after every byte, which
+   writes its count back; only while it is the active channel is the count in ACTIVE instead. */
+static uint32_t rx_head(void) {
+    uint32_t active = DMAC->ACTIVE.reg;
+    uint32_t left;
+
+    if ((active & DMAC_ACTIVE_ABUSY) &&
+        (active & DMAC_ACTIVE_ID_Msk) >> DMAC_ACTIVE_ID_Pos == UART_DMA_RX_CH)
+        left = active >> DMAC_ACTIVE_BTCNT_Pos;
+    else
+        left = dma_wb[UART_DMA_RX_CH].BTCNT.reg;
+    return (UART_RX_RING_SIZE - left) & (UART_RX_RING_SIZE - 1);
+}
+
+/* Bytes channel 0 has written since uart_dma_init(). A lap that ends between the two reads of
+   the head is counted, and the head read again. */
+static uint32_t rx_written(void) {
+    uint32_t head = rx_head();
+
+    if (dmac_channel_block_done(UART_DMA_RX_CH)) {
+        rx_laps++;
+        head = rx_head();
+    }
+    return rx_laps * UART_RX_RING_SIZE + head;
+}
+
+uint32_t uart_dma_rx_count(void) {
+    uint32_t written = rx_written();
+
+    uart_dma_kick();
+    if (written - rx_read > UART_RX_RING_SIZE) {
+        /* The unread bytes have been written over: drop them all, the protocol resyncs */
+        rx_overflow = true;
+        rx_read = written;
+    }
+    return written - rx_read;
+}
+
+uint32_t uart_dma_read(uint8_t *ptr, uint32_t length) {
+    uint32_t n = uart_dma_rx_count();
+
+    if (n > length)
+        n = length;
+    for (uint32_t i = 0; i < n; i++)
+        *ptr++ = rx_ring[rx_read++ & (UART_RX_RING_SIZE - 1)];
+    return n;
+}
+
+bool uart_dma_rx_overflow(void) {
+    bool lost = rx_overflow;
+    rx_overflow = false;
+    return lost;
+}
+
+void uart_dma_kick(void) {
+    if (tx_inflight) {
+        if (dmac_channel_busy(UART_DMA_TX_CH))
+            return;
+        tx_tail = (tx_tail + tx_inflight) & (UART_TX_RING_SIZE - 1);
+        tx_inflight = 0;
+    }
+    if (tx_head == tx_tail)
+        return;
+
+    /* Up to the end of the ring; the rest goes once this is done */
+    tx_inflight = tx_head > tx_tail ? tx_head - tx_tail : UART_TX_RING_SIZE - tx_tail;
+    dma_desc[UART_DMA_TX_CH].BTCTRL.reg =
+        DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE | DMAC_BTCTRL_SRCINC;
+    dma_desc[UART_DMA_TX_CH].BTCNT.reg = tx_inflight;
+    dma_desc[UART_DMA_TX_CH].SRCADDR.reg = (uint32_t)tx_ring + tx_tail + tx_inflight;
+    dma_desc[UART_DMA_TX_CH].DSTADDR.reg = (uint32_t)&dma_sercom->USART.DATA.reg;
+    dma_desc[UART_DMA_TX_CH].DESCADDR.reg = 0;
+    dma_sercom->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_TXC;
+    dmac_channel_start(UART_DMA_TX_CH, sercom_dma_trigger + 1);
+}
+
+void uart_dma_write(const uint8_t *ptr, uint32_t length) {
+    while (length--) {
+        /* One slot stays free, to tell a full ring from an empty one */
+        while (((tx_head + 1) & (UART_TX_RING_SIZE - 1)) == tx_tail)
+            uart_dma_kick();
+        tx_ring[tx_head] = *ptr++;
+        tx_head = (tx_head + 1) & (UART_TX_RING_SIZE - 1);
+    }
+    uart_dma_kick();
+}
+
+void uart_dma_flush(void) {
+    if (!tx_inflight && tx_head == tx_tail)
+        return;
+    while (tx_inflight || tx_head != tx_tail)
+        uart_dma_kick();
+    /* Until the last byte is out of the shift register too */
+    while (!dma_sercom->USART.INTFLAG.bit.TXC)
+        ;
+}
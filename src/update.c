@@ -0,0 +1,133 @@
+#include "uf2.h"
+#include "boot_table.h"
+
+// The one staged row, shared by all sessions: staging another row writes this one out first
+static uint32_t stage_buf[FLASH_ROW_SIZE / 4];
+static uint32_t stage_addr;
+static UpdateSession *stage_owner;
+
+bool update_addr_ok(uint32_t addr) {
+    return addr >= APP_START_ADDRESS && addr < FLASH_SIZE && boot_slot_write_allowed(addr);
+}
+
+void update_begin(UpdateSession *s, uint8_t flags) {
+    if (stage_owner == s)
+        update_sync(s);
+    memset(s, 0, sizeof(*s));
+    s->flags = flags | UPDATE_ACTIVE;
+    s->stats.started = timerHigh;
+#if USE_BANK_SWAP
+    // Rows of an earlier image that never finished aren't part of this one
+    if (flags & UPDATE_IMAGE)
+        bank_discard();
+#endif
+#if USE_SIGNED_IMAGES
+    if (flags & UPDATE_IMAGE)
+        multiboot_stream_begin();
+#endif
+}
+
+static void write_row(UpdateSession *s, uint32_t addr, uint32_t *src) {
+#if USE_BANK_SWAP
+    if (s->flags & UPDATE_IMAGE)
+        bank_write_row(addr, src);
+    else
+#endif
+        flash_write_row((uint32_t *)addr, src);
+#if USE_SIGNED_IMAGES
+    if (s->flags & UPDATE_IMAGE) {
+#if USE_BANK_SWAP
+        multiboot_stream_row(addr + FLASH_BANK_SIZE, (const uint8_t *)src);
+#else
+        multiboot_stream_row(addr, (const uint8_t *)src);
+#endif
+    }
+#endif
+    s->stats.rows++;
+}
+
+void update_sync(UpdateSession *s) {
+    if (stage_owner != s)
+        return;
+    stage_owner = NULL;
+    write_row(s, stage_addr, stage_buf);
+}
+
+bool update_submit(UpdateSession *s, uint32_t addr, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+    bool ok = true;
+
+    if (!(s->flags & UPDATE_ACTIVE))
+        update_begin(s, s->flags);
+    s->stats.bytes += len;
+
+    while (len) {
+        uint32_t row = addr & ~(FLASH_ROW_SIZE - 1);
+        uint32_t offset = addr - row;
+        uint32_t n = FLASH_ROW_SIZE - offset < len ? FLASH_ROW_SIZE - offset : len;
+
+        if (!update_addr_ok(row)) {
+            s->stats.rejected += n;
+            ok = false;
+        } else if (n == FLASH_ROW_SIZE && !((uint32_t)src & 3)) {
+            // Replaces whatever was staged for this row
+            if (stage_owner == s && stage_addr == row)
+                stage_owner = NULL;
+            write_row(s, row, (uint32_t *)src);
+#if USE_BANK_SWAP
+        } else if ((s->flags & UPDATE_IMAGE) && n < FLASH_ROW_SIZE) {
+            // The rest of the row would come from the running bank, the old image
+            s->stats.rejected += n;
+            ok = false;
+#endif
+        } else {
+            if (stage_owner != s || stage_addr != row) {
+                if (stage_owner)
+                    update_sync(stage_owner);
+                // Keep the rest of the row; erased first if flash_erase_to_end() asked for it
+                flash_erase_pending(row, FLASH_ROW_SIZE);
+                memcpy(stage_buf, (void *)row, FLASH_ROW_SIZE);
+                stage_owner = s;
+                stage_addr = row;
+                s->stats.merged++;
+            }
+            memcpy((uint8_t *)stage_buf + offset, src, n);
+            if (offset + n == FLASH_ROW_SIZE)
+                update_sync(s);
+        }
+        addr += n;
+        src += n;
+        len -= n;
+    }
+    return ok;
+}
+
+bool update_finalize(UpdateSession *s, uint32_t reset_ticks) {
+    update_sync(s);
+#if USE_SIGNED_IMAGES
+    // Leave an unsigned or tampered with image alone, and stay in the bootloader
+    if ((s->flags & UPDATE_IMAGE) && !multiboot_transfer_ok()) {
+#if USE_BANK_SWAP
+        bank_discard();
+#endif
+        return false;
+    }
+#endif
+#if USE_BANK_SWAP
+    // Only now may the next reset swap it in
+    if (s->flags & UPDATE_IMAGE)
+        bank_commit();
+#endif
+    boot_slot_commit();
+    if (reset_ticks)
+        update_reset_after(reset_ticks);
+    return true;
+}
+
+void update_reset_after(uint32_t reset_ticks) {
+    resetHorizon = timerHigh + reset_ticks;
+}
+
+const UpdateStats *update_progress(const UpdateSession *s) {
+    return &s->stats;
+}
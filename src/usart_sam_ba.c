@@ -47,11 +47,26 @@ volatile uint8_t idx_tx_write;
 
 /* Test for timeout in AT91F_GetChar */
 uint8_t error_timeout;
-uint16_t size_of_data;
+uint32_t size_of_data;
 uint8_t mode_of_transfer;
 
 #define BOOT_USART_PAD(n) BOOT_USART_PAD##n
 
+// The SERCOM core clock, 48MHz on both chips (GCLK0 on the SAMD21)
+#define USART_CLOCK 48000000
+
+// Current baud rate; follows auto-baud and the L command
+static uint32_t usart_baud;
+
+#if USE_UART_AUTOBAUD
+// More line errors than this at a rate L switched to go back to usart_base_baud
+#define USART_MAX_ERRORS 16
+
+// BOOT_USART_BAUD, or what auto-baud measured last
+static uint32_t usart_base_baud;
+static uint32_t usart_errors;
+#endif
+
 /**
  * \brief Open the given USART
  */
@@ -115,20 +130,26 @@ void usart_open() {
     clkctrl.bit.WRTLOCK = false;
     clkctrl.bit.GEN = GCLK_CLKCTRL_GEN_GCLK0_Val;
     GCLK->CLKCTRL.reg = (clkctrl.reg | temp);
-    /* Baud rate 115200 - clock 8MHz -> BAUD value-50436 */
-    uart_basic_init(BOOT_USART_MODULE, 50436, BOOT_USART_PAD_SETTINGS);
+    uart_basic_init(BOOT_USART_MODULE, 0, BOOT_USART_PAD_SETTINGS);
     #endif
 
     #ifdef SAMD51
-    GCLK->PCHCTRL[BOOT_GCLK_ID_CORE].reg = GCLK_PCHCTRL_GEN_GCLK0_Val | (1 << GCLK_PCHCTRL_CHEN_Pos);
+    GCLK->PCHCTRL[BOOT_GCLK_ID_CORE].reg = GCLK_48MHZ | (1 << GCLK_PCHCTRL_CHEN_Pos);
     GCLK->PCHCTRL[BOOT_GCLK_ID_SLOW].reg = GCLK_PCHCTRL_GEN_GCLK3_Val | (1 << GCLK_PCHCTRL_CHEN_Pos);
 
     MCLK->BOOT_USART_MASK.reg |= BOOT_USART_BUS_CLOCK_INDEX ;
-    /* Baud rate 115200 - clock 48MHz -> BAUD value-63018 */
-    uart_basic_init(BOOT_USART_MODULE, 63018, BOOT_USART_PAD_SETTINGS);
+    uart_basic_init(BOOT_USART_MODULE, 0, BOOT_USART_PAD_SETTINGS);
     #endif
 
-
+    uart_set_baud(BOOT_USART_MODULE, BOOT_USART_BAUD, USART_CLOCK);
+    usart_baud = BOOT_USART_BAUD;
+#if USE_UART_AUTOBAUD
+    usart_base_baud = BOOT_USART_BAUD;
+    uart_enable_autobaud(BOOT_USART_MODULE);
+#endif
+#if USE_UART_DMA
+    uart_dma_init(BOOT_USART_MODULE);
+#endif
 
     // Initialize flag
     b_sharp_received = false;
@@ -144,7 +165,92 @@ void usart_open() {
  * \brief Configures communication line
  *
  */
-void usart_close(void) { uart_disable(BOOT_USART_MODULE); }
+void usart_close(void) {
+#if USE_UART_DMA
+    uart_dma_stop();
+#endif
+    uart_disable(BOOT_USART_MODULE);
+}
+
+void usart_flush(void) {
+#if USE_UART_DMA
+    uart_dma_flush();
+#else
+    // Set once the last byte written is out, cleared by the next write
+    while (!BOOT_USART_MODULE->USART.INTFLAG.bit.TXC)
+        ;
+#endif
+}
+
+void usart_line_error(void) {
+#if USE_UART_AUTOBAUD
+    if (usart_baud != usart_base_baud && ++usart_errors > USART_MAX_ERRORS) {
+        uart_set_baud(BOOT_USART_MODULE, usart_base_baud, USART_CLOCK);
+        usart_baud = usart_base_baud;
+        usart_errors = 0;
+    }
+#endif
+}
+
+// Called after bytes have been read: picks up a new rate from auto-baud (whose sync byte has
+// come in by then) and counts framing errors and overruns
+static void usart_check_line(void) {
+#if USE_UART_DMA
+    if (uart_dma_rx_overflow()) {
+        logmsg("uart rx overflow");
+        usart_line_error();
+    }
+#endif
+#if USE_UART_AUTOBAUD
+    Sercom *sercom = BOOT_USART_MODULE;
+    uint16_t status;
+
+    if (sercom->USART.INTFLAG.reg & SERCOM_USART_INTFLAG_RXBRK) {
+        sercom->USART.INTFLAG.reg = SERCOM_USART_INTFLAG_RXBRK;
+        usart_base_baud = usart_baud = uart_get_baud(sercom, USART_CLOCK);
+        usart_errors = 0;
+    }
+    status = sercom->USART.STATUS.reg & (SERCOM_USART_STATUS_PERR | SERCOM_USART_STATUS_FERR |
+                                         SERCOM_USART_STATUS_BUFOVF | SERCOM_USART_STATUS_ISF);
+    if (status) {
+        sercom->USART.STATUS.reg = status;
+        usart_line_error();
+    }
+#endif
+}
+
+// Waits up to ms milliseconds of SysTick time for a byte; false if none came
+static bool usart_wait_rx(uint32_t ms) {
+    uint32_t start = systick_ms;
+
+    while (!usart_is_rx_ready())
+        if (systick_ms - start >= ms)
+            return false;
+    return true;
+}
+
+#if USE_UART_AUTOBAUD
+bool usart_switch_baud(uint32_t baud) {
+    uint32_t old = usart_baud;
+
+    if (baud < 1200 || baud > USART_CLOCK / 8)
+        return false;
+    usart_flush();
+    uart_set_baud(BOOT_USART_MODULE, baud, USART_CLOCK);
+    usart_baud = baud;
+    usart_errors = 0;
+
+    // The host confirms with a '#' at the new rate; anything else is what the old rate looks
+    // like at the new one; the host has a second to send it
+    uint32_t start = systick_ms;
+    while (systick_ms - start < 1000)
+        if (usart_is_rx_ready() && usart_getc() == SHARP_CHARACTER)
+            return true;
+    uart_set_baud(BOOT_USART_MODULE, old, USART_CLOCK);
+    usart_baud = old;
+    return false;
+}
+#endif
 
 /**
  * \brief Puts a byte on usart line
@@ -155,13 +261,26 @@ void usart_close(void) { uart_disable(BOOT_USART_MODULE); }
  * \return \c 1 if function was successfully done, otherwise \c 0.
  */
 int usart_putc(int value) {
+#if USE_UART_DMA
+    uint8_t b = value;
+    uart_dma_write(&b, 1);
+#else
     uart_write_byte(BOOT_USART_MODULE, (uint8_t)value);
+#endif
     return 1;
 }
 
 int usart_getc(void) {
     uint16_t retval;
+#if USE_UART_DMA
+    uint8_t b;
+    while (!uart_dma_read(&b, 1))
+        ;
+    retval = b;
+#else
     retval = (uint16_t)uart_read_byte(BOOT_USART_MODULE);
+#endif
+    usart_check_line();
     // usart_read_wait(&usart_sam_ba, &retval);
     return (int)retval;
 }
@@ -175,6 +294,9 @@ int usart_sharp_received(void) {
 }
 
 bool usart_is_rx_ready(void) {
+#if USE_UART_DMA
+    return uart_dma_rx_count() != 0;
+#endif
     return (BOOT_USART_MODULE->USART.INTFLAG.reg & SERCOM_USART_INTFLAG_RXC);
 }
 
@@ -187,6 +309,10 @@ int usart_readc(void) {
 
 // Send given data (polling)
 uint32_t usart_putdata(void const *data, uint32_t length) {
+#if USE_UART_DMA
+    uart_dma_write(data, length);
+    return length;
+#endif
     uint32_t i;
     uint8_t *ptrdata;
     ptrdata = (uint8_t *)data;
@@ -197,41 +323,61 @@ uint32_t usart_putdata(void const *data, uint32_t length) {
     return (i);
 }
 
+#if USE_UART_DMA
+// The line counts as idle after this many characters' time without a byte
+#define USART_IDLE_CHARS 2
+
+#endif
+
 // Get data from comm. device
 uint32_t usart_getdata(void *data, uint32_t length) {
+#if USE_UART_DMA
+    // Like a USB packet: waits for a byte, then returns everything that comes in until the line
+    // goes idle (or length is reached)
+    uint32_t n = 0, last;
+    while (!uart_dma_rx_count())
+        ;
+    last = systick_cycles();
+    while (n < length &&
+           systick_cycles() - last < USART_IDLE_CHARS * 10 * (CPU_FREQUENCY / usart_baud)) {
+        uint32_t got = uart_dma_read((uint8_t *)data + n, length - n);
+        if (got) {
+            n += got;
+            last = systick_cycles();
+        }
+    }
+    usart_check_line();
+    return n;
+#endif
     uint8_t *ptrdata;
     ptrdata = (uint8_t *)data;
     *ptrdata = usart_getc();
     return (1);
 }
 
-static uint16_t crcCache[256];
+// CRC16POLY applied to each nibble value; a nibble at a time needs no table built at run time,
+// which used to hold up the first packet of a transfer
+static const uint16_t crcNibble[16] = {0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5,
+                                       0x60c6, 0x70e7, 0x8108, 0x9129, 0xa14a, 0xb16b,
+                                       0xc18c, 0xd1ad, 0xe1ce, 0xf1ef};
 
 //*----------------------------------------------------------------------------
 //* \fn    add_crc
 //* \brief Compute the CRC
 //*----------------------------------------------------------------------------
 uint16_t add_crc(uint8_t ch, unsigned short crc0) {
-    if (!crcCache[1]) {
-        for (int ptr = 0; ptr < 256; ptr++) {
-            uint16_t crc = (int)ptr << 8;
-            for (uint16_t cmpt = 0; cmpt < 8; cmpt++) {
-                if (crc & 0x8000)
-                    crc = crc << 1 ^ CRC16POLY;
-                else
-                    crc = crc << 1;
-            }
-            crcCache[ptr] = crc;
-        }
-    }
-
-    return ((crc0 << 8) ^ crcCache[((crc0 >> 8) ^ ch) & 0xff]) & 0xffff;
+    uint16_t crc = crc0;
+    crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (ch >> 4)];
+    crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (ch & 0xf)];
+    return crc;
 }
 
 //*----------------------------------------------------------------------------
 //* \fn    getbytes
 //* \brief
 //*----------------------------------------------------------------------------
+// Stores up to size_of_data of the bytes (all of them in mode_of_transfer), with the CRC
+// worked out as they come in
 static uint16_t getbytes(uint8_t *ptr_data, uint16_t length) {
     uint16_t crc = 0;
     uint16_t cpt;
@@ -242,11 +388,11 @@ static uint16_t getbytes(uint8_t *ptr_data, uint16_t length) {
         if (error_timeout)
             return 1;
         crc = add_crc(c, crc);
-        // crc = (crc << 8) ^ xcrc16tab[(crc>>8) ^ c];
-        if (size_of_data || mode_of_transfer) {
+        if (mode_of_transfer) {
             *ptr_data++ = c;
-            if (length == PKTLEN_128)
-                size_of_data--;
+        } else if (size_of_data) {
+            *ptr_data++ = c;
+            size_of_data--;
         }
     }
 
@@ -291,31 +437,36 @@ static int putPacket(uint8_t *tmppkt, uint8_t sno) {
 
 //*----------------------------------------------------------------------------
 //* \fn    getPacket
-//* \brief Used by Xdown to retrieve packets.
+//* \brief Used by Xdown to retrieve packets, after their SOH (128 bytes) or STX
+//*        (1024 bytes). Returns PKT_OK, PKT_REPEAT for the previous packet again (our
+//*        ACK got lost) or PKT_BAD; the caller answers.
 //*----------------------------------------------------------------------------
-uint8_t getPacket(uint8_t *ptr_data, uint8_t sno) {
+uint8_t getPacket(uint8_t *ptr_data, uint8_t sno, uint16_t length) {
     uint8_t seq[2];
     uint16_t crc, xcrc;
+    uint32_t size_before = size_of_data;
 
-    getbytes(seq, 2);
-    xcrc = getbytes(ptr_data, PKTLEN_128);
+    seq[0] = usart_getc();
+    seq[1] = usart_getc();
+    xcrc = getbytes(ptr_data, length);
     if (error_timeout)
-        return (false);
+        return PKT_BAD;
 
     /* An "endian independent way to combine the CRC bytes. */
     crc = (uint16_t)usart_getc() << 8;
     crc += (uint16_t)usart_getc();
 
     if (error_timeout == 1)
-        return (false);
+        return PKT_BAD;
 
-    if ((crc != xcrc) || (seq[0] != sno) || (seq[1] != (uint8_t)(~sno))) {
-        usart_putc(CAN);
-        return (false);
-    }
+    if (crc == xcrc && seq[0] == sno && seq[1] == (uint8_t)(~sno))
+        return PKT_OK;
 
-    usart_putc(ACK);
-    return (true);
+    // The packet goes again, into the same place
+    size_of_data = size_before;
+    if (crc == xcrc && seq[0] == (uint8_t)(sno - 1) && seq[1] == (uint8_t)(~seq[0]))
+        return PKT_REPEAT;
+    return PKT_BAD;
 }
 
 //*----------------------------------------------------------------------------
@@ -417,23 +568,12 @@ uint32_t usart_putdata_xmd(void const *data, uint32_t length) {
 // static void Xdown(char *ptr_data, uint16_t length)
 // Get data from comm. device using xmodem (if necessary)
 uint32_t usart_getdata_xmd(void *data, uint32_t length) {
-    uint32_t timeout;
     char c;
     uint8_t *ptr_data = (uint8_t *)data;
     uint32_t b_run, nbr_of_timeout = 100;
-    uint8_t sno = 0x01;
+    uint8_t sno = 0x01, pkt;
+    uint16_t pkt_len;
     uint32_t data_transfered = 0;
-    uint16_t crc = 0; 
-
-    for (int i =0; i < 128; i++)
-    {
-	    crc = add_crc(i, crc); // warm up crc function very slow on first run
-    }
-
-
-    // Copied from legacy source code ... might need some tweaking
-    uint32_t loops_per_second =
-        CPU_FREQUENCY / 10; /* system_clock_source_get_hz(BOOT_USART_GCLK_GEN_SOURCE) / 10; */
 
     error_timeout = 0;
 
@@ -449,13 +589,7 @@ uint32_t usart_getdata_xmd(void *data, uint32_t length) {
     // ("Xdown");
     while (1) {
         usart_putc('C');
-        timeout = loops_per_second;
-        while (!(usart_is_rx_ready()) && timeout)
-	{
-            timeout--;
-	    __asm__ volatile(""); //  How to prevent GCC from optimizing out a busy wait loop
-	}
-        if (timeout)
+        if (usart_wait_rx(1000))
             break;
 
         if (!(--nbr_of_timeout))
@@ -474,17 +608,23 @@ uint32_t usart_getdata_xmd(void *data, uint32_t length) {
         }
         switch (c) {
         case SOH: /* 128-byte incoming packet */
+        case STX: /* 1024-byte incoming packet (XMODEM-1K) */
             // ("O");
-            b_run = getPacket(ptr_data, sno);
+            pkt_len = c == STX ? PKTLEN_1K : PKTLEN_128;
+            pkt = getPacket(ptr_data, sno, pkt_len);
             if (error_timeout) { // Test for timeout in usart_getc
                 error_timeout = 0;
                 return (0);
                 //                return (-1);
             }
-            if (b_run == true) {
+            // A bad packet is sent again, instead of ending the transfer
+            if (pkt == PKT_BAD)
+                usart_line_error();
+            usart_putc(pkt == PKT_BAD ? NAK : ACK);
+            if (pkt == PKT_OK) {
                 ++sno;
-                ptr_data += PKTLEN_128;
-                data_transfered += PKTLEN_128;
+                ptr_data += pkt_len;
+                data_transfered += pkt_len;
             }
             break;
         case EOT: // ("E");
@@ -503,3 +643,102 @@ uint32_t usart_getdata_xmd(void *data, uint32_t length) {
     return (true);
     //    return(b_run);
 }
+
+#if USE_YMODEM
+static uint8_t ymodem_buf[PKTLEN_1K];
+
+// Waits for a byte, sending poke about every second meanwhile; -1 after 10 seconds
+static int ymodem_getc(uint8_t poke) {
+    for (int tries = 0; tries < 10; tries++) {
+        if (usart_wait_rx(1000))
+            return usart_getc();
+        usart_putc(poke);
+    }
+    return -1;
+}
+
+static uint32_t parse_decimal(const char *p) {
+    uint32_t n = 0;
+    if (*p < '0' || *p > '9')
+        return 0xffffffff;
+    while (*p >= '0' && *p <= '9')
+        n = n * 10 + *p++ - '0';
+    return n;
+}
+
+uint32_t usart_ymodem_receive(const YmodemSink *sink) {
+    uint32_t files = 0, size = 0, offset = 0;
+    uint8_t sno = 0, eots = 0, pkt;
+    uint16_t pkt_len;
+    bool in_file = false;
+
+    error_timeout = 0;
+    mode_of_transfer = 1;
+    usart_putc('C');
+    while (1) {
+        int c = ymodem_getc(in_file ? NAK : 'C');
+        if (c < 0 || c == CAN)
+            break;
+        if (c == EOT && in_file) {
+            // The first EOT is NAKed, as YMODEM asks, in case it was noise
+            if (!eots++) {
+                usart_putc(NAK);
+                continue;
+            }
+            usart_putc(ACK);
+            sink->end();
+            files++;
+            in_file = false;
+            sno = 0;
+            usart_putc('C');
+            continue;
+        }
+        if (c != SOH && c != STX)
+            continue;
+
+        pkt_len = c == STX ? PKTLEN_1K : PKTLEN_128;
+        pkt = getPacket(ymodem_buf, sno, pkt_len);
+        if (pkt == PKT_BAD) {
+            usart_line_error();
+            usart_putc(NAK);
+            continue;
+        }
+        if (pkt == PKT_REPEAT) {
+            usart_putc(ACK);
+            continue;
+        }
+
+        if (in_file) {
+            // The last packet is padded; the size from the header says where the file ends
+            uint32_t n = size - offset < pkt_len ? size - offset : pkt_len;
+            if (n)
+                sink->data(offset, ymodem_buf, n);
+            offset += n;
+            sno++;
+            usart_putc(ACK);
+        } else if (!ymodem_buf[0]) {
+            // An empty name ends the batch
+            usart_putc(ACK);
+            break;
+        } else {
+            // Packet 0: the file name, then its size in decimal (and more we don't need)
+            ymodem_buf[pkt_len - 1] = 0;
+            const char *name = (const char *)ymodem_buf;
+            size = parse_decimal(name + strlen(name) + 1);
+            if (!sink->start(name, size)) {
+                usart_putc(CAN);
+                usart_putc(CAN);
+                break;
+            }
+            usart_putc(ACK);
+            in_file = true;
+            offset = 0;
+            sno = 1;
+            eots = 0;
+            usart_putc('C');
+        }
+    }
+    mode_of_transfer = 0;
+    return files;
+}
+#endif
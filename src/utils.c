@@ -13,9 +13,9 @@ void __attribute__ ((noinline)) delay(uint32_t ms) {
     uint32_t count = ms * (current_cpu_frequency_MHz) * (led_tick_on ? 149: 167);
 #endif
 #ifdef SAMD51
-    // SAMD51 starts up at 48MHz by default, and we set the clock to
-    // 48MHz, so we don't need to adjust for current_cpu_frequency_MHz.
-    uint32_t count = ms * (led_tick_on ? 6353 : 6826);
+    // SAMD51 starts up at 48MHz by default; the multipliers are for 48MHz and scale with
+    // USE_120MHZ once system_init() is done.
+    uint32_t count = ms * ((led_tick_on ? 6353 : 6826) * current_cpu_frequency_MHz / 48);
 #endif
     for (uint32_t i = 1; i < count; ++i) {
         asm volatile("");
@@ -57,6 +57,29 @@ void timerTick(void) {
     }
 }
 
+#if USE_BOOT_PROFILE
+void boot_profile_mark(uint32_t phase) {
+    volatile UF2_BootProfile *prof = UF2_BOOT_PROFILE;
+
+    if (phase == UF2_BOOT_PHASE_MAIN) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        prof->magic = UF2_BOOT_PROFILE_MAGIC;
+        // 48MHz until system_init() raises it, which never happens when we go straight to the app
+        prof->cpu_hz = current_cpu_frequency_MHz * 1000000;
+        prof->count = 0;
+    }
+
+    uint32_t n = prof->count;
+    if (n < UF2_BOOT_PROFILE_MAX) {
+        prof->marks[n].phase = phase;
+        prof->marks[n].cycles = DWT->CYCCNT;
+        prof->count = n + 1;
+    }
+}
+#endif
+
 void panic(int code) {
     logval("PANIC", code);
     while (1) {
@@ -80,6 +103,10 @@ void resetIntoApp() {
     // reset without waiting for double tap (only works for one reset)
     RGBLED_set_color(COLOR_LEAVE);
     *DBL_TAP_PTR = DBL_TAP_MAGIC_QUICK_BOOT;
+#if USE_BANK_SWAP
+    // doesn't return if an update is waiting in the other bank
+    bank_swap_finish();
+#endif
     NVIC_SystemReset();
 }
 
@@ -134,14 +161,31 @@ void logval(const char *lbl, uint32_t v) {
 #endif
 
 static uint32_t now;
+static uint8_t now_ms_ticks;
+volatile uint32_t systick_ms;
 static uint32_t signal_end;
 int8_t led_tick_step = 1;
 volatile bool led_tick_on = false;
 static uint8_t limit = 200;
 
+uint32_t systick_cycles(void) {
+    uint32_t ticks, val;
+
+    // A tick between the two reads shows as a changed count
+    do {
+        ticks = *(volatile uint32_t *)&now;
+        val = SysTick->VAL;
+    } while (ticks != *(volatile uint32_t *)&now);
+    return ticks * (SysTick->LOAD + 1) + SysTick->LOAD - val;
+}
+
 void led_tick() {
     led_tick_on = true;
     now++;
+    if (++now_ms_ticks == 48) {
+        now_ms_ticks = 0;
+        systick_ms++;
+    }
     if (signal_end) {
         if (now == signal_end - 1000) {
             LED_MSC_ON();
@@ -0,0 +1,10 @@
+// Host stand-in for inc/boot_table.h, for test/test_update.c
+#ifndef BOOT_TABLE_H
+#define BOOT_TABLE_H
+
+#include "uf2.h"
+
+bool boot_slot_write_allowed(uint32_t addr);
+void boot_slot_commit(void);
+
+#endif
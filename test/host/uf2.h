@@ -0,0 +1,38 @@
+// Host stand-in for inc/uf2.h, for the host tests: just what src/update.c, src/aes.c and
+// src/sha256.c use. Flash is the array flash[], and reads of flash addresses through memcpy() are
+// sent there.
+#ifndef UF2_H
+#define UF2_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FLASH_ROW_SIZE 256
+#define APP_START_ADDRESS 0x2000
+#define FLASH_SIZE 0x40000
+#define FLASH_BANK_SIZE (FLASH_SIZE / 2)
+#ifndef USE_BANK_SWAP
+#define USE_BANK_SWAP 0
+#endif
+#define USE_SIGNED_IMAGES 0
+
+#include "update.h"
+
+extern uint8_t flash[FLASH_SIZE];
+extern uint32_t timerHigh, resetHorizon;
+
+void flash_write_row(uint32_t *dst, uint32_t *src);
+void flash_erase_pending(uint32_t addr, uint32_t len);
+void bank_write_row(uint32_t addr, uint32_t *src);
+void bank_commit(void);
+void bank_discard(void);
+
+static inline void *host_memcpy(void *dst, const void *src, size_t len) {
+    if ((uintptr_t)src < FLASH_SIZE)
+        src = flash + (uintptr_t)src;
+    return (memcpy)(dst, src, len);
+}
+#define memcpy host_memcpy
+
+#endif
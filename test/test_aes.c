@@ -0,0 +1,62 @@
+// Host tests of the software AES-128 in src/aes.c (the SAMD21 one) against published vectors:
+// make test-host
+#include <stdio.h>
+#include "uf2.h"
+#include "aes.h"
+
+static int failures;
+
+// The memcpy() of test/host/uf2.h wants it; src/aes.c never copies from flash addresses
+uint8_t flash[FLASH_SIZE];
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            failures++;                                                                            \
+        }                                                                                          \
+    } while (0)
+
+// FIPS-197 appendix C.1: a counter block that is the plaintext, over zeros, gives the ciphertext
+static void test_fips197(void) {
+    static const uint8_t key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    static const uint8_t nonce[12] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                                      0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb};
+    static const uint8_t expected[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+                                         0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+    uint8_t data[16] = {0};
+
+    aes_set_key(key);
+    aes_ctr(nonce, 0xccddeeff, data, sizeof(data));
+    CHECK(!memcmp(data, expected, sizeof(data)));
+}
+
+// SP 800-38A F.5.1, CTR-AES128.Encrypt, the first two blocks
+static void test_sp800_38a(void) {
+    static const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    static const uint8_t nonce[12] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5,
+                                      0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb};
+    static const uint8_t expected[32] = {
+        0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+        0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff};
+    uint8_t data[32] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51};
+
+    aes_set_key(key);
+    aes_ctr(nonce, 0xfcfdfeff, data, sizeof(data));
+    CHECK(!memcmp(data, expected, sizeof(data)));
+}
+
+int main(void) {
+    test_fips197();
+    test_sp800_38a();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("aes: ok\n");
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Host tests of the module map checks in src/multiboot.c: make test-host
+#include <stdio.h>
+#include "boot_table.h"
+#include "sha256.h"
+
+static int failures;
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            failures++;                                                                            \
+        }                                                                                          \
+    } while (0)
+
+// Flash, from APP_START_ADDRESS on; multiboot_relocate_module() is the only writer
+static uint8_t flash[FLASH_SIZE];
+
+void flash_write_row(uint32_t *dst, uint32_t *src) {
+    memcpy(flash + (uint32_t)(uintptr_t)dst, src, FLASH_ROW_SIZE);
+}
+
+// Digests aren't tested here
+void sha256_flash(const uint8_t *data, uint32_t len, uint8_t *digest) {
+    memset(digest, 0, SHA256_DIGEST_SIZE);
+}
+
+static void set_flash(ModuleMap *m, uint32_t start, uint32_t end) {
+    m->flash.start = start;
+    m->flash.end = end;
+}
+
+static void set_ram(ModuleMap *m, uint32_t start, uint32_t end) {
+    m->ram.start = start;
+    m->ram.end = end;
+}
+
+static void test_validate_map(void) {
+    ModuleMap map[MB_MAX_MODULES];
+    int bad = -1;
+
+    // In any order
+    memset(map, 0, sizeof(map));
+    set_flash(&map[0], APP_START_ADDRESS + 0x4000, APP_START_ADDRESS + 0x6000);
+    set_flash(&map[1], APP_START_ADDRESS, APP_START_ADDRESS + 0x4000);
+    set_flash(&map[2], APP_START_ADDRESS + 0x8000, APP_END_ADDRESS);
+    CHECK(multiboot_validate_map(map, 3, &bad) == MB_MAP_OK);
+    CHECK(module_map_error == MB_MAP_OK);
+    CHECK(multiboot_validate_map(map, 0, &bad) == MB_MAP_OK);
+
+    // Overlap with a module that comes earlier in the table, but later in flash
+    set_flash(&map[1], APP_START_ADDRESS, APP_START_ADDRESS + 0x4004);
+    CHECK(multiboot_validate_map(map, 3, &bad) == MB_MAP_FLASH_OVERLAP);
+    CHECK(bad == 0);
+    CHECK(module_map_error == (0 << 8 | MB_MAP_FLASH_OVERLAP));
+    // A module inside another one
+    set_flash(&map[1], APP_START_ADDRESS, APP_START_ADDRESS + 0x4000);
+    set_flash(&map[3], APP_START_ADDRESS + 0x9000, APP_START_ADDRESS + 0xa000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_OVERLAP);
+    CHECK(bad == 3);
+    // Same start
+    set_flash(&map[3], APP_START_ADDRESS + 0x4000, APP_START_ADDRESS + 0x4100);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_OVERLAP);
+    CHECK(bad == 0 || bad == 3);
+
+    // Out of range: over the bootloader, over the boot table, past the end, empty, wrapped
+    set_flash(&map[3], APP_START_ADDRESS - FLASH_ROW_SIZE, APP_START_ADDRESS);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_RANGE);
+    CHECK(bad == 3);
+    set_flash(&map[3], APP_END_ADDRESS - 0x100, APP_END_ADDRESS + 4);
+    set_flash(&map[2], APP_START_ADDRESS + 0x8000, APP_START_ADDRESS + 0x9000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_RANGE);
+    set_flash(&map[3], FLASH_SIZE, FLASH_SIZE + 0x1000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_RANGE);
+    set_flash(&map[3], APP_START_ADDRESS + 0xa000, APP_START_ADDRESS + 0xa000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_RANGE);
+    set_flash(&map[3], APP_START_ADDRESS + 0xb000, APP_START_ADDRESS + 0xa000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_FLASH_RANGE);
+    CHECK(bad == 3);
+
+    // Alignment: of the words, to the alignment tag, and of the tag itself
+    set_flash(&map[3], APP_START_ADDRESS + 0xa002, APP_START_ADDRESS + 0xb000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_MISALIGNED);
+    set_flash(&map[3], APP_START_ADDRESS + 0xa100, APP_START_ADDRESS + 0xb000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_OK);
+    map[3].align = 0x1000;
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_MISALIGNED);
+    CHECK(bad == 3);
+    map[3].align = 0x100;
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_OK);
+    map[3].align = 0x300;
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_MISALIGNED);
+    map[3].align = 0;
+
+    // SRAM: modules without an address tag don't take any
+    set_ram(&map[0], RAM_START, RAM_START + 0x1000);
+    set_ram(&map[2], RAM_START + 0x1000, RAM_START + 0x1800);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_OK);
+    set_ram(&map[3], RAM_START + 0x1400, RAM_START + 0x2000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_RAM_OVERLAP);
+    CHECK(bad == 3);
+    set_ram(&map[3], RAM_START - 0x100, RAM_START);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_RAM_RANGE);
+    // The boot state at the top of SRAM has to survive the jump
+    set_ram(&map[3], RAM_START + 0x2000, (uint32_t)DBL_TAP_PTR + 4);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_RAM_RANGE);
+    CHECK(bad == 3);
+    set_ram(&map[3], RAM_START + 0x3000, RAM_START + 0x2000);
+    CHECK(multiboot_validate_map(map, 4, &bad) == MB_MAP_RAM_RANGE);
+    CHECK(module_map_error == (3 << 8 | MB_MAP_RAM_RANGE));
+}
+
+static void test_pick_load_addr(void) {
+    MultibootRelocatableTag tag = {0, 0xffffffff, 0, MB_RELOC_PREFERENCE_LOWEST, 0};
+    uint32_t len = 3 * MB_LOAD_ALIGN - 0x10;
+
+    // Clamped to the application flash, aligned to at least MB_LOAD_ALIGN
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) == APP_START_ADDRESS);
+    tag.preference = MB_RELOC_PREFERENCE_HIGHEST;
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) == APP_END_ADDRESS - 3 * MB_LOAD_ALIGN);
+
+    // Around the module that is already there
+    uint32_t avoid = APP_START_ADDRESS + 4 * MB_LOAD_ALIGN;
+    tag.preference = MB_RELOC_PREFERENCE_LOWEST;
+    tag.min_addr = avoid + 0x10;
+    CHECK(multiboot_pick_load_addr(&tag, len, avoid, avoid + 2 * MB_LOAD_ALIGN) ==
+          avoid + 2 * MB_LOAD_ALIGN);
+    tag.min_addr = 0;
+    tag.preference = MB_RELOC_PREFERENCE_HIGHEST;
+    tag.max_addr = avoid + MB_LOAD_ALIGN;
+    CHECK(multiboot_pick_load_addr(&tag, len, avoid, avoid + 2 * MB_LOAD_ALIGN) ==
+          avoid - 3 * MB_LOAD_ALIGN);
+    // No room below it
+    tag.min_addr = avoid - 2 * MB_LOAD_ALIGN;
+    CHECK(multiboot_pick_load_addr(&tag, len, avoid, avoid + 2 * MB_LOAD_ALIGN) == 0);
+    // No room at all
+    tag.min_addr = APP_START_ADDRESS;
+    tag.max_addr = APP_START_ADDRESS + 2 * MB_LOAD_ALIGN;
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) == 0);
+    tag.max_addr = 0xffffffff;
+    CHECK(multiboot_pick_load_addr(&tag, FLASH_SIZE, 0, 0) == 0);
+    tag.min_addr = FLASH_SIZE;
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) == 0);
+
+    // Alignment from the tag, which has to be a power of two
+    tag.min_addr = APP_START_ADDRESS + 0x10;
+    tag.preference = MB_RELOC_PREFERENCE_LOWEST;
+    tag.align = 8 * MB_LOAD_ALIGN;
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) % (8 * MB_LOAD_ALIGN) == 0);
+    tag.align = 3 * MB_LOAD_ALIGN;
+    CHECK(multiboot_pick_load_addr(&tag, len, 0, 0) == 0);
+}
+
+// max_addr is exclusive, both when picking an address and when keeping the one a module has
+static void test_tag_bounds(void) {
+    MultibootRelocatableTag tag = {APP_START_ADDRESS, APP_START_ADDRESS + 4 * MB_LOAD_ALIGN, 0,
+                                   MB_RELOC_PREFERENCE_HIGHEST, 0};
+    uint32_t addr = multiboot_pick_load_addr(&tag, MB_LOAD_ALIGN, 0, 0);
+
+    CHECK(addr == APP_START_ADDRESS + 3 * MB_LOAD_ALIGN);
+    CHECK(multiboot_tag_allows(&tag, addr, MB_LOAD_ALIGN));
+    CHECK(!multiboot_tag_allows(&tag, addr + 4, MB_LOAD_ALIGN));
+    CHECK(!multiboot_tag_allows(&tag, APP_START_ADDRESS - 4, 8));
+    CHECK(!multiboot_tag_allows(&tag, APP_START_ADDRESS, 0xffffffff));
+}
+
+static void test_relocate(void) {
+    uint32_t image[300];
+    struct {
+        MultibootRelocTable table;
+        uint16_t entries[3];
+    } rel = {{MB_RELOC_MAGIC, 0x1000, sizeof(image), 3}, {1, 2, 296}};
+    uint32_t load_addr = APP_START_ADDRESS + MB_LOAD_ALIGN;
+    const uint32_t *out = (const uint32_t *)(flash + load_addr);
+
+    for (int i = 0; i < 300; i++)
+        image[i] = i;
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, sizeof(rel), load_addr) == 0);
+    // Fixups at words 1, 3 and 299, the last one in the second row
+    CHECK(out[0] == 0 && out[2] == 2 && out[298] == 298);
+    CHECK(out[1] == 1 + load_addr - 0x1000);
+    CHECK(out[3] == 3 + load_addr - 0x1000);
+    CHECK(out[299] == 299 + load_addr - 0x1000);
+    // Padded to the row
+    CHECK(out[300] == 0xffffffff);
+    // Only to whole rows, and only fixups inside the image
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, sizeof(rel), load_addr + 4) != 0);
+    rel.entries[2] = 297;
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, sizeof(rel), load_addr) != 0);
+    // A table that claims more entries than the module holds isn't walked
+    rel.entries[2] = 296;
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, sizeof(rel.table) + 4, load_addr) != 0);
+    rel.table.num_entries = 0x40000000;
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, sizeof(rel), load_addr) != 0);
+    CHECK(multiboot_relocate_module((uint8_t *)image, &rel.table, 4, load_addr) != 0);
+}
+
+int main(void) {
+    test_validate_map();
+    test_pick_load_addr();
+    test_tag_bounds();
+    test_relocate();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("multiboot: ok\n");
+    return 0;
+}
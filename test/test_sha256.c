@@ -0,0 +1,92 @@
+// Host tests of the software SHA-256 in src/sha256.c (the SAMD21 one, and the SAMD51's fallback)
+// against FIPS 180-4 examples and digests from Python's hashlib: make test-host
+#include <stdio.h>
+#include "uf2.h"
+#include "sha256.h"
+
+static int failures;
+
+// The memcpy() of test/host/uf2.h wants it; nothing is hashed from flash addresses here
+uint8_t flash[FLASH_SIZE];
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            failures++;                                                                            \
+        }                                                                                          \
+    } while (0)
+
+static bool digest_is(const uint8_t *digest, const char *hex) {
+    char out[2 * SHA256_DIGEST_SIZE + 1];
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+        sprintf(out + 2 * i, "%02x", digest[i]);
+    return !strcmp(out, hex);
+}
+
+static void test_examples(void) {
+    static const char two_block[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    sha256_flash((const uint8_t *)"abc", 3, digest);
+    CHECK(digest_is(digest, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+    sha256_flash((const uint8_t *)"", 0, digest);
+    CHECK(digest_is(digest, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    sha256_flash((const uint8_t *)two_block, sizeof(two_block) - 1, digest);
+    CHECK(digest_is(digest, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+    // The ones the SAMD51 checks its ICM with
+    CHECK(sha256_self_test());
+}
+
+// Lengths around the padding boundaries, where the length goes into the same block or the next
+static void test_padding(void) {
+    static const struct {
+        uint32_t len;
+        const char *hex;
+    } cases[] = {
+        {55, "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+        {56, "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a"},
+        {64, "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb"},
+        {119, "31eba51c313a5c08226adf18d4a359cfdfd8d2e816b13f4af952f7ea6584dcfb"},
+        {120, "2f3d335432c70b580af0e8e1b3674a7c020d683aa5f73aaaedfdc55af904c21c"},
+    };
+    uint8_t data[120], digest[SHA256_DIGEST_SIZE];
+
+    memset(data, 'a', sizeof(data));
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        sha256_flash(data, cases[i].len, digest);
+        CHECK(digest_is(digest, cases[i].hex));
+    }
+}
+
+// A million 'a's, fed in uneven pieces, as the streamed signature check feeds it
+static void test_million(void) {
+    static uint8_t data[1000];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t left = 1000000, piece = 1;
+    Sha256 ctx;
+
+    memset(data, 'a', sizeof(data));
+    sha256_init(&ctx);
+    while (left) {
+        uint32_t n = piece < left ? piece : left;
+        sha256_update(&ctx, data, n);
+        left -= n;
+        piece = piece * 7 % 997 + 1;
+    }
+    sha256_final(&ctx, digest);
+    CHECK(digest_is(digest, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"));
+}
+
+int main(void) {
+    test_examples();
+    test_padding();
+    test_million();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("sha256: ok\n");
+    return 0;
+}
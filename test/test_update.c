@@ -0,0 +1,234 @@
+// Host tests of the update engine in src/update.c, against the stubs in test/host: make test-host
+// builds it with and without USE_BANK_SWAP
+#include <stdio.h>
+#include "boot_table.h"
+
+static int failures;
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond);                                      \
+            failures++;                                                                            \
+        }                                                                                          \
+    } while (0)
+
+// The boot slot running above this one can't be written
+#define WRITABLE_END 0x30000
+
+uint8_t flash[FLASH_SIZE];
+// What went to the inactive bank, at the address of the running one
+static uint8_t bank[FLASH_SIZE];
+uint32_t timerHigh, resetHorizon;
+static uint32_t row_writes, bank_writes, commits;
+// Whether the next reset would swap the inactive bank in
+static bool bank_armed;
+
+void flash_write_row(uint32_t *dst, uint32_t *src) {
+    uint32_t addr = (uint32_t)(uintptr_t)dst;
+
+    CHECK(addr % FLASH_ROW_SIZE == 0 && addr >= APP_START_ADDRESS && addr < WRITABLE_END);
+    (memcpy)(flash + addr, src, FLASH_ROW_SIZE);
+    row_writes++;
+}
+
+void bank_write_row(uint32_t addr, uint32_t *src) {
+    CHECK(addr % FLASH_ROW_SIZE == 0 && addr >= APP_START_ADDRESS && addr < WRITABLE_END);
+    (memcpy)(bank + addr, src, FLASH_ROW_SIZE);
+    bank_writes++;
+}
+
+void bank_commit(void) {
+    bank_armed = true;
+}
+
+void bank_discard(void) {
+    bank_armed = false;
+}
+
+// Nothing is marked for erasing here
+void flash_erase_pending(uint32_t addr, uint32_t len) {}
+
+bool boot_slot_write_allowed(uint32_t addr) {
+    return addr < WRITABLE_END;
+}
+
+void boot_slot_commit(void) {
+    commits++;
+}
+
+static uint32_t rng = 1;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void fill_random(uint8_t *p, uint32_t len) {
+    while (len--)
+        *p++ = next_random();
+}
+
+// Random writes of any length and alignment from two sessions, interleaved, read back as written
+static void test_merge(void) {
+    static uint8_t ref[FLASH_SIZE];
+    static uint8_t data[700 + 4];
+    UpdateSession raw = {0}, other = {0};
+
+    fill_random(flash, FLASH_SIZE);
+    (memcpy)(ref, flash, FLASH_SIZE);
+    for (int i = 0; i < 5000; i++) {
+        UpdateSession *s = next_random() & 1 ? &raw : &other;
+        uint32_t addr = APP_START_ADDRESS + next_random() % (WRITABLE_END - APP_START_ADDRESS);
+        uint32_t len = 1 + next_random() % 700;
+        // Unaligned sources as well
+        uint8_t *src = data + next_random() % 4;
+
+        if (len > WRITABLE_END - addr)
+            len = WRITABLE_END - addr;
+        fill_random(src, len);
+        CHECK(update_submit(s, addr, src, len));
+        (memcpy)(ref + addr, src, len);
+        if (next_random() % 7 == 0)
+            update_sync(s);
+    }
+    update_sync(&raw);
+    update_sync(&other);
+    CHECK(!(memcmp)(flash, ref, FLASH_SIZE));
+    CHECK(raw.stats.rejected == 0 && other.stats.rejected == 0);
+    CHECK(raw.stats.merged > 0);
+}
+
+static void test_rejected(void) {
+    uint32_t row[FLASH_ROW_SIZE / 4];
+    UpdateSession s = {0};
+
+    memset(row, 0x5a, sizeof(row));
+    memset(flash, 0xff, sizeof(flash));
+    row_writes = 0;
+
+    // The bootloader, the running boot slot, past the end of flash
+    CHECK(!update_submit(&s, APP_START_ADDRESS - FLASH_ROW_SIZE, row, FLASH_ROW_SIZE));
+    CHECK(!update_submit(&s, WRITABLE_END, row, FLASH_ROW_SIZE));
+    CHECK(!update_submit(&s, FLASH_SIZE, row, 4));
+    CHECK(s.stats.rejected == 2 * FLASH_ROW_SIZE + 4);
+    CHECK(row_writes == 0);
+
+    // Straddling the start of the application: only the part inside is written
+    CHECK(!update_submit(&s, APP_START_ADDRESS - 16, row, 32));
+    update_sync(&s);
+    CHECK(s.stats.rejected == 2 * FLASH_ROW_SIZE + 4 + 16);
+    CHECK(flash[APP_START_ADDRESS - 1] == 0xff);
+    CHECK(flash[APP_START_ADDRESS] == 0x5a && flash[APP_START_ADDRESS + 15] == 0x5a);
+    CHECK(flash[APP_START_ADDRESS + 16] == 0xff);
+    CHECK(s.stats.bytes == 2 * FLASH_ROW_SIZE + 4 + 32);
+}
+
+// Staging a row for one session writes out the row another one had staged
+static void test_stage_owner(void) {
+    uint8_t a[8], b[8];
+    UpdateSession s1 = {0}, s2 = {0};
+
+    memset(flash, 0xff, sizeof(flash));
+    memset(a, 1, sizeof(a));
+    memset(b, 2, sizeof(b));
+    row_writes = 0;
+    CHECK(update_submit(&s1, APP_START_ADDRESS + 8, a, sizeof(a)));
+    CHECK(row_writes == 0);
+    CHECK(update_submit(&s2, APP_START_ADDRESS + FLASH_ROW_SIZE, b, sizeof(b)));
+    CHECK(row_writes == 1 && flash[APP_START_ADDRESS + 8] == 1);
+    // Syncing a session with nothing staged writes nothing
+    update_sync(&s1);
+    CHECK(row_writes == 1);
+    update_sync(&s2);
+    CHECK(row_writes == 2 && flash[APP_START_ADDRESS + FLASH_ROW_SIZE] == 2);
+}
+
+static void test_finalize(void) {
+    uint8_t data[16];
+    UpdateSession s;
+
+    memset(data, 3, sizeof(data));
+    timerHigh = 100;
+    update_begin(&s, 0);
+    CHECK(s.stats.started == 100);
+    commits = row_writes = 0;
+    resetHorizon = 0;
+    CHECK(update_submit(&s, APP_START_ADDRESS, data, sizeof(data)));
+    CHECK(update_finalize(&s, 50));
+    // Synced, committed and the reset scheduled
+    CHECK(row_writes == 1 && commits == 1);
+    CHECK(resetHorizon == 150);
+    CHECK(update_progress(&s)->bytes == sizeof(data));
+}
+
+#if USE_BANK_SWAP
+// An image goes to the inactive bank in whole rows: a partial one would be merged with the old one
+static void test_bank_image(void) {
+    uint32_t row[FLASH_ROW_SIZE / 4 + 1];
+    UpdateSession s;
+
+    memset(row, 0x77, sizeof(row));
+    memset(bank, 0xff, sizeof(bank));
+    update_begin(&s, UPDATE_IMAGE);
+    bank_writes = row_writes = 0;
+    CHECK(update_submit(&s, APP_START_ADDRESS, row, FLASH_ROW_SIZE));
+    CHECK(bank_writes == 1 && row_writes == 0);
+    CHECK(bank[APP_START_ADDRESS] == 0x77);
+
+    CHECK(!update_submit(&s, APP_START_ADDRESS + FLASH_ROW_SIZE, row, 16));
+    CHECK(!update_submit(&s, APP_START_ADDRESS + 2 * FLASH_ROW_SIZE + 16, row, FLASH_ROW_SIZE));
+    update_sync(&s);
+    CHECK(s.stats.rejected == 16 + FLASH_ROW_SIZE);
+    CHECK(bank_writes == 1 && row_writes == 0);
+    CHECK(bank[APP_START_ADDRESS + FLASH_ROW_SIZE] == 0xff);
+
+    // A whole row from an unaligned source goes through the row buffer, but isn't partial
+    CHECK(update_submit(&s, APP_START_ADDRESS + FLASH_ROW_SIZE, (uint8_t *)row + 1,
+                        FLASH_ROW_SIZE));
+    CHECK(s.stats.rejected == 16 + FLASH_ROW_SIZE);
+    CHECK(bank_writes == 2 && bank[APP_START_ADDRESS + FLASH_ROW_SIZE] == 0x77);
+}
+
+// Only a finalized image is swapped in: not a synced one, nor a finalized raw session
+static void test_bank_commit(void) {
+    uint32_t row[FLASH_ROW_SIZE / 4];
+    UpdateSession s;
+
+    memset(row, 0x33, sizeof(row));
+    bank_armed = false;
+    update_begin(&s, UPDATE_IMAGE);
+    CHECK(update_submit(&s, APP_START_ADDRESS, row, FLASH_ROW_SIZE));
+    update_sync(&s);
+    CHECK(!bank_armed);
+    CHECK(update_finalize(&s, 0));
+    CHECK(bank_armed);
+
+    // Starting another image drops the one that was waiting
+    update_begin(&s, UPDATE_IMAGE);
+    CHECK(!bank_armed);
+    update_begin(&s, 0);
+    CHECK(update_submit(&s, APP_START_ADDRESS, row, 16));
+    CHECK(update_finalize(&s, 0));
+    CHECK(!bank_armed);
+}
+#endif
+
+int main(void) {
+    test_merge();
+    test_rejected();
+    test_stage_owner();
+    test_finalize();
+#if USE_BANK_SWAP
+    test_bank_image();
+    test_bank_commit();
+#endif
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("update%s: ok\n", USE_BANK_SWAP ? " (bank swap)" : "");
+    return 0;
+}